@@ -7,7 +7,7 @@
  * Contributors  :  Peng Gao  <gn3po4g@outlook.com>
  *               |
  * Created On    : <2023-08-29>
- * Last Modified : <2024-09-05>
+ * Last Modified : <2026-10-18>
  *
  * chsrc 头文件
  * ------------------------------------------------------------*/
@@ -16,9 +16,34 @@
 #include "source.h"
 #include <pthread.h>
 
+#ifndef XY_On_Windows
+  #include <ifaddrs.h>
+  #include <net/if.h>
+  #include <sys/utsname.h>
+#endif
+
+#include <ctype.h>
+#include <errno.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#ifdef XY_On_Linux
+  #include <sys/socket.h>
+  #include <netdb.h>
+  #include <netinet/in.h>
+  #include <linux/tcp.h>
+  #include <linux/fs.h>
+  #include <sys/ioctl.h>
+  #include <sys/syscall.h>
+#endif
+
 #define App_Name "chsrc"
 
 static int chsrc_get_cpucore ();
+static void chsrc_journal_record (const char *path);
+static const char **chsrc_find_target_aliases (const char *input);
 
 bool ProgMode_CMD_Measure = false;
 bool ProgMode_CMD_Reset   = false;
@@ -32,6 +57,46 @@ bool CliOpt_DryRun    = false;
 bool CliOpt_NoColor   = false;
 bool CliOpt_Parallel  = false;
 
+/**
+ * -interface <ifname> 与 -source-ip <addr> 用于在多出口(多网卡)的机器上指定测速所走的路径
+ *
+ * 两者都可以用逗号分隔给出多个值，此时会对每个源在每个出口上分别测速，
+ * 并最终给出最快的 (镜像站, 出口) 组合；-interface all 表示使用所有已启用的非回环网卡
+ *
+ * 这里存放的是直接传给 curl --interface 的值，网卡名以 "if!" 为前缀，地址以 "host!" 为前缀
+ */
+#define Chsrc_Max_Measure_Routes 16
+char *CliOpt_Routes[Chsrc_Max_Measure_Routes] = {0};
+int   CliOpt_Routes_n = 0;
+
+/* 当前正在测速使用的出口，NULL 表示使用默认路由 */
+char *ProgStatus_Measure_Route = NULL;
+
+/* 当前正在测速的目标，用于记录测速历史 */
+const char *ProgStatus_Measure_Target = NULL;
+
+/**
+ * -rank median 时，不使用本次的测速结果排序，而使用历史测速记录中的中位数
+ * (本次结果也会计入历史)，见 chsrc_history_apply_median()
+ */
+bool CliOpt_RankByMedian = false;
+
+/**
+ * -cmd-timeout <秒>，为 chsrc_run() 运行的每条命令设置超时，覆盖各命令的默认值；0 表示不限时
+ * 未指定时为 -1，此时使用 RunOpt 中的超时
+ */
+int CliOpt_Cmd_Timeout = -1;
+
+/**
+ * -refresh=none|metadata|targeted|full，换源后如何刷新，见 chsrc_refresh()
+ */
+#define RefreshPolicy_None     0  // 不刷新
+#define RefreshPolicy_Metadata 1  // 只刷新元数据，如 pacman -Syy, dnf makecache
+#define RefreshPolicy_Targeted 2  // 只刷新本次换源涉及的仓库，不支持时同 metadata
+#define RefreshPolicy_Full     3  // 刷新并升级整个系统，如 pacman -Syyu
+
+int CliOpt_Refresh = RefreshPolicy_Metadata;
+
 /**
  * -local 的含义是启用 *项目级* 换源
  *
@@ -54,6 +119,7 @@ bool CliOpt_Parallel  = false;
 #define Exit_MatinerIssue 3
 #define Exit_FatalBug     4
 #define Exit_FatalUnkownError  5
+#define Exit_Timeout      6
 
 #define chsrc_log(str)   xy_log(App_Name,str)
 #define chsrc_succ(str)  xy_succ(App_Name,str)
@@ -131,7 +197,7 @@ log_check_result (const char *check_what, const char *check_type, bool exist)
  * @translation Done
  */
 void
-log_cmd_result (bool result, int exit_status)
+log_cmd_result (bool result, const XyProc *proc)
 {
   char *run_msg  = NULL;
   char *succ_msg = NULL;
@@ -141,21 +207,28 @@ log_cmd_result (bool result, int exit_status)
     {
       run_msg  = "RUN";
       succ_msg = YesMark " executed successfully";
-      fail_msg = NoMark  " executed unsuccessfully, exit status: ";
+      fail_msg = NoMark  " executed unsuccessfully, ";
     }
   else
     {
       run_msg  = "运行";
       succ_msg = YesMark " 命令执行成功";
-      fail_msg = NoMark  " 命令执行失败，退出状态: ";
+      fail_msg = NoMark  " 命令执行失败，";
     }
 
   if (result)
     xy_log_brkt (green (App_Name), bdgreen (run_msg), green (succ_msg));
   else
     {
-      char buf[8] = {0};
-      sprintf (buf, "%d", exit_status);
+      char buf[64] = {0};
+      if (proc->timed_out)
+        sprintf (buf, CliOpt_InEnglish ? "timed out, process group killed" : "运行超时，已终止其进程组");
+      else if (proc->signal)
+        sprintf (buf, CliOpt_InEnglish ? "killed by signal %d" : "被信号 %d 终止", proc->signal);
+      else if (127==proc->exit_code)
+        sprintf (buf, CliOpt_InEnglish ? "command not found (127)" : "命令不存在 (127)");
+      else
+        sprintf (buf, CliOpt_InEnglish ? "exit code: %d" : "退出码: %d", proc->exit_code);
       char *log = xy_2strjoin (red (fail_msg), bdred (buf));
       xy_log_brkt (red (App_Name), bdred (run_msg), log);
     }
@@ -171,6 +244,28 @@ is_url (const char *str)
 
 
 
+/**
+ * chsrc 的缓存目录
+ *
+ * Windows 上为 %LOCALAPPDATA%\chsrc，其他平台为 $XDG_CACHE_HOME/chsrc 或 ~/.cache/chsrc
+ */
+char *
+chsrc_cache_dir ()
+{
+  if (xy_on_windows)
+    {
+      char *local = getenv ("LOCALAPPDATA");
+      if (local && *local)
+        return xy_2strjoin (local, "\\chsrc");
+      return xy_2strjoin (xy_os_home, "\\AppData\\Local\\chsrc");
+    }
+
+  char *xdg = getenv ("XDG_CACHE_HOME");
+  if (xdg && *xdg)
+    return xy_2strjoin (xdg, "/chsrc");
+  return xy_2strjoin (xy_os_home, "/.cache/chsrc");
+}
+
 #define Quiet_When_Exist    0x00
 #define Noisy_When_Exist    0x01
 #define Quiet_When_NonExist 0x00
@@ -192,20 +287,20 @@ query_program_exist (char *check_cmd, char *prog_name, int mode)
 {
   char *which = check_cmd;
 
-  int status = system (which);
+  XyProc proc = xy_spawn_cmd (which, XyProc_Quiet);
 
   // char buf[32] = {0}; sprintf(buf, "错误码: %d", status);
 
   char *msg = CliOpt_InEnglish ? "command" : "命令";
 
-  if (0 != status)
+  if (!xy_proc_succ (&proc))
     {
       if (mode & Noisy_When_NonExist)
         {
           // xy_warn (xy_strjoin(4, "× 命令 ", progname, " 不存在，", buf));
           log_check_result (prog_name, msg, false);
-          return false;
         }
+      return false;
     }
   else
     {
@@ -216,6 +311,310 @@ query_program_exist (char *check_cmd, char *prog_name, int mode)
 }
 
 
+/**
+ * 程序查找结果的缓存，在整个进程生命周期内有效
+ */
+#define Chsrc_Max_Program_Cache 64
+
+typedef struct ProgramCacheEntry_t {
+  char *name;
+  char *path;  /* 不存在时为 NULL */
+} ProgramCacheEntry;
+
+static ProgramCacheEntry ProgStatus_Program_Cache[Chsrc_Max_Program_Cache];
+static int               ProgStatus_Program_Cache_n = 0;
+
+/* chsrc_detect_programs() 会从多个线程访问 Program_Cache 与 Tool_Cache */
+static pthread_mutex_t   ProgStatus_Program_Cache_Lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * 在 PATH 中查找程序，结果会被缓存，不会运行该程序
+ *
+ * @return 程序的完整路径，不存在时返回 NULL
+ */
+char *
+chsrc_which (const char *prog_name)
+{
+  pthread_mutex_lock (&ProgStatus_Program_Cache_Lock);
+  for (int i=0; i<ProgStatus_Program_Cache_n; i++)
+    {
+      if (xy_streql (ProgStatus_Program_Cache[i].name, prog_name))
+        {
+          char *cached = ProgStatus_Program_Cache[i].path;
+          pthread_mutex_unlock (&ProgStatus_Program_Cache_Lock);
+          return cached;
+        }
+    }
+  pthread_mutex_unlock (&ProgStatus_Program_Cache_Lock);
+
+  /* 查找 PATH 时不持有锁，多个线程可同时查找不同的程序 */
+  char *path = xy_which (prog_name);
+
+  pthread_mutex_lock (&ProgStatus_Program_Cache_Lock);
+  if (ProgStatus_Program_Cache_n < Chsrc_Max_Program_Cache)
+    {
+      ProgramCacheEntry entry = { xy_strdup (prog_name), path };
+      ProgStatus_Program_Cache[ProgStatus_Program_Cache_n++] = entry;
+    }
+  pthread_mutex_unlock (&ProgStatus_Program_Cache_Lock);
+  return path;
+}
+
+/**
+ * 程序输出的持久缓存
+ *
+ * 许多 recipe 只是为了读取版本号 (或 Maven home 这类从版本信息推得的内容) 就要运行一次
+ * 解释器或 JVM。这里将 `prog args` 的 stdout 缓存在 chsrc_cache_dir() 下的 tools 文件中，
+ * 以 (程序完整路径, mtime, 大小, args) 为键，程序被升级或替换后自然失效
+ *
+ * corepack 的 shim (yarn, pnpm) 按当前项目 package.json 中的 packageManager 决定实际运行的版本，
+ * 其输出与程序文件本身无关，所以不缓存，见 tool_cache_is_shim()
+ *
+ * 文件每行一条记录，以制表符分隔各字段，输出中的 '\\'、'\t'、'\n' 被转义
+ */
+#define Chsrc_Max_Tool_Cache 256
+
+typedef struct ToolCacheEntry_t {
+  char     *path;
+  long long mtime;
+  long long size;
+  char     *args;
+  char     *output;
+} ToolCacheEntry;
+
+static ToolCacheEntry ProgStatus_Tool_Cache[Chsrc_Max_Tool_Cache];
+static int            ProgStatus_Tool_Cache_n = -1;  /* -1 表示尚未读取缓存文件 */
+
+static char *
+tool_cache_path ()
+{
+  return xy_2strjoin (chsrc_cache_dir (), xy_on_windows ? "\\tools" : "/tools");
+}
+
+static char *
+tool_cache_escape (const char *str)
+{
+  char *ret = xy_malloc0 (strlen (str) * 2 + 1);
+  char *cur = ret;
+  for (const char *p = str; *p; p++)
+    {
+      if      ('\\'==*p) { *cur++ = '\\'; *cur++ = '\\'; }
+      else if ('\t'==*p)  { *cur++ = '\\'; *cur++ = 't'; }
+      else if ('\n'==*p)  { *cur++ = '\\'; *cur++ = 'n'; }
+      else *cur++ = *p;
+    }
+  return ret;
+}
+
+static char *
+tool_cache_unescape (const char *str)
+{
+  char *ret = xy_malloc0 (strlen (str) + 1);
+  char *cur = ret;
+  for (const char *p = str; *p; p++)
+    {
+      if ('\\'==*p && p[1])
+        {
+          p++;
+          *cur++ = 't'==*p ? '\t' : ('n'==*p ? '\n' : *p);
+        }
+      else *cur++ = *p;
+    }
+  return ret;
+}
+
+static void
+tool_cache_load ()
+{
+  ProgStatus_Tool_Cache_n = 0;
+
+  FILE *f = fopen (tool_cache_path (), "r");
+  if (!f) return;
+
+  XyProc content = {0};
+  char buf[4096];
+  size_t n, cap = 0;
+  while ((n = fread (buf, 1, sizeof buf, f)) > 0)
+    {
+      if (content.out_len + n + 1 > cap)
+        content.out = realloc (content.out, cap = (content.out_len + n + 1) * 2);
+      memcpy (content.out + content.out_len, buf, n);
+      content.out_len += n;
+      content.out[content.out_len] = '\0';
+    }
+  fclose (f);
+  if (!content.out) return;
+
+  char *next = NULL;
+  for (char *line = content.out; *line; line = next)
+    {
+      next = strchr (line, '\n');
+      if (next) *next++ = '\0';
+      else next = line + strlen (line);
+
+      if (ProgStatus_Tool_Cache_n >= Chsrc_Max_Tool_Cache) break;
+
+      char *field[5] = {0};
+      char *cur = line;
+      int i = 0;
+      for (; i<5 && cur; i++)
+        {
+          field[i] = cur;
+          cur = strchr (cur, '\t');
+          if (cur) *cur++ = '\0';
+        }
+      if (i < 5) continue;
+
+      ToolCacheEntry e;
+      e.path   = tool_cache_unescape (field[0]);
+      e.mtime  = atoll (field[1]);
+      e.size   = atoll (field[2]);
+      e.args   = tool_cache_unescape (field[3]);
+      e.output = tool_cache_unescape (field[4]);
+      ProgStatus_Tool_Cache[ProgStatus_Tool_Cache_n++] = e;
+    }
+  xy_proc_free (&content);
+}
+
+/**
+ * 整体重写缓存文件，先写临时文件再改名
+ */
+static void
+tool_cache_save ()
+{
+  if (!xy_mkdir_p (chsrc_cache_dir ()))
+    return;
+
+  /* 多个 chsrc 可能同时保存，交给 xy_file_write() 经由各自独有的临时文件原子地替换 */
+  XyLineBuf sb = {0};
+  for (int i=0; i<ProgStatus_Tool_Cache_n; i++)
+    {
+      ToolCacheEntry *e = &ProgStatus_Tool_Cache[i];
+      char nums[64];
+      sprintf (nums, "\t%lld\t%lld\t", e->mtime, e->size);
+      char *line = xy_strjoin (6, tool_cache_escape (e->path), nums, tool_cache_escape (e->args),
+                                  "\t", tool_cache_escape (e->output), "\n");
+      _xy_strbuf_append (&sb, line, strlen (line));
+    }
+
+  xy_file_write (tool_cache_path (), sb.buf ? sb.buf : "", sb.len);
+  free (sb.buf);
+}
+
+/**
+ * 程序是否为 corepack 的 shim：其解析后的路径或文件开头提到 corepack
+ * (Windows 上的 shim 是调用 corepack 的 .cmd 脚本)
+ */
+static bool
+tool_cache_is_shim (const char *path)
+{
+#ifndef XY_On_Windows
+  char real[PATH_MAX];
+  if (realpath (path, real) && strstr (real, "corepack"))
+    return true;
+#endif
+
+  FILE *f = fopen (path, "rb");
+  if (!f) return false;
+  char head[4096];
+  size_t n = fread (head, 1, sizeof head - 1, f);
+  fclose (f);
+  head[n] = '\0';
+  /* 二进制文件中可能有 '\0'，只看其前的部分即可 */
+  return NULL!=strstr (head, "corepack");
+}
+
+/**
+ * 获取 `prog_name args` 的标准输出，优先使用缓存
+ *
+ * @return 程序不存在或运行失败时返回 NULL
+ */
+char *
+chsrc_program_output (char *prog_name, const char *args)
+{
+  char *path = chsrc_which (prog_name);
+  if (!path) return NULL;
+
+  struct stat st;
+  if (0!=stat (path, &st)) return NULL;
+  long long mtime = (long long) st.st_mtime;
+  long long size  = (long long) st.st_size;
+  bool cacheable  = !tool_cache_is_shim (path);
+
+  pthread_mutex_lock (&ProgStatus_Program_Cache_Lock);
+  if (ProgStatus_Tool_Cache_n < 0)
+    tool_cache_load ();
+
+  for (int i=0; cacheable && i<ProgStatus_Tool_Cache_n; i++)
+    {
+      ToolCacheEntry *e = &ProgStatus_Tool_Cache[i];
+      if (xy_streql (e->path, path) && xy_streql (e->args, args)
+          && e->mtime==mtime && e->size==size)
+        {
+          char *cached = e->output;
+          pthread_mutex_unlock (&ProgStatus_Program_Cache_Lock);
+          return cached;
+        }
+    }
+  pthread_mutex_unlock (&ProgStatus_Program_Cache_Lock);
+
+  /* 运行程序时不持有锁 */
+  char *cmd = xy_strjoin (4, "\"", path, "\" ", args);
+  XyProc proc = xy_spawn_cmd (cmd, XyProc_Capture_Stdout | XyProc_Capture_Stderr);
+  if (!xy_proc_succ (&proc) || !proc.out)
+    {
+      xy_proc_free (&proc);
+      return NULL;
+    }
+
+  ToolCacheEntry e = { xy_strdup (path), mtime, size, xy_strdup (args), xy_strdup (proc.out) };
+  xy_proc_free (&proc);
+  if (!cacheable) return e.output;
+
+  pthread_mutex_lock (&ProgStatus_Program_Cache_Lock);
+  int stale = -1;
+  for (int i=0; i<ProgStatus_Tool_Cache_n; i++)
+    {
+      ToolCacheEntry *cur = &ProgStatus_Tool_Cache[i];
+      if (xy_streql (cur->path, path) && xy_streql (cur->args, args))
+        stale = i;
+    }
+
+  if (stale >= 0)
+    ProgStatus_Tool_Cache[stale] = e;
+  else if (ProgStatus_Tool_Cache_n < Chsrc_Max_Tool_Cache)
+    ProgStatus_Tool_Cache[ProgStatus_Tool_Cache_n++] = e;
+  else
+    {
+      /* 已满时丢弃最旧的一条 */
+      memmove (ProgStatus_Tool_Cache, ProgStatus_Tool_Cache + 1, sizeof (ToolCacheEntry) * (Chsrc_Max_Tool_Cache - 1));
+      ProgStatus_Tool_Cache[Chsrc_Max_Tool_Cache - 1] = e;
+    }
+
+  tool_cache_save ();
+  pthread_mutex_unlock (&ProgStatus_Program_Cache_Lock);
+  return e.output;
+}
+
+
+/**
+ * 检测程序是否存在，只查找 PATH 而不运行 `prog_name --version`
+ */
+static bool
+query_program_in_path (char *prog_name, int mode)
+{
+  char *msg = CliOpt_InEnglish ? "command" : "命令";
+  bool exist = NULL!=chsrc_which (prog_name);
+
+  if (exist && (mode & Noisy_When_Exist))
+    log_check_result (prog_name, msg, true);
+  else if (!exist && (mode & Noisy_When_NonExist))
+    log_check_result (prog_name, msg, false);
+
+  return exist;
+}
+
+
 /**
  * @note
  *  1. 一般只在 Recipe 中使用，显式检测每一个需要用到的 program
@@ -225,22 +624,20 @@ query_program_exist (char *check_cmd, char *prog_name, int mode)
 bool
 chsrc_check_program (char *prog_name)
 {
-  char *quiet_cmd = xy_str_to_quietcmd (xy_2strjoin (prog_name, " --version"));
-  return query_program_exist (quiet_cmd, prog_name, Noisy_When_Exist|Noisy_When_NonExist);
+  return query_program_in_path (prog_name, Noisy_When_Exist|Noisy_When_NonExist);
 }
 
 /**
  * @note
  *  1. 此函数没有强制性，只返回检查结果
  *  2. 无论存在与否，**均不输出**
- *  3. 此函数只能对接受 --version 选项的命令行程序有效
+ *  3. 只在 PATH 中查找，并不运行该程序
  *
  */
 bool
 chsrc_check_program_quietly (char *prog_name)
 {
-  char *quiet_cmd = xy_str_to_quietcmd (xy_2strjoin (prog_name, " --version"));
-  return query_program_exist (quiet_cmd, prog_name, Quiet_When_Exist|Quiet_When_NonExist);
+  return query_program_in_path (prog_name, Quiet_When_Exist|Quiet_When_NonExist);
 }
 
 /**
@@ -250,8 +647,7 @@ chsrc_check_program_quietly (char *prog_name)
 bool
 chsrc_check_program_quietly_when_exist (char *prog_name)
 {
-  char *quiet_cmd = xy_str_to_quietcmd (xy_2strjoin (prog_name, " --version"));
-  return query_program_exist (quiet_cmd, prog_name, Quiet_When_Exist|Noisy_When_NonExist);
+  return query_program_in_path (prog_name, Quiet_When_Exist|Noisy_When_NonExist);
 }
 
 
@@ -264,8 +660,7 @@ chsrc_check_program_quietly_when_exist (char *prog_name)
 void
 chsrc_ensure_program (char *prog_name)
 {
-  char *quiet_cmd = xy_str_to_quietcmd (xy_2strjoin (prog_name, " --version"));
-  bool exist = query_program_exist (quiet_cmd, prog_name, Quiet_When_Exist|Noisy_When_NonExist);
+  bool exist = query_program_in_path (prog_name, Quiet_When_Exist|Noisy_When_NonExist);
   if (exist)
     {
       // OK, nothing should be done
@@ -280,6 +675,72 @@ chsrc_ensure_program (char *prog_name)
 }
 
 
+/**
+ * 一个 target 所依赖的某个程序的检测项，交给 chsrc_detect_programs() 并发检测
+ */
+typedef struct ProgramProbe_t {
+  char       *name;
+  const char *args;   /* 非 NULL 时一并获取 `name args` 的输出，如 "--version" */
+
+  /* 以下为检测结果 */
+  bool        exist;
+  char       *path;
+  char       *output; /* 仅在 args 非 NULL 且运行成功时有值 */
+} ProgramProbe;
+
+static void *
+detect_program_thread (void *arg)
+{
+  ProgramProbe *probe = (ProgramProbe *) arg;
+  probe->path  = chsrc_which (probe->name);
+  probe->exist = NULL!=probe->path;
+  if (probe->exist && probe->args)
+    probe->output = chsrc_program_output (probe->name, probe->args);
+  return NULL;
+}
+
+/**
+ * 并发检测一组程序，总耗时取决于最慢的那一个，而不是所有检测之和
+ *
+ * 检测完成后按给定顺序统一输出检测结果，输出与逐个调用 chsrc_check_program() 相同
+ *
+ * @param  noisy  是否输出每个程序的检测结果
+ * @return 存在的程序个数
+ */
+int
+chsrc_detect_programs (ProgramProbe *probes, int n, bool noisy)
+{
+  pthread_t *threads = xy_malloc0 (sizeof (pthread_t) * n);
+  bool      *started = xy_malloc0 (sizeof (bool) * n);
+
+  for (int i=0; i<n; i++)
+    {
+      probes[i].exist  = false;
+      probes[i].path   = NULL;
+      probes[i].output = NULL;
+      started[i] = 0==pthread_create (&threads[i], NULL, detect_program_thread, &probes[i]);
+      /* 无法创建线程时在当前线程检测 */
+      if (!started[i])
+        detect_program_thread (&probes[i]);
+    }
+
+  int found = 0;
+  char *msg = CliOpt_InEnglish ? "command" : "命令";
+  for (int i=0; i<n; i++)
+    {
+      if (started[i])
+        pthread_join (threads[i], NULL);
+      if (probes[i].exist) found++;
+      if (noisy)
+        log_check_result (probes[i].name, msg, probes[i].exist);
+    }
+
+  free (threads);
+  free (started);
+  return found;
+}
+
+
 bool
 chsrc_check_file (char *path)
 {
@@ -404,771 +865,3650 @@ to_human_readable_speed (double speed)
 
 
 /**
- * 测速代码参考自 https://github.com/mirrorz-org/oh-my-mirrorz/blob/master/oh-my-mirrorz.py
- * 功劳和版权属于原作者，由 @ccmywish 修改为C语言，并做了额外调整
- *
- * @return 返回测得的速度，若出错，返回-1
+ * 将 -interface / -source-ip 的值加入测速出口列表
  *
- * 该函数实际原型为 char * (*)(const char*)
+ * @param  value         用户给出的值，可以用逗号分隔多个
+ * @param  is_interface  true 表示值为网卡名，false 表示值为源地址
  */
-void *
-measure_speed_for_url (void *url)
+void
+chsrc_add_measure_routes (const char *value, bool is_interface)
 {
-  char *time_sec = NULL;
-
-  if (CliOpt_Parallel)
-    time_sec = "9";
-  else
-    time_sec = "6";
-
-  /* 现在我们切换至跳转后的链接来测速，不再使用下述判断
-  if (xy_str_start_with(url, "https://registry.npmmirror"))
-    {
-      // 这里 npmmirror 跳转非常慢，需要1~3秒，所以我们给它留够至少8秒测速时间，否则非常不准
-      time_sec = "10";
-    }
-  */
-
-  char *ipv6 = ""; // 默认不启用
+  char *values = xy_strdup (value);
 
-  if (CliOpt_IPv6==true)
+  for (char *tok = strtok (values, ","); tok; tok = strtok (NULL, ","))
     {
-      ipv6 = "--ipv6";
-    }
-
-
-  char *os_devnull = xy_os_devnull;
-  bool on_cygwin = false;
+      if (is_interface && xy_streql (tok, "all"))
+        {
+#ifdef XY_On_Windows
+          char *msg = CliOpt_InEnglish ? "-interface all is not supported on Windows, please specify the interface names"
+                                       : "Windows 上暂不支持 -interface all，请直接指定网卡名";
+          chsrc_error (msg);
+          exit (Exit_Unsupported);
+#else
+          struct ifaddrs *ifs = NULL;
+          if (0!=getifaddrs (&ifs))
+            {
+              char *msg = CliOpt_InEnglish ? "Unable to enumerate network interfaces" : "无法枚举网卡";
+              chsrc_error (msg);
+              exit (Exit_UserCause);
+            }
+          for (struct ifaddrs *ifa = ifs; ifa; ifa = ifa->ifa_next)
+            {
+              if (NULL==ifa->ifa_addr) continue;
+              if (ifa->ifa_flags & IFF_LOOPBACK) continue;
+              if (! (ifa->ifa_flags & IFF_UP) || ! (ifa->ifa_flags & IFF_RUNNING)) continue;
+              int family = ifa->ifa_addr->sa_family;
+              if (family!=AF_INET && family!=AF_INET6) continue;
+
+              /* 同一网卡会因为有多个地址而出现多次 */
+              char *route = xy_2strjoin ("if!", ifa->ifa_name);
+              bool dup = false;
+              for (int i=0; i<CliOpt_Routes_n; i++)
+                if (xy_streql (CliOpt_Routes[i], route)) dup = true;
+
+              if (!dup && CliOpt_Routes_n < Chsrc_Max_Measure_Routes)
+                CliOpt_Routes[CliOpt_Routes_n++] = route;
+            }
+          freeifaddrs (ifs);
+#endif
+          continue;
+        }
 
-  // https://github.com/RubyMetric/chsrc/issues/65
-  // curl (仅)在 Cygwin 上 -o nul 会把 nul 当做普通文件
-  // 为了践行 chsrc everywhere 的承诺，我们也考虑支持 Cygwin
-  if (0==system ("cygcheck --version>nul"))
-    {
-      on_cygwin = true;
-      os_devnull = "/tmp/chsrc-measure-downloaded";
+      if (CliOpt_Routes_n >= Chsrc_Max_Measure_Routes)
+        {
+          char *msg = CliOpt_InEnglish ? "Too many interfaces/addresses, ignore: " : "指定的网卡/地址过多，忽略: ";
+          chsrc_warn (xy_2strjoin (msg, tok));
+          continue;
+        }
+      CliOpt_Routes[CliOpt_Routes_n++] = xy_2strjoin (is_interface ? "if!" : "host!", tok);
     }
+}
 
-  // 我们用 —L，因为Ruby China源会跳转到其他地方
-  // npmmirror 也会跳转
-  char *curl_cmd = xy_strjoin (8, "curl -qsL ", ipv6,
-                                  " -o ", os_devnull,
-                                  " -w \"%{http_code} %{speed_download}\" -m", time_sec,
-                                  " -A chsrc/" Chsrc_Banner_Version "  ", url);
-
-  // chsrc_info (xy_2strjoin ("测速命令 ", curl_cmd));
-
-  char *curl_buf = NULL;
+/**
+ * 去掉传给 curl 的前缀，用于向用户展示
+ */
+char *
+chsrc_measure_route_name (const char *route)
+{
+  if (NULL==route)
+    return CliOpt_InEnglish ? "default route" : "默认路由";
 
-  if (on_cygwin)
-    {
-      char *curl_script = ".chsrc_measure_tmp.sh";
-      FILE *f = fopen (curl_script, "w");
-        if (f==NULL)
-          exit (Exit_UserCause);
-      fputs (curl_cmd, f);
-      fclose (f);
-      curl_buf = xy_run ( xy_2strjoin ("bash .\\", curl_script), 0, NULL);
-      system (xy_2strjoin ("del ", curl_script));
-      system (xy_strjoin (3, "bash -c \"rm ", os_devnull, "\""));
-    }
+  if (xy_str_start_with (route, "if!"))
+    return xy_str_delete_prefix (route, "if!");
   else
-    {
-      curl_buf = xy_run (curl_cmd, 0, NULL);
-    }
-
-  // 如果尾部有换行，删除
-  curl_buf = xy_str_strip (curl_buf);
-
-  return curl_buf;
+    return xy_str_delete_prefix (route, "host!");
 }
 
 
 /**
- * @return 返回速度speed
+ * 被测传输所在连接的内核 TCP 指标
+ *
+ * 仅靠吞吐量无法区分「距离远」与「过载丢包」的镜像站。curl 经由 chsrc 自己的中继
+ * 建立到镜像站的连接 (见 measure_relay_start())，这样承载被测传输的套接字由 chsrc 持有，
+ * 传输结束时读取其 TCP_INFO
+ *
+ * 我们是接收端，所以只取接收端有意义的指标
+ */
+typedef struct TcpProbeInfo_t {
+  bool   valid;
+  double rtt_ms;          /* 接收端估计的 RTT (tcpi_rcv_rtt) */
+  unsigned int ooopack;   /* 乱序到达的包数，内核低于 5.4 时为 0 */
+  unsigned int segs_in;   /* 收到的总段数 */
+  double loss;            /* 丢包估计: ooopack / segs_in，接收端看到的乱序大多由丢包造成 */
+} TcpProbeInfo;
+
+/* 一次测速的原始结果 */
+typedef struct MeasureResult_t {
+  int          http_code;
+  double       speed;      /* curl 测得的速度，Byte/s */
+  TcpProbeInfo tcp;
+} MeasureResult;
+
+/**
+ * 单调时钟，单位秒，用于计时
  */
 double
-parse_and_say_curl_result (char *curl_buf)
+chsrc_now_seconds ()
 {
-  // 分隔两部分数据
-  char *split = strchr (curl_buf, ' ');
-  if (split) *split = '\0';
-
-  // say(curl_buf); say(split+1);
-     int http_code = atoi (curl_buf);
-  double     speed = atof (split+1);
-    char *speedstr = to_human_readable_speed (speed);
+#ifdef XY_On_Windows
+  return GetTickCount64 () / 1000.0;
+#else
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
 
-  if (200!=http_code)
-    {
-      char *http_code_str = yellow (xy_2strjoin ("HTTP码 ", curl_buf));
-      say (xy_strjoin (3, speedstr, " | ",  http_code_str));
-    }
-  else
+#ifdef XY_On_Linux
+/**
+ * 连接 host:port，若指定了测速出口则绑定到该网卡/地址
+ *
+ * @param  timeout_sec  连接的时限，连接后也作为收发的时限
+ *
+ * @return 套接字，失败时返回 -1
+ */
+static int
+measure_connect (const char *host, const char *port, int timeout_sec)
+{
+  struct addrinfo hints = {0}, *res = NULL;
+  hints.ai_family   = CliOpt_IPv6 ? AF_INET6 : AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (0!=getaddrinfo (host, port, &hints, &res))
+    return -1;
+
+  int fd = -1;
+  for (struct addrinfo *ai = res; ai; ai = ai->ai_next)
     {
-      say (speedstr);
+      fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (fd < 0) continue;
+
+      /* Linux 上 connect() 受 SO_SNDTIMEO 限制 */
+      struct timeval tv = { timeout_sec, 0 };
+      setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof tv);
+      setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
+      bool bound = true;
+      const char *route = ProgStatus_Measure_Route;
+      if (route && xy_str_start_with (route, "if!"))
+        {
+          const char *ifname = route + strlen ("if!");
+          bound = 0==setsockopt (fd, SOL_SOCKET, SO_BINDTODEVICE, ifname, strlen (ifname));
+        }
+      else if (route && xy_str_start_with (route, "host!"))
+        {
+          struct addrinfo bhints = {0}, *local = NULL;
+          bhints.ai_family   = ai->ai_family;
+          bhints.ai_socktype = SOCK_STREAM;
+          bhints.ai_flags    = AI_NUMERICHOST;
+          bound = 0==getaddrinfo (route + strlen ("host!"), NULL, &bhints, &local)
+                  && 0==bind (fd, local->ai_addr, local->ai_addrlen);
+          if (local) freeaddrinfo (local);
+        }
+
+      if (bound && 0==connect (fd, ai->ai_addr, ai->ai_addrlen))
+        break;
+
+      close (fd);
+      fd = -1;
     }
-  return speed;
+  freeaddrinfo (res);
+  return fd;
 }
 
 
-int
-get_max_ele_idx_in_dbl_ary (double *array, int size)
+/**
+ * 测速中继: 一个只监听 127.0.0.1 的 HTTP CONNECT 代理
+ *
+ * chsrc 不实现 TLS，所以仍由 curl 下载并计算吞吐；curl 以 --proxytunnel 经过中继，
+ * 每次 CONNECT (包括 -L 跳转到的其他主机) 都由中继以 measure_connect() 连接镜像站，
+ * 再原样转发双方的字节。传输结束时，从收到数据最多的那个连接上读取 TCP_INFO
+ *
+ * 每次测速一个中继，在其自己的线程中以 poll() 同时服务多个连接
+ */
+#define Chsrc_Measure_Relay_Max_Conns 8
+
+typedef struct MeasureRelayConn_t {
+  int    client;      /* curl 一侧 */
+  int    upstream;    /* 镜像站一侧，-1 表示尚未收到 CONNECT 请求 */
+  char   head[1024];  /* CONNECT 请求头 */
+  size_t head_len;
+  size_t down;        /* 从镜像站收到的字节数 */
+} MeasureRelayConn;
+
+typedef struct MeasureRelay_t {
+  int       listener;
+  int       stop[2];   /* 写入 stop[1] 使中继线程结束 */
+  int       timeout_sec;
+  pthread_t thread;
+
+  MeasureRelayConn conns[Chsrc_Measure_Relay_Max_Conns];
+  int              conns_n;
+
+  struct tcp_info  best;       /* 收到数据最多的连接的 TCP_INFO */
+  socklen_t        best_len;
+  size_t           best_down;
+} MeasureRelay;
+
+static bool
+relay_send_all (int fd, const char *buf, size_t len)
 {
-  double maxval = array[0];
-  int maxidx = 0;
+  while (len > 0)
+    {
+      ssize_t n = send (fd, buf, len, MSG_NOSIGNAL);
+      if (n < 0 && EINTR==errno) continue;
+      if (n <= 0) return false;
+      buf += n; len -= n;
+    }
+  return true;
+}
 
-  for (int i=1; i<size; i++)
+/**
+ * 关闭第 i 个连接；关闭前若它是目前收到数据最多的连接，记下其 TCP_INFO
+ */
+static void
+relay_close_conn (MeasureRelay *relay, int i)
+{
+  MeasureRelayConn *c = &relay->conns[i];
+  if (c->upstream >= 0)
     {
-      if (array[i]>maxval)
+      struct tcp_info ti;
+      memset (&ti, 0, sizeof ti);
+      socklen_t len = sizeof ti;
+      if (c->down > relay->best_down
+          && 0==getsockopt (c->upstream, IPPROTO_TCP, TCP_INFO, &ti, &len))
         {
-          maxval = array[i];
-          maxidx = i;
+          relay->best      = ti;
+          relay->best_len  = len;
+          relay->best_down = c->down;
         }
+      close (c->upstream);
     }
-  return maxidx;
+  close (c->client);
+  relay->conns[i] = relay->conns[--relay->conns_n];
 }
 
-
 /**
- * @param      sources        所有待测源
- * @param      size           待测源的数量
- * @param[out] speed_records  速度值记录
+ * 处理 CONNECT host:port HTTP/1.1，连接镜像站并回复 curl
+ *
+ * @return 连接是否可继续使用
  */
-void
-measure_speed_for_every_source (SourceInfo sources[], int size, double speed_records[])
+static bool
+relay_open_upstream (MeasureRelay *relay, MeasureRelayConn *c)
 {
-    bool get_measured[size]; /* 是否测速了 */
-     int get_measured_n = 0; /* 测速了几个 */
-   char *measure_msgs[size];
+  c->head[c->head_len] = '\0';
+  char target[512] = {0};
+  if (1!=sscanf (c->head, "CONNECT %511s HTTP/", target))
+    return false;
+
+  /* 形如 host:port 或 [IPv6]:port */
+  char *colon = strrchr (target, ':');
+  if (!colon) return false;
+  *colon = '\0';
+  char *host = target;
+  if ('['==host[0])
+    {
+      host++;
+      char *end = strchr (host, ']');
+      if (end) *end = '\0';
+    }
 
-  double speed = 0.0;
+  c->upstream = measure_connect (host, colon + 1, relay->timeout_sec);
+  if (c->upstream < 0)
+    {
+      relay_send_all (c->client, "HTTP/1.1 502 Bad Gateway\r\n\r\n", strlen ("HTTP/1.1 502 Bad Gateway\r\n\r\n"));
+      return false;
+    }
 
-  pthread_t *threads = xy_malloc0 (sizeof(pthread_t) * size);
+  const char *ok = "HTTP/1.1 200 Connection established\r\n\r\n";
+  return relay_send_all (c->client, ok, strlen (ok));
+}
 
-  for (int i=0; i<size; i++)
+static void *
+measure_relay_thread (void *arg)
+{
+  MeasureRelay *relay = (MeasureRelay *) arg;
+  struct pollfd fds[2 + 2 * Chsrc_Measure_Relay_Max_Conns];
+  char buf[65536];
+
+  for (;;)
     {
-      SourceInfo src = sources[i];
-      const char *url = src.mirror->__bigfile_url;
-      if (NULL==url)
+      int nfds = 0;
+      fds[nfds++] = (struct pollfd) { relay->stop[0], POLLIN, 0 };
+      fds[nfds++] = (struct pollfd) { relay->listener, POLLIN, 0 };
+      for (int i=0; i<relay->conns_n; i++)
         {
-          if (xy_streql ("upstream", src.mirror->code))
-            {
-              // 上游源不测速，但不置0，因为要避免这种情况: 可能其他镜像站测速都为0，最后反而选择了该 upstream
-              speed = -999;
-            }
-          else
-            {
-              char *msg1 = CliOpt_InEnglish ? "Dev team doesn't offer " : "开发者未提供 ";
-              char *msg2 = CliOpt_InEnglish ? " mirror site's speed measure link, so skip it" : " 镜像站测速链接，跳过该站点";
-              chsrc_warn (xy_strjoin (3, msg1, src.mirror->code, msg2));
-              speed = 0;
-            }
-          speed_records[i] = speed;
-          get_measured[i] = false;
-          measure_msgs[i] = NULL;
+          fds[nfds++] = (struct pollfd) { relay->conns[i].client, POLLIN, 0 };
+          fds[nfds++] = (struct pollfd) { relay->conns[i].upstream, POLLIN, 0 }; /* -1 时被 poll() 忽略 */
         }
-      else
-        {
-          const char *msg = CliOpt_InEnglish ? src.mirror->abbr : src.mirror->name;
-          measure_msgs[i] = xy_strjoin (3, "  - ", msg, " ... ");
-          printf ("%s", measure_msgs[i]);
 
-          if (CliOpt_Parallel)
-            say (""); /* 并行时直接显示下一测速状态行 */
-          else
-            fflush (stdout);
+      if (poll (fds, nfds, -1) < 0)
+        {
+          if (EINTR==errno) continue;
+          break;
+        }
+      if (fds[0].revents) break;
 
-          char *url_ = xy_strdup (url);
+      /* 倒序处理，关闭连接时与最后一个交换不会跳过尚未处理的连接 */
+      for (int i=relay->conns_n-1; i>=0; i--)
+        {
+          MeasureRelayConn *c = &relay->conns[i];
+          short from_client   = fds[2 + 2*i].revents;
+          short from_upstream = fds[3 + 2*i].revents;
+          bool alive = true;
 
-          if (CliOpt_Parallel)
+          if (from_client && c->upstream < 0)
             {
-              int ret = pthread_create (&threads[i], NULL, measure_speed_for_url, url_);
-              if (ret!=0)
-                {
-                  chsrc_error ("Unable to measure speed\n");
-                  exit (Exit_UserCause);
-                }
+              ssize_t n = recv (c->client, c->head + c->head_len, sizeof c->head - 1 - c->head_len, 0);
+              if (n <= 0) alive = false;
               else
                 {
-                  get_measured[i] = true;
-                  get_measured_n += 1;
+                  c->head_len += n;
+                  c->head[c->head_len] = '\0';
+                  /* curl 在收到回复前不会发送 TLS 数据，所以请求头之后不会有多余的字节 */
+                  if (strstr (c->head, "\r\n\r\n"))
+                    alive = relay_open_upstream (relay, c);
+                  else if (c->head_len >= sizeof c->head - 1)
+                    alive = false;
                 }
             }
-          else
+          else if (from_client)
             {
-              char *curl_result = measure_speed_for_url (url_);
-              double speed = parse_and_say_curl_result (curl_result);
-              speed_records[i] = speed;
+              ssize_t n = recv (c->client, buf, sizeof buf, 0);
+              alive = n > 0 && relay_send_all (c->upstream, buf, n);
             }
-        }
-    }
 
+          if (alive && from_upstream)
+            {
+              ssize_t n = recv (c->upstream, buf, sizeof buf, 0);
+              alive = n > 0 && relay_send_all (c->client, buf, n);
+              if (n > 0) c->down += n;
+            }
 
-  if (CliOpt_Parallel)
-    {
-      /* 汇总 */
-      char **curl_results = xy_malloc0 (sizeof(char *) * size);
-      for (int i=0; i<size; i++)
-        {
-          if (get_measured[i]==true)
-            pthread_join (threads[i], (void *)&curl_results[i]);
+          if (!alive) relay_close_conn (relay, i);
         }
 
-      for (int i=0; i<get_measured_n; i++)
-        printf("\033[A\033[2K");
-
-      for (int i=0; i<size; i++)
+      if (fds[1].revents & POLLIN)
         {
-          if (get_measured[i]==true)
+          int fd = accept (relay->listener, NULL, NULL);
+          if (fd >= 0 && relay->conns_n < Chsrc_Measure_Relay_Max_Conns)
             {
-              printf ("%s", measure_msgs[i]);
-              double speed = parse_and_say_curl_result (curl_results[i]);
-              speed_records[i] = speed;
+              MeasureRelayConn *c = &relay->conns[relay->conns_n++];
+              memset (c, 0, sizeof *c);
+              c->client   = fd;
+              c->upstream = -1;
             }
+          else if (fd >= 0)
+            close (fd);
         }
-      /* 汇总结束 */
-    } /* End of if Parallel*/
-}
+    }
 
+  while (relay->conns_n > 0)
+    relay_close_conn (relay, relay->conns_n - 1);
+  return NULL;
+}
 
+/**
+ * 用户为 curl 设置了代理时，curl 本应经由该代理访问镜像站，此时不使用中继
+ */
+static bool
+measure_relay_usable ()
+{
+  const char *vars[] = { "https_proxy", "HTTPS_PROXY", "http_proxy", "all_proxy", "ALL_PROXY" };
+  for (size_t i=0; i<xy_arylen (vars); i++)
+    {
+      char *val = getenv (vars[i]);
+      if (val && *val) return false;
+    }
+  return true;
+}
 
 /**
- * 自动测速选择镜像站和源
+ * 启动中继
  *
- * @translation Done
+ * @param  timeout_sec  连接镜像站的时限，同 curl 的 -m
+ *
+ * @return 监听的端口，失败时返回 0
  */
-#define auto_select_mirror(s) select_mirror_autoly(s##_sources, s##_sources_n, (char*)#s+3)
-int
-select_mirror_autoly (SourceInfo *sources, size_t size, const char *target_name)
+static int
+measure_relay_start (MeasureRelay *relay, int timeout_sec)
 {
-  {
-  char *msg = NULL;
+  memset (relay, 0, sizeof *relay);
+  relay->timeout_sec = timeout_sec;
 
-  if (CliOpt_Parallel)
-    msg = CliOpt_InEnglish ? "Measuring speed in parallel. We recommend you use the default sequential measure for more referential results"
-                           : "即将并行测速，建议使用默认的顺序测速以获得更具参考意义的结果";
-  else
-    msg = CliOpt_InEnglish ? "Measuring speed in sequence" : "顺序测速中";
+  struct sockaddr_in addr = {0};
+  addr.sin_family      = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  socklen_t addr_len   = sizeof addr;
 
-  xy_log_brkt (App_Name, bdpurple (CliOpt_InEnglish ? "MEASURE" : "测速"), msg);
-  say ("");
-  }
+  relay->listener = socket (AF_INET, SOCK_STREAM, 0);
+  if (relay->listener < 0) return 0;
 
-  if (0==size || 1==size)
+  if (0!=bind (relay->listener, (struct sockaddr *) &addr, sizeof addr)
+      || 0!=listen (relay->listener, Chsrc_Measure_Relay_Max_Conns)
+      || 0!=getsockname (relay->listener, (struct sockaddr *) &addr, &addr_len)
+      || 0!=pipe (relay->stop))
     {
-      char *msg1 = CliOpt_InEnglish ? "Currently " : "当前 ";
-      char *msg2 = CliOpt_InEnglish ? "No any source, please contact maintainers: chsrc issue" : " 无任何可用源，请联系维护者: chsrc issue";
-      chsrc_error (xy_strjoin (3, msg1, target_name, msg2));
-      exit (Exit_MatinerIssue);
+      close (relay->listener);
+      return 0;
     }
 
-  if (CliOpt_DryRun)
+  /* 不要让 curl 等子进程继承 */
+  fcntl (relay->listener, F_SETFD, FD_CLOEXEC);
+  fcntl (relay->stop[0], F_SETFD, FD_CLOEXEC);
+  fcntl (relay->stop[1], F_SETFD, FD_CLOEXEC);
+
+  if (0!=pthread_create (&relay->thread, NULL, measure_relay_thread, relay))
     {
-      return 1; // Dry Run 时，跳过测速
+      close (relay->listener);
+      close (relay->stop[0]);
+      close (relay->stop[1]);
+      return 0;
     }
+  return ntohs (addr.sin_port);
+}
 
-  bool only_one = false;
-  if (2==size) only_one = true;
+/**
+ * 结束中继，并取出承载被测传输的连接的 TCP 指标
+ */
+static TcpProbeInfo
+measure_relay_stop (MeasureRelay *relay)
+{
+  (void) !write (relay->stop[1], "x", 1);
+  pthread_join (relay->thread, NULL);
+  close (relay->listener);
+  close (relay->stop[0]);
+  close (relay->stop[1]);
+
+  TcpProbeInfo info = {0};
+  if (0==relay->best_down) return info;
+
+  struct tcp_info *ti = &relay->best;
+  info.valid   = true;
+  info.rtt_ms  = ti->tcpi_rcv_rtt / 1000.0;
+  info.segs_in = ti->tcpi_segs_in;
+  /* 旧内核返回的 tcp_info 较短，不含 tcpi_rcv_ooopack */
+  if (relay->best_len >= offsetof (struct tcp_info, tcpi_rcv_ooopack) + sizeof ti->tcpi_rcv_ooopack)
+    info.ooopack = ti->tcpi_rcv_ooopack;
+  if (info.segs_in > 0)
+    info.loss = (double) info.ooopack / info.segs_in;
+  return info;
+}
+#endif
 
-  /** --------------------------------------------- */
-  bool exist_curl = chsrc_check_program_quietly_when_exist ("curl");
-  if (!exist_curl)
+
+/**
+ * 根据丢包情况惩罚测得的速度，作为排序依据
+ *
+ * 丢包估计每 1% 扣 1% 的速度，最多扣一半。一次丢包会使其后约一个窗口的包都乱序到达，
+ * 所以 info.loss 远大于真实丢包率，按 1:1 扣分即可
+ */
+double
+chsrc_score_speed (double speed, TcpProbeInfo info)
+{
+  if (!info.valid || speed <= 0)
+    return speed;
+
+  double penalty = info.loss;
+  if (penalty > 0.5) penalty = 0.5;
+
+  return speed * (1 - penalty);
+}
+
+
+/**
+ * 测速历史
+ *
+ * 每次测速的每个结果都追加到缓存目录下的 history 文件中，文件格式为:
+ *
+ *   8 字节魔数 Chsrc_History_Magic，随后是若干定长的 MeasureRecord
+ *
+ * 记录按本机字节序存放，不考虑在机器间拷贝。记录数超过 Chsrc_History_Compact_At 时，
+ * 丢弃 Chsrc_History_Keep_Days 天前的记录，并最多保留最近的 Chsrc_History_Keep 条
+ *
+ * 魔数的最后一位是格式版本。旧版 (CHSRCHI1) 的 route 只有 24 字节，读取时转换为当前格式，
+ * 下次追加记录前整个文件会被重写为当前格式
+ */
+typedef struct MeasureRecord_t {
+  int64_t  time;        /* Unix 时间 */
+  char     target[24];  /* 规范化后的目标名，见 chsrc_find_target_aliases() */
+  char     mirror[24];  /* 镜像站 code */
+  char     route[64];   /* 测速出口，见 chsrc_history_route_key() */
+  double   speed;       /* Byte/s，失败时为 0 */
+  float    rtt_ms;      /* 同 TcpProbeInfo，无 TCP 指标时为 0 */
+  float    loss;
+  uint16_t ooopack;
+  uint8_t  failed;
+  uint8_t  hour;        /* 测速时本地时间的小时，用于分时段统计 */
+} MeasureRecord;
+
+#define Chsrc_History_Magic        "CHSRCHI2"
+#define Chsrc_History_Magic_V1     "CHSRCHI1"
+#define Chsrc_History_Compact_At   20000
+#define Chsrc_History_Keep         10000
+#define Chsrc_History_Keep_Days    90
+/* 历史样本少于该值时，-rank median 仍使用本次测速结果 */
+#define Chsrc_History_Min_Samples  3
+
+/* 格式版本 1 的记录 */
+typedef struct MeasureRecordV1_t {
+  int64_t  time;
+  char     target[24];
+  char     mirror[24];
+  char     route[24];
+  double   speed;
+  float    rtt_ms;
+  float    rttvar_ms;
+  float    loss;
+  uint16_t retrans;
+  uint8_t  failed;
+  uint8_t  hour;
+} MeasureRecordV1;
+
+char *
+chsrc_history_path ()
+{
+  return xy_2strjoin (chsrc_cache_dir (), xy_on_windows ? "\\history" : "/history");
+}
+
+/**
+ * 测速出口在历史中的写法：同 CliOpt_Routes，空串表示默认路由
+ *
+ * 放不进 MeasureRecord.route 的出口 (如很长的主机名) 保留前缀并在其后附上整串的
+ * FNV-1a 哈希，这样写入与比较时得到的是同一个键，不同出口也不会因截断而混在一起
+ */
+static void
+chsrc_history_route_key (const char *route, char key[64])
+{
+  if (NULL==route) route = "";
+
+  size_t len = strlen (route);
+  if (len < 64)
     {
-      char *msg = CliOpt_InEnglish ? "No curl, unable to measure speed" : "没有curl命令，无法测速";
-      chsrc_error (msg);
-      exit (Exit_UserCause);
+      memcpy (key, route, len + 1);
+      return;
     }
-  /** --------------------------------------------- */
 
-  /* 总测速记录值 */
-  double speed_records[size];
-  measure_speed_for_every_source (sources, size, speed_records);
-  say ("");
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i=0; i<len; i++)
+    {
+      h ^= (unsigned char) route[i];
+      h *= 1099511628211ULL;
+    }
+  /* 46 字节前缀 + '#' + 16 位十六进制 = 63 */
+  snprintf (key, 64, "%.46s#%016llx", route, (unsigned long long) h);
+}
 
-  /* DEBUG */
-  /*
-  for (int i=0; i<size; i++)
+/**
+ * 读取全部测速历史
+ *
+ * @param[out] n  记录条数
+ *
+ * @return 记录数组，无历史时返回 NULL
+ */
+MeasureRecord *
+chsrc_history_load (size_t *n)
+{
+  *n = 0;
+  FILE *f = fopen (chsrc_history_path (), "rb");
+  if (!f) return NULL;
+
+  char magic[8];
+  bool v1 = false;
+  if (8!=fread (magic, 1, 8, f)
+      || (0!=memcmp (magic, Chsrc_History_Magic, 8)
+          && !(v1 = (0==memcmp (magic, Chsrc_History_Magic_V1, 8)))))
     {
-      printf ("speed_records[%d] = %f\n", i, speed_records[i]);
+      fclose (f);
+      return NULL;
     }
-  */
 
-  int fast_idx = get_max_ele_idx_in_dbl_ary (speed_records, size);
+  fseek (f, 0, SEEK_END);
+  long size = ftell (f) - 8;
+  fseek (f, 8, SEEK_SET);
 
-  if (only_one)
+  size_t cap = size / (v1 ? sizeof (MeasureRecordV1) : sizeof (MeasureRecord));
+  if (0==cap)
     {
-      char *msg1 = CliOpt_InEnglish ? "NOTICE  mirror site: " : "镜像站提示: ";
-      char   *is = CliOpt_InEnglish ? " is " : " 是 ";
-      char *msg2 = CliOpt_InEnglish ? "'s ONLY mirror available currently, thanks for their generous support"
-                                    : " 目前唯一可用镜像站，感谢他们的慷慨支持";
-      const char *name = CliOpt_InEnglish ? sources[fast_idx].mirror->abbr
-                                          : sources[fast_idx].mirror->name;
-      say (xy_strjoin (5, msg1, bdgreen(name), green(is), green(target_name), green(msg2)));
+      fclose (f);
+      return NULL;
     }
-  else
+
+  MeasureRecord *records = xy_malloc0 (cap * sizeof (MeasureRecord));
+  if (!v1)
     {
-      char *msg = CliOpt_InEnglish ? "FASTEST mirror site: " : "最快镜像站: ";
-      const char *name = CliOpt_InEnglish ? sources[fast_idx].mirror->abbr
-                                          : sources[fast_idx].mirror->name;
-      say (xy_2strjoin (msg, green(name)));
+      *n = fread (records, sizeof (MeasureRecord), cap, f);
+      fclose (f);
+      return records;
     }
 
-  // https://github.com/RubyMetric/chsrc/pull/71
-  if (ProgMode_CMD_Measure)
+  MeasureRecordV1 old;
+  while (*n < cap && 1==fread (&old, sizeof old, 1, f))
     {
-      char *msg = CliOpt_InEnglish ? "URL of above source: " : "镜像源地址: ";
-      say (xy_2strjoin (msg, green(sources[fast_idx].url)));
+      MeasureRecord *r = &records[(*n)++];
+      r->time = old.time;
+      memcpy (r->target, old.target, sizeof r->target);
+      memcpy (r->mirror, old.mirror, sizeof r->mirror);
+      memcpy (r->route,  old.route,  sizeof old.route);
+      r->speed = old.speed;
+      /* 版本 1 的 TCP 指标取自另一条探测连接，不能代表被测的传输，丢弃 */
+      r->failed = old.failed;
+      r->hour = old.hour;
     }
-
-  return fast_idx;
+  fclose (f);
+  return records;
 }
 
+/**
+ * 压缩历史文件：经由 xy_file_write() 原子地替换，中途失败或多个 chsrc 同时压缩都不会损坏历史
+ *
+ * 总是以当前格式写出，因此也用于升级旧版历史文件
+ */
+static void
+chsrc_history_compact ()
+{
+  size_t n = 0;
+  MeasureRecord *records = chsrc_history_load (&n);
+  if (!records) return;
 
-#define use_specific_mirror_or_auto_select(input, s) \
-  (NULL!=(input)) ? find_mirror(s, input) : auto_select_mirror(s)
+  int64_t oldest = (int64_t) time (NULL) - Chsrc_History_Keep_Days * 24 * 3600;
+  size_t begin = n > Chsrc_History_Keep ? n - Chsrc_History_Keep : 0;
 
+  char *buf = xy_malloc0 (8 + (n - begin) * sizeof (MeasureRecord));
+  memcpy (buf, Chsrc_History_Magic, 8);
+  size_t len = 8;
+  for (size_t i=begin; i<n; i++)
+    {
+      if (records[i].time >= oldest)
+        {
+          memcpy (buf + len, &records[i], sizeof (MeasureRecord));
+          len += sizeof (MeasureRecord);
+        }
+    }
+  free (records);
 
+  xy_file_write (chsrc_history_path (), buf, len);
+  free (buf);
+}
 
-bool
-source_is_upstream (SourceInfo *source)
+/**
+ * 追加一条测速记录，出错时静默忽略，不影响测速本身
+ */
+void
+chsrc_history_append (const char *mirror, double speed, TcpProbeInfo info, bool failed)
 {
-  return xy_streql (source->mirror->code, "upstream");
+  char *dir = chsrc_cache_dir ();
+  if (!xy_mkdir_p (dir))
+    return;
+
+  char *path = chsrc_history_path ();
+
+  /* 旧版或无法识别的历史文件不能直接追加，先升级；无法升级时丢弃 */
+  char magic[8] = {0};
+  FILE *old = fopen (path, "rb");
+  if (old)
+    {
+      size_t got = fread (magic, 1, 8, old);
+      fclose (old);
+      if (got > 0 && 0!=memcmp (magic, Chsrc_History_Magic, 8))
+        {
+          chsrc_history_compact ();
+          old = fopen (path, "rb");
+          got = old ? fread (magic, 1, 8, old) : 0;
+          if (old) fclose (old);
+          if (got > 0 && 0!=memcmp (magic, Chsrc_History_Magic, 8))
+            remove (path);
+        }
+    }
+
+  struct stat st;
+  if (0==stat (path, &st) && st.st_size > 8
+      && (st.st_size - 8) / sizeof (MeasureRecord) >= Chsrc_History_Compact_At)
+    {
+      chsrc_history_compact ();
+    }
+
+  FILE *f = fopen (path, "ab");
+  if (!f) return;
+
+  /* "ab" 模式下 ftell() 在首次写入前不一定在文件尾，所以先移过去 */
+  fseek (f, 0, SEEK_END);
+  if (0==ftell (f))
+    fwrite (Chsrc_History_Magic, 1, 8, f);
+
+  MeasureRecord rec;
+  memset (&rec, 0, sizeof rec);
+
+  time_t now = time (NULL);
+  struct tm *local = localtime (&now);
+
+  const char *target = ProgStatus_Measure_Target ? ProgStatus_Measure_Target : "";
+  const char **aliases = chsrc_find_target_aliases (target);
+  if (aliases) target = aliases[0];
+
+  rec.time = (int64_t) now;
+  strncpy (rec.target, target, sizeof rec.target - 1);
+  strncpy (rec.mirror, mirror, sizeof rec.mirror - 1);
+  chsrc_history_route_key (ProgStatus_Measure_Route, rec.route);
+  rec.speed     = failed ? 0 : speed;
+  rec.rtt_ms    = info.valid ? info.rtt_ms : 0;
+  rec.loss      = info.valid ? info.loss   : 0;
+  rec.ooopack   = info.valid ? (info.ooopack > 0xFFFF ? 0xFFFF : info.ooopack) : 0;
+  rec.failed    = failed;
+  rec.hour      = local ? local->tm_hour : 0;
+
+  fwrite (&rec, sizeof rec, 1, f);
+  fclose (f);
 }
 
-bool
-source_is_userdefine (SourceInfo *source)
+
+static int
+chsrc_dbl_cmp (const void *a, const void *b)
 {
-  return xy_streql (source->mirror->code, "user");
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
 }
 
-bool
-source_has_empty_url (SourceInfo *source)
+/**
+ * 对已排序的数组取百分位数 (最近秩法)
+ */
+double
+chsrc_percentile (const double *sorted, size_t n, double p)
 {
-  return source->url == NULL;
+  if (0==n) return 0;
+  size_t rank = (size_t) (p * n + 0.999999);
+  if (rank < 1) rank = 1;
+  if (rank > n) rank = n;
+  return sorted[rank - 1];
 }
 
 /**
- * 用户*只可能*通过下面三种方式来换源，无论哪一种都会返回一个 SourceInfo 出来
- *
- * 1. 用户指定 MirrorCode
- * 2. 用户什么都没指定 (将测速选择最快镜像)
- * 3. 用户给了一个 URL
+ * 用历史中位数代替本次测速结果作为排序依据
  *
- * @dependency 变量 option
- * @dependency 变量 source
+ * 失败的测速按 0 计入，这样经常失败的镜像站中位数也会偏低；
+ * 每个源都按其本次最快出口的历史来计算
  */
-#define chsrc_yield_source(for_what) \
-  SourceInfo source; \
-  if (is_url (option)) \
-    { \
-      SourceInfo __tmp = { &UserDefine, option }; \
-      source = __tmp; \
-    } \
-  else \
-    { \
-      int __index = use_specific_mirror_or_auto_select (option, for_what); \
-      source = for_what##_sources[__index]; \
-    }
+void
+chsrc_history_apply_median (SourceInfo sources[], int size, double speed_records[], char *route_records[])
+{
+  size_t n = 0;
+  MeasureRecord *records = chsrc_history_load (&n);
+  if (!records) return;
 
+  const char *target = ProgStatus_Measure_Target ? ProgStatus_Measure_Target : "";
+  const char **aliases = chsrc_find_target_aliases (target);
+  if (aliases) target = aliases[0];
 
+  double *scores = xy_malloc0 (sizeof (double) * n);
+
+  for (int i=0; i<size; i++)
+    {
+      if (xy_streql ("upstream", sources[i].mirror->code)) continue;
+
+      char route[64];
+      chsrc_history_route_key (route_records[i], route);
+      size_t k = 0;
+      for (size_t j=0; j<n; j++)
+        {
+          MeasureRecord *r = &records[j];
+          if (strcmp (r->target, target) || strcmp (r->mirror, sources[i].mirror->code) || strcmp (r->route, route))
+            continue;
+
+          TcpProbeInfo info = {0};
+          info.valid = r->rtt_ms > 0;
+          info.rtt_ms = r->rtt_ms; info.loss = r->loss;
+          scores[k++] = r->failed ? 0 : chsrc_score_speed (r->speed, info);
+        }
+
+      if (k < Chsrc_History_Min_Samples) continue;
+
+      qsort (scores, k, sizeof (double), chsrc_dbl_cmp);
+      speed_records[i] = chsrc_percentile (scores, k, 0.5);
+    }
+
+  free (scores);
+  free (records);
+}
 
-#define split_between_source_changing_process   puts ("--------------------------------")
 
 /**
- * 用于 _setsrc 函数
+ * Git 仓库测速
  *
- * 1. 告知用户选择了什么源和镜像
- * 2. 对选择的源和镜像站进行一定的校验
+ * 对于以 Git 仓库形式提供的源 (如 Homebrew 的 brew.git)，
+ * 下载一个大文件的速度并不能代表 git clone/fetch 的表现，后者还取决于镜像站 smart HTTP
+ * 的 info/refs 与 pack 协商的延迟。recipe 在 chsrc_yield_source_and_confirm() 之前调用
+ * chsrc_git_probe_repo() 后，测速将改为:
  *
- * @translation Done
+ *   1. GET  <repo>/info/refs?service=git-upload-pack，计时并取得 HEAD
+ *   2. POST <repo>/git-upload-pack，以 deepen 1 拉取 HEAD 的浅克隆 pack
+ *
+ * 最终速度为 pack 大小 / (两步总耗时)，即包含协商开销的有效速度
+ */
+bool        ProgStatus_Git_Probe = false;
+const char *ProgStatus_Git_Probe_Prefix = NULL;
+const char *ProgStatus_Git_Probe_Suffix = NULL;
+
+/**
+ * @param  prefix  拼接在源 URL 之前，得到仓库地址
+ * @param  suffix  拼接在源 URL 之后，得到仓库地址
  */
-#define chsrc_confirm_source confirm_source(&source)
 void
-confirm_source (SourceInfo *source)
+chsrc_git_probe_repo (const char *prefix, const char *suffix)
 {
-  // 由于实现问题，我们把本应该独立出去的默认上游源，也放在了可以换源的数组中，而且放在第一个
-  // chsrc 已经规避用户使用未实现的 `chsrc reset`
-  // 但是某些用户可能摸索着强行使用 chsrc set target upstream，从而执行起该禁用的功能，
-  // 之所以禁用，是因为有的 reset 我们并没有实现，我们在这里阻止这些邪恶的用户
-  if (source_is_upstream (source) && source_has_empty_url (source))
-    {
-      char *msg = CliOpt_InEnglish ? "Not implement RESET for the target yet" : "暂未对该目标实现重置";
-      chsrc_error (msg);
-      exit (Exit_Unsupported);
-    }
-  else if (source_has_empty_url (source))
-    {
-      char *msg = CliOpt_InEnglish ? "URL of the source doesn't exist, please report a bug to the dev team" : \
-                                     "该源URL不存在，请向开发团队提交bug";
-      chsrc_error (msg);
-      exit (Exit_FatalBug);
-    }
-  else
-    {
-      char *msg = CliOpt_InEnglish ? "SELECT  mirror site: " : "选中镜像站: ";
-      say (xy_strjoin (5, msg, green (source->mirror->abbr), " (", green (source->mirror->code), ")"));
-    }
+  ProgStatus_Git_Probe = true;
+  ProgStatus_Git_Probe_Prefix = prefix;
+  ProgStatus_Git_Probe_Suffix = suffix;
+}
 
-  split_between_source_changing_process;
+static char *
+git_pkt_line (const char *data)
+{
+  char *pkt = xy_malloc0 (strlen (data) + 5);
+  sprintf (pkt, "%04x%s", (unsigned int) strlen (data) + 4, data);
+  return pkt;
 }
 
-#define chsrc_yield_source_and_confirm(for_what) chsrc_yield_source(for_what);chsrc_confirm_source
+/**
+ * 从 info/refs 的响应中取出第一个 ref (即 HEAD) 的对象名
+ *
+ * @param[out] shallow  服务端是否支持浅克隆
+ *
+ * @return 对象名，不是 smart HTTP 响应或没有任何 ref 时返回 NULL
+ */
+static char *
+git_parse_first_ref (const char *buf, size_t len, bool *shallow)
+{
+  size_t pos = 0;
+  bool smart = false;
 
+  while (pos + 4 <= len)
+    {
+      char hex[5] = {0};
+      memcpy (hex, buf + pos, 4);
+      size_t pkt_len = strtoul (hex, NULL, 16);
+      if (0==pkt_len)
+        {
+          pos += 4; /* flush-pkt */
+          continue;
+        }
+      if (pkt_len < 4 || pos + pkt_len > len)
+        return NULL;
 
-#define ChsrcTypeAuto     "auto"
-#define ChsrcTypeReset    "reset"
-#define ChsrcTypeSemiAuto "semiauto"
-#define ChsrcTypeManual   "manual"
-#define ChsrcTypeUntested "untested"
+      const char *data = buf + pos + 4;
+      size_t data_len = pkt_len - 4;
+      pos += pkt_len;
 
-#define MSG_EN_PUBLIC_URL "If the URL you specify is a public service, you are invited to contribute: chsrc issue"
-#define MSG_CN_PUBLIC_URL "若您指定的URL为公有服务，邀您参与贡献: chsrc issue"
+      if (data_len >= 9 && 0==strncmp (data, "# service", 9))
+        {
+          smart = true;
+          continue;
+        }
+      if (!smart)
+        return NULL;
+
+      /* "<oid> HEAD\0<capabilities>\n" */
+      const char *space = memchr (data, ' ', data_len);
+      if (!space)
+        return NULL;
+      const char *nul = memchr (data, '\0', data_len);
+      if (nul)
+        {
+          char *caps = xy_strndup (nul + 1, data_len - (nul + 1 - data));
+          *shallow = NULL!=strstr (caps, "shallow");
+          free (caps);
+        }
+      return xy_strndup (data, space - data);
+    }
+  return NULL;
+}
 
-#define MSG_EN_FULLY_AUTO "Fully-Auto changed source. "
-#define MSG_CN_FULLY_AUTO "全自动换源完成"
+/**
+ * 对 Git 仓库进行 smart HTTP 测速
+ *
+ * @param  curl_opts  --ipv6、--interface 等额外的 curl 选项
+ *
+ * @return 与 measure_speed_for_url() 相同格式的结果，并附加 "git <info/refs 耗时ms>"
+ */
+char *
+measure_git_for_url (const char *url, const char *time_sec, const char *curl_opts)
+{
+  /* 可能以 root 运行，临时文件必须以独占方式创建，见 xy_tmpfile_create() */
+  char *refs_file = xy_tmpfile_create ("chsrc-git-refs");
+  char *body_file = xy_tmpfile_create ("chsrc-git-body");
+  char *result = NULL;
+  if (!refs_file || !body_file)
+    {
+      result = xy_strdup ("000 0");
+      goto cleanup;
+    }
 
-#define MSG_EN_SEMI_AUTO  "Semi-Auto changed source. "
-#define MSG_CN_SEMI_AUTO  "半自动换源完成"
+  char *ua = " -A \"git/2.0 (chsrc/" Chsrc_Banner_Version ")\" ";
 
-#define MSG_EN_THANKS     "Thanks to the mirror site: "
-#define MSG_CN_THANKS     "感谢镜像提供方: "
+  /* 1. info/refs */
+  char *refs_cmd = xy_strjoin (9, "curl -qsL ", curl_opts, ua, " -o \"", refs_file, "\"",
+                                  " -w \"%{http_code} %{time_total} %{url_effective}\" -m", time_sec,
+                                  xy_strjoin (3, " \"", url, "/info/refs?service=git-upload-pack\""));
+  char *refs_out = xy_str_strip (xy_run (refs_cmd, 0, NULL));
 
-#define MSG_EN_BETTER     "If you have a better source changing method , please help: chsrc issue"
-#define MSG_CN_BETTER     "若您有更好的换源方案，邀您帮助: chsrc issue"
+  int    refs_code = atoi (refs_out);
+  double refs_time = 0;
+  char   effective[1024] = {0};
+  sscanf (refs_out, "%*d %lf %1023s", &refs_time, effective);
 
-#define MSG_EN_CONSTRAINT "Implementation constraints require manual operation according to the above prompts. "
-#define MSG_CN_CONSTRAINT "因实现约束需按上述提示手工操作"
+  if (200!=refs_code)
+    {
+      char buf[32];
+      sprintf (buf, "%03d 0", refs_code);
+      result = xy_strdup (buf);
+      goto cleanup;
+    }
 
-#define MSG_EN_STILL      "Still need to operate manually according to the above prompts. "
-#define MSG_CN_STILL      "仍需按上述提示手工操作"
+  FILE *f = fopen (refs_file, "rb");
+  char refs[65536];
+  size_t refs_len = f ? fread (refs, 1, sizeof refs, f) : 0;
+  if (f) fclose (f);
+
+  bool shallow = false;
+  char *oid = git_parse_first_ref (refs, refs_len, &shallow);
+  if (!oid)
+    {
+      /* 不是 smart HTTP，或仓库为空，都无法正常使用 */
+      result = xy_strdup ("200 0");
+      goto cleanup;
+    }
+
+  /* 2. 浅克隆 pack */
+  char *body = xy_strjoin (4,
+                 git_pkt_line (xy_strjoin (3, "want ", oid, shallow ? " no-progress ofs-delta shallow\n"
+                                                                    : " no-progress ofs-delta\n")),
+                 shallow ? git_pkt_line ("deepen 1\n") : "",
+                 "0000",
+                 git_pkt_line ("done\n"));
+  f = fopen (body_file, "wb");
+  if (!f)
+    {
+      result = xy_strdup ("200 0");
+      goto cleanup;
+    }
+  fwrite (body, 1, strlen (body), f);
+  fclose (f);
+
+  /* 跳转后的 info/refs 地址即可推出实际的仓库地址，POST 不再跟随跳转 */
+  char *repo = xy_str_end_with (effective, "/info/refs?service=git-upload-pack")
+               ? xy_str_delete_suffix (effective, "/info/refs?service=git-upload-pack")
+               : xy_strdup (url);
+
+  char *pack_cmd = xy_strjoin (9, "curl -qs ", curl_opts, ua, " -o " xy_os_devnull,
+                                  " -H \"Content-Type: application/x-git-upload-pack-request\""
+                                  " -H \"Accept: application/x-git-upload-pack-result\"",
+                                  xy_strjoin (3, " --data-binary \"@", body_file, "\""),
+                                  " -w \"%{http_code} %{time_total} %{size_download}\" -m", time_sec,
+                                  xy_strjoin (3, " \"", repo, "/git-upload-pack\""));
+  char *pack_out = xy_str_strip (xy_run (pack_cmd, 0, NULL));
+
+  int    pack_code = 0;
+  double pack_time = 0, pack_size = 0;
+  sscanf (pack_out, "%d %lf %lf", &pack_code, &pack_time, &pack_size);
+
+  double speed = 0;
+  if (200==pack_code && refs_time + pack_time > 0)
+    speed = pack_size / (refs_time + pack_time);
+
+  char buf[96];
+  sprintf (buf, "%03d %.0f git %.0f", pack_code, speed, refs_time * 1000);
+  result = xy_strdup (buf);
+
+cleanup:
+  if (refs_file) remove (refs_file);
+  if (body_file) remove (body_file);
+  return result;
+}
 
-#define thank_mirror(msg) chsrc_log(xy_2strjoin(msg,purple(CliOpt_InEnglish?source->mirror->abbr:source->mirror->name)))
 
 /**
- * @param source    可为NULL
- * @param last_word 5种选择：ChsrcTypeAuto | ChsrcTypeReset | ChsrcTypeSemiAuto | ChsrcTypeManual | ChsrcTypeUntested
- * @translation Done
+ * 测速代码参考自 https://github.com/mirrorz-org/oh-my-mirrorz/blob/master/oh-my-mirrorz.py
+ * 功劳和版权属于原作者，由 @ccmywish 修改为C语言，并做了额外调整
+ *
+ * @return 返回测得的速度，若出错，返回-1
+ *
+ * 该函数实际原型为 char * (*)(const char*)
  */
-void
-chsrc_conclude (SourceInfo *source, const char *last_word)
+void *
+measure_speed_for_url (void *url)
 {
-  split_between_source_changing_process;
+  char *time_sec = NULL;
 
-  if (xy_streql (ChsrcTypeAuto, last_word))
+  if (CliOpt_Parallel)
+    time_sec = "9";
+  else
+    time_sec = "6";
+
+  /* 现在我们切换至跳转后的链接来测速，不再使用下述判断
+  if (xy_str_start_with(url, "https://registry.npmmirror"))
     {
-      if (source)
-        {
-          if (source_is_userdefine (source))
-            {
-              char *msg = CliOpt_InEnglish ? MSG_EN_FULLY_AUTO      MSG_EN_PUBLIC_URL \
-                                           : MSG_CN_FULLY_AUTO ", " MSG_CN_PUBLIC_URL;
-              chsrc_log (msg);
-            }
-          else
-            {
-              char *msg = CliOpt_InEnglish ? MSG_EN_FULLY_AUTO      MSG_EN_THANKS \
-                                           : MSG_CN_FULLY_AUTO ", " MSG_CN_THANKS;
-              thank_mirror (msg);
-            }
-        }
-      else
-        {
-          char *msg = CliOpt_InEnglish ? MSG_EN_FULLY_AUTO : MSG_CN_FULLY_AUTO;
-          chsrc_log (msg);
-        }
+      // 这里 npmmirror 跳转非常慢，需要1~3秒，所以我们给它留够至少8秒测速时间，否则非常不准
+      time_sec = "10";
     }
-  else if (xy_streql (ChsrcTypeReset, last_word))
+  */
+
+  char *ipv6 = ""; // 默认不启用
+
+  if (CliOpt_IPv6==true)
     {
-      // source_is_upstream (source)
-      char *msg = CliOpt_InEnglish ? "Has been reset to the upstream default source" : "已重置为上游默认源";
-      chsrc_log (purple (msg));
+      ipv6 = "--ipv6";
     }
-  else if (xy_streql (ChsrcTypeSemiAuto, last_word))
+
+  char *route = ""; // 默认走默认路由
+
+  if (ProgStatus_Measure_Route)
     {
-      if (source)
-        {
-          if (source_is_userdefine (source))
-            {
-              char *msg = CliOpt_InEnglish ? MSG_EN_SEMI_AUTO      MSG_EN_STILL      MSG_EN_PUBLIC_URL \
-                                           : MSG_CN_SEMI_AUTO ", " MSG_CN_STILL "。" MSG_CN_PUBLIC_URL;
-              chsrc_log (msg);
-            }
-          else
-            {
-              char *msg = CliOpt_InEnglish ? MSG_EN_SEMI_AUTO      MSG_EN_STILL      MSG_EN_THANKS \
-                                           : MSG_CN_SEMI_AUTO ", " MSG_CN_STILL "。" MSG_CN_THANKS;
-              thank_mirror (msg);
-            }
-        }
-      else
-        {
-          char *msg = CliOpt_InEnglish ? MSG_EN_SEMI_AUTO      MSG_EN_STILL \
-                                       : MSG_CN_SEMI_AUTO ", " MSG_CN_STILL;
-          chsrc_log (msg);
-        }
+      route = xy_strjoin (3, " --interface \"", ProgStatus_Measure_Route, "\"");
+    }
 
-      char *msg = CliOpt_InEnglish ? MSG_EN_BETTER : MSG_CN_BETTER;
-      chsrc_warn (msg);
+  if (ProgStatus_Git_Probe)
+    {
+      return measure_git_for_url (url, time_sec, xy_strjoin (3, ipv6, route, " "));
     }
-  else if (xy_streql (ChsrcTypeManual, last_word))
+
+  char *os_devnull = xy_os_devnull;
+  bool on_cygwin = false;
+
+  // https://github.com/RubyMetric/chsrc/issues/65
+  // curl (仅)在 Cygwin 上 -o nul 会把 nul 当做普通文件
+  // 为了践行 chsrc everywhere 的承诺，我们也考虑支持 Cygwin
+  if (xy_on_windows && 0==system ("cygcheck --version>nul"))
     {
-      if (source)
-        {
-          if (source_is_userdefine (source))
-            {
-              char *msg = CliOpt_InEnglish ? MSG_EN_CONSTRAINT      MSG_EN_PUBLIC_URL \
-                                           : MSG_CN_CONSTRAINT "; " MSG_CN_PUBLIC_URL;
-              chsrc_log (msg);
-            }
-          else
+      on_cygwin = true;
+      os_devnull = "/tmp/chsrc-measure-downloaded";
+    }
+
+  /* 经由中继测速时，由中继负责 IPv6 与测速出口，curl 只连接本机的中继 */
+  char *relay_opt = "";
+#ifdef XY_On_Linux
+  MeasureRelay relay;
+  int relay_port = measure_relay_usable () ? measure_relay_start (&relay, atoi (time_sec)) : 0;
+  if (relay_port)
+    {
+      char port_buf[16];
+      sprintf (port_buf, "%d", relay_port);
+      relay_opt = xy_strjoin (3, " --proxytunnel --proxy http://127.0.0.1:", port_buf, " ");
+      ipv6 = "";
+      route = "";
+    }
+#endif
+
+  // 我们用 —L，因为Ruby China源会跳转到其他地方
+  // npmmirror 也会跳转
+  char *curl_cmd = xy_strjoin (10, "curl -qsL ", ipv6, route, relay_opt,
+                                   " -o ", os_devnull,
+                                   " -w \"%{http_code} %{speed_download}\" -m", time_sec,
+                                   " -A chsrc/" Chsrc_Banner_Version "  ", url);
+
+  // chsrc_info (xy_2strjoin ("测速命令 ", curl_cmd));
+
+  char *curl_buf = NULL;
+
+  if (on_cygwin)
+    {
+      char *curl_script = ".chsrc_measure_tmp.sh";
+      FILE *f = fopen (curl_script, "w");
+        if (f==NULL)
+          exit (Exit_UserCause);
+      fputs (curl_cmd, f);
+      fclose (f);
+      curl_buf = xy_run ( xy_2strjoin ("bash .\\", curl_script), 0, NULL);
+      system (xy_2strjoin ("del ", curl_script));
+      system (xy_strjoin (3, "bash -c \"rm ", os_devnull, "\""));
+    }
+  else
+    {
+      curl_buf = xy_run (curl_cmd, 0, NULL);
+    }
+
+  // 如果尾部有换行，删除
+  curl_buf = xy_str_strip (curl_buf);
+
+  /* 中继所得的 TCP 指标附在 curl 输出之后交给 parse_and_say_curl_result() */
+#ifdef XY_On_Linux
+  if (relay_port)
+    {
+      TcpProbeInfo info = measure_relay_stop (&relay);
+      if (info.valid)
+        {
+          char tcp_buf[96];
+          sprintf (tcp_buf, " %.3f %u %u %.6f", info.rtt_ms, info.ooopack, info.segs_in, info.loss);
+          curl_buf = xy_2strjoin (curl_buf, tcp_buf);
+        }
+    }
+#endif
+
+  return curl_buf;
+}
+
+
+/**
+ * @param[out] result  解析出的原始测速结果，可为 NULL
+ *
+ * @return 返回经丢包惩罚后的速度，用于排序
+ */
+double
+parse_and_say_curl_result (char *curl_buf, MeasureResult *result)
+{
+  // 分隔两部分数据
+  char *split = strchr (curl_buf, ' ');
+  if (split) *split = '\0';
+
+  // say(curl_buf); say(split+1);
+     int http_code = atoi (curl_buf);
+  double     speed = split ? atof (split+1) : 0;
+    char *speedstr = to_human_readable_speed (speed);
+
+  /* 速度之后是可选的 TCP 指标，或 Git 测速的 info/refs 耗时 */
+  TcpProbeInfo info = {0};
+  double git_refs_ms = -1;
+  char *tcp_part = split ? strchr (split+1, ' ') : NULL;
+  if (tcp_part && xy_str_start_with (tcp_part, " git "))
+    {
+      git_refs_ms = atof (tcp_part + strlen (" git "));
+    }
+  else if (tcp_part)
+    {
+      info.valid = 4==sscanf (tcp_part, "%lf %u %u %lf", &info.rtt_ms, &info.ooopack,
+                              &info.segs_in, &info.loss);
+    }
+
+  char *line = speedstr;
+
+  if (200!=http_code)
+    {
+      char *http_code_str = yellow (xy_2strjoin (CliOpt_InEnglish ? "HTTP code " : "HTTP码 ", curl_buf));
+      line = xy_strjoin (3, line, " | ",  http_code_str);
+    }
+
+  if (git_refs_ms >= 0)
+    {
+      char git_buf[64];
+      sprintf (git_buf, "info/refs %.0fms", git_refs_ms);
+      line = xy_strjoin (3, line, " | ", git_buf);
+    }
+
+  if (info.valid)
+    {
+      char tcp_buf[96];
+      sprintf (tcp_buf, "RTT %.1fms", info.rtt_ms);
+      line = xy_strjoin (3, line, " | ", tcp_buf);
+
+      if (info.ooopack)
+        {
+          char loss_buf[64];
+          sprintf (loss_buf, CliOpt_InEnglish ? "out-of-order %u/%u" : "乱序 %u/%u",
+                   info.ooopack, info.segs_in);
+          line = xy_strjoin (3, line, " | ", info.loss >= 0.1 ? yellow (loss_buf) : loss_buf);
+        }
+    }
+
+  say (line);
+
+  if (result)
+    {
+      result->http_code = http_code;
+      result->speed     = speed;
+      result->tcp       = info;
+    }
+  return chsrc_score_speed (speed, info);
+}
+
+
+int
+get_max_ele_idx_in_dbl_ary (double *array, int size)
+{
+  double maxval = array[0];
+  int maxidx = 0;
+
+  for (int i=1; i<size; i++)
+    {
+      if (array[i]>maxval)
+        {
+          maxval = array[i];
+          maxidx = i;
+        }
+    }
+  return maxidx;
+}
+
+
+/**
+ * @param      sources        所有待测源
+ * @param      size           待测源的数量
+ * @param[out] speed_records  速度值记录
+ */
+void
+measure_speed_for_every_source (SourceInfo sources[], int size, double speed_records[])
+{
+    bool get_measured[size]; /* 是否测速了 */
+     int get_measured_n = 0; /* 测速了几个 */
+   char *measure_msgs[size];
+
+  double speed = 0.0;
+
+  pthread_t *threads = xy_malloc0 (sizeof(pthread_t) * size);
+
+  for (int i=0; i<size; i++)
+    {
+      SourceInfo src = sources[i];
+      const char *url = src.mirror->__bigfile_url;
+      if (ProgStatus_Git_Probe)
+        {
+          url = src.url ? xy_strjoin (3, ProgStatus_Git_Probe_Prefix, src.url, ProgStatus_Git_Probe_Suffix) : NULL;
+        }
+      if (NULL==url)
+        {
+          if (xy_streql ("upstream", src.mirror->code))
             {
-              char *msg = CliOpt_InEnglish ? MSG_EN_CONSTRAINT      MSG_EN_THANKS \
-                                           : MSG_CN_CONSTRAINT ", " MSG_CN_THANKS;
-              thank_mirror (msg);
+              // 上游源不测速，但不置0，因为要避免这种情况: 可能其他镜像站测速都为0，最后反而选择了该 upstream
+              speed = -999;
+            }
+          else
+            {
+              char *msg1 = CliOpt_InEnglish ? "Dev team doesn't offer " : "开发者未提供 ";
+              char *msg2 = CliOpt_InEnglish ? " mirror site's speed measure link, so skip it" : " 镜像站测速链接，跳过该站点";
+              chsrc_warn (xy_strjoin (3, msg1, src.mirror->code, msg2));
+              speed = 0;
             }
+          speed_records[i] = speed;
+          get_measured[i] = false;
+          measure_msgs[i] = NULL;
         }
       else
         {
-          char *msg = CliOpt_InEnglish ? MSG_EN_CONSTRAINT : MSG_CN_CONSTRAINT;
-          chsrc_log (msg);
+          const char *msg = CliOpt_InEnglish ? src.mirror->abbr : src.mirror->name;
+          measure_msgs[i] = xy_strjoin (3, "  - ", msg, " ... ");
+          printf ("%s", measure_msgs[i]);
+
+          if (CliOpt_Parallel)
+            say (""); /* 并行时直接显示下一测速状态行 */
+          else
+            fflush (stdout);
+
+          char *url_ = xy_strdup (url);
+
+          if (CliOpt_Parallel)
+            {
+              int ret = pthread_create (&threads[i], NULL, measure_speed_for_url, url_);
+              if (ret!=0)
+                {
+                  chsrc_error ("Unable to measure speed\n");
+                  exit (Exit_UserCause);
+                }
+              else
+                {
+                  get_measured[i] = true;
+                  get_measured_n += 1;
+                }
+            }
+          else
+            {
+              char *curl_result = measure_speed_for_url (url_);
+              MeasureResult result;
+              double speed = parse_and_say_curl_result (curl_result, &result);
+              speed_records[i] = speed;
+              chsrc_history_append (src.mirror->code, result.speed, result.tcp,
+                                    200!=result.http_code || result.speed <= 0);
+            }
         }
-      char *msg = CliOpt_InEnglish ? MSG_EN_BETTER : MSG_CN_BETTER;
-      chsrc_warn (msg);
     }
-  else if (xy_streql (ChsrcTypeUntested, last_word))
+
+
+  if (CliOpt_Parallel)
     {
-      if (source)
+      /* 汇总 */
+      char **curl_results = xy_malloc0 (sizeof(char *) * size);
+      for (int i=0; i<size; i++)
         {
-          if (source_is_userdefine (source))
+          if (get_measured[i]==true)
+            pthread_join (threads[i], (void *)&curl_results[i]);
+        }
+
+      for (int i=0; i<get_measured_n; i++)
+        printf("\033[A\033[2K");
+
+      for (int i=0; i<size; i++)
+        {
+          if (get_measured[i]==true)
             {
-              char *msg = CliOpt_InEnglish ? MSG_EN_PUBLIC_URL : MSG_CN_PUBLIC_URL;
-              chsrc_log (msg);
+              printf ("%s", measure_msgs[i]);
+              MeasureResult result;
+              double speed = parse_and_say_curl_result (curl_results[i], &result);
+              speed_records[i] = speed;
+              chsrc_history_append (sources[i].mirror->code, result.speed, result.tcp,
+                                    200!=result.http_code || result.speed <= 0);
             }
-          else
+        }
+      /* 汇总结束 */
+    } /* End of if Parallel*/
+}
+
+
+
+/**
+ * 在每个测速出口上分别对所有源测速，每个源只保留其最快的出口
+ *
+ * @param      sources        所有待测源
+ * @param      size           待测源的数量
+ * @param[out] speed_records  每个源在所有出口中测得的最快速度
+ * @param[out] route_records  每个源测得最快速度时所经由的出口
+ */
+void
+measure_speed_for_every_source_via_routes (SourceInfo sources[], int size, double speed_records[], char *route_records[])
+{
+  if (CliOpt_Routes_n <= 1)
+    {
+      ProgStatus_Measure_Route = CliOpt_Routes_n ? CliOpt_Routes[0] : NULL;
+      measure_speed_for_every_source (sources, size, speed_records);
+      for (int i=0; i<size; i++)
+        route_records[i] = ProgStatus_Measure_Route;
+      return;
+    }
+
+  double records[size];
+
+  for (int r=0; r<CliOpt_Routes_n; r++)
+    {
+      ProgStatus_Measure_Route = CliOpt_Routes[r];
+
+      char *msg = CliOpt_InEnglish ? "Via " : "经由 ";
+      say (bdblue (xy_2strjoin (msg, chsrc_measure_route_name (ProgStatus_Measure_Route))));
+
+      measure_speed_for_every_source (sources, size, records);
+      say ("");
+
+      for (int i=0; i<size; i++)
+        {
+          if (0==r || records[i] > speed_records[i])
             {
-              char *msg = CliOpt_InEnglish ? MSG_EN_THANKS : MSG_CN_THANKS;
-              thank_mirror (msg);
+              speed_records[i] = records[i];
+              route_records[i] = ProgStatus_Measure_Route;
             }
         }
-      else
+    }
+}
+
+
+/**
+ * 换源前预检
+ *
+ * 测速文件快，并不代表镜像站上有我们要用的内容 (例如某个发行版代号、ubuntu-ports、debian-security)，
+ * 否则往往要等到配置文件已被改写、运行 apt update 时才发现。所以 recipe 可以在
+ * chsrc_yield_source_and_confirm() 之前用 chsrc_preflight_path() 登记换源后将引用的具体文件，
+ * 之后:
+ *
+ *   1. 自动测速时，按测速结果依次并发地 HEAD 这些文件，跳过会 404 的候选镜像站
+ *   2. 用户指定镜像站或自定义 URL 时，在 confirm_source() 中检查，不通过则在改动任何文件前退出
+ */
+#define Chsrc_Max_Preflight_Paths 16
+/* 每批并发预检的候选镜像站数 */
+#define Chsrc_Preflight_Batch     4
+
+const char *ProgStatus_Preflight_Paths[Chsrc_Max_Preflight_Paths] = {0};
+int         ProgStatus_Preflight_Paths_n = 0;
+
+/* 已通过预检的源 URL，避免 confirm_source() 中重复检查 */
+const char *ProgStatus_Preflight_Passed_Url = NULL;
+
+/**
+ * 登记一个需要预检的路径
+ *
+ * @param  path  直接拼接在源 URL 之后，如 "/dists/jammy/InRelease" 或 "-ports/dists/jammy/InRelease"
+ */
+void
+chsrc_preflight_path (const char *path)
+{
+  if (ProgStatus_Preflight_Paths_n < Chsrc_Max_Preflight_Paths)
+    ProgStatus_Preflight_Paths[ProgStatus_Preflight_Paths_n++] = xy_strdup (path);
+}
+
+typedef struct PreflightCheck_t {
+  char *url;
+  int   http_code;
+} PreflightCheck;
+
+/**
+ * 该函数实际原型为 void * (*)(PreflightCheck *)
+ */
+void *
+preflight_check_url (void *arg)
+{
+  PreflightCheck *check = arg;
+
+  char *ipv6 = CliOpt_IPv6 ? "--ipv6 " : "";
+  char *cmd = xy_strjoin (6, "curl -qsIL ", ipv6, "-o " xy_os_devnull " -w \"%{http_code}\" -m 8",
+                             " -A chsrc/" Chsrc_Banner_Version " \"", check->url, "\"");
+  char *buf = xy_run (cmd, 0, NULL);
+  check->http_code = buf ? atoi (buf) : 0;
+  return NULL;
+}
+
+/**
+ * 只有明确不存在或完全连不上才算失败；有些镜像站不支持 HEAD (405)，不能因此跳过
+ */
+static bool
+preflight_code_ok (int http_code)
+{
+  return 0!=http_code && 404!=http_code && 410!=http_code;
+}
+
+/**
+ * 并发预检多个源的全部登记路径
+ *
+ * @param      urls    待检查源的 URL
+ * @param      n       源的个数
+ * @param[out] failed  每个源第一个失败的路径与 HTTP 码，通过时为 NULL
+ */
+static void
+chsrc_preflight_run (const char *urls[], int n, char *failed[])
+{
+  int paths_n = ProgStatus_Preflight_Paths_n;
+  int total = n * paths_n;
+
+  PreflightCheck *checks  = xy_malloc0 (sizeof (PreflightCheck) * total);
+  pthread_t      *threads = xy_malloc0 (sizeof (pthread_t) * total);
+  bool           *started = xy_malloc0 (sizeof (bool) * total);
+
+  for (int i=0; i<n; i++)
+    for (int k=0; k<paths_n; k++)
+      {
+        int idx = i * paths_n + k;
+        checks[idx].url = xy_2strjoin (urls[i], ProgStatus_Preflight_Paths[k]);
+        started[idx] = 0==pthread_create (&threads[idx], NULL, preflight_check_url, &checks[idx]);
+        if (!started[idx])
+          preflight_check_url (&checks[idx]);
+      }
+
+  for (int idx=0; idx<total; idx++)
+    if (started[idx])
+      pthread_join (threads[idx], NULL);
+
+  for (int i=0; i<n; i++)
+    {
+      failed[i] = NULL;
+      for (int k=0; k<paths_n; k++)
+        {
+          PreflightCheck *c = &checks[i * paths_n + k];
+          if (!preflight_code_ok (c->http_code))
+            {
+              char code[16];
+              sprintf (code, " (HTTP %03d)", c->http_code);
+              failed[i] = xy_2strjoin (ProgStatus_Preflight_Paths[k], code);
+              break;
+            }
+        }
+    }
+
+  for (int idx=0; idx<total; idx++)
+    free (checks[idx].url);
+  free (checks); free (threads); free (started);
+}
+
+static void
+chsrc_preflight_say_time (int candidates_n, double begin)
+{
+  char buf[128];
+  sprintf (buf, CliOpt_InEnglish ? "Preflight checked %d candidate(s) in %.2fs"
+                                 : "预检 %d 个候选镜像站，用时 %.2f 秒",
+           candidates_n, chsrc_now_seconds () - begin);
+  chsrc_log2 (buf);
+}
+
+/**
+ * 按测速结果从快到慢，分批并发预检，返回第一个通过预检的源
+ *
+ * 若全部未通过，则提示后仍返回最快的源，因为此时更可能是网络或我们的预检路径有问题
+ */
+int
+chsrc_preflight_select (SourceInfo *sources, int size, double speed_records[])
+{
+  int order[size];
+  int order_n = 0;
+  for (int i=0; i<size; i++)
+    {
+      if (NULL==sources[i].url || xy_streql ("upstream", sources[i].mirror->code)) continue;
+      order[order_n++] = i;
+    }
+
+  /* 插入排序即可，源的数量很少 */
+  for (int i=1; i<order_n; i++)
+    for (int j=i; j>0 && speed_records[order[j]] > speed_records[order[j-1]]; j--)
+      {
+        int t = order[j]; order[j] = order[j-1]; order[j-1] = t;
+      }
+
+  double begin = chsrc_now_seconds ();
+  int checked_n = 0;
+
+  for (int b=0; b<order_n; b+=Chsrc_Preflight_Batch)
+    {
+      int n = order_n - b < Chsrc_Preflight_Batch ? order_n - b : Chsrc_Preflight_Batch;
+      const char *urls[n];
+      char *failed[n];
+      for (int i=0; i<n; i++)
+        urls[i] = sources[order[b+i]].url;
+
+      chsrc_preflight_run (urls, n, failed);
+      checked_n += n;
+
+      for (int i=0; i<n; i++)
+        {
+          const MirrorSite *mirror = sources[order[b+i]].mirror;
+          if (failed[i])
+            {
+              char *msg = CliOpt_InEnglish ? "Preflight skipped " : "预检跳过 ";
+              chsrc_warn2 (xy_strjoin (4, msg, mirror->code, ": ", failed[i]));
+              continue;
+            }
+          chsrc_preflight_say_time (checked_n, begin);
+          ProgStatus_Preflight_Passed_Url = sources[order[b+i]].url;
+          return order[b+i];
+        }
+    }
+
+  chsrc_preflight_say_time (checked_n, begin);
+  char *msg = CliOpt_InEnglish ? "No candidate passed the preflight check, still use the fastest one"
+                               : "没有候选镜像站通过预检，仍使用测速最快者";
+  chsrc_warn2 (msg);
+  return get_max_ele_idx_in_dbl_ary (speed_records, size);
+}
+
+
+/**
+ * 自动测速后，除选中者外其余可用的源，按速度从快到慢排列
+ *
+ * 刷新 (如 apt update) 超时后，recipe 可以用 chsrc_retry_with_next_source() 依次换用它们
+ */
+int *ProgStatus_Fallback_Sources   = NULL;
+int  ProgStatus_Fallback_Sources_n = 0;
+int  ProgStatus_Fallback_Pos       = 0;
+
+static void
+chsrc_record_fallback_sources (SourceInfo *sources, int size, double speed_records[], int chosen)
+{
+  ProgStatus_Fallback_Sources = xy_malloc0 (sizeof (int) * size);
+  ProgStatus_Fallback_Sources_n = 0;
+  ProgStatus_Fallback_Pos = 0;
+
+  int *order = ProgStatus_Fallback_Sources;
+  for (int i=0; i<size; i++)
+    {
+      if (i==chosen || NULL==sources[i].url || speed_records[i] <= 0
+          || xy_streql ("upstream", sources[i].mirror->code))
+        continue;
+      int j = ProgStatus_Fallback_Sources_n++;
+      for (; j>0 && speed_records[i] > speed_records[order[j-1]]; j--)
+        order[j] = order[j-1];
+      order[j] = i;
+    }
+}
+
+/**
+ * 换用测速排名中的下一个源；没有可换用的源 (包括用户指定了镜像站时) 则直接退出
+ *
+ * @return 总是 true，便于写在循环条件中
+ */
+bool
+chsrc_use_next_fallback_source (SourceInfo *sources, SourceInfo *source)
+{
+  if (ProgStatus_Fallback_Pos >= ProgStatus_Fallback_Sources_n)
+    {
+      char *msg = CliOpt_InEnglish ? "Refresh timed out and there is no other mirror site to fall back to"
+                                   : "刷新超时，且没有其他可换用的镜像站";
+      chsrc_error (msg);
+      exit (Exit_Timeout);
+    }
+
+  *source = sources[ProgStatus_Fallback_Sources[ProgStatus_Fallback_Pos++]];
+  char *msg = CliOpt_InEnglish ? "Refresh timed out, falling back to the next fastest mirror site: "
+                               : "刷新超时，改用测速排名下一位的镜像站: ";
+  const char *name = CliOpt_InEnglish ? source->mirror->abbr : source->mirror->name;
+  chsrc_warn (xy_strjoin (4, msg, name, " ", source->url));
+  return true;
+}
+
+/**
+ * 用法:
+ *
+ *   do { 写入 source.url; }
+ *   while (Run_Timeout==chsrc_run ("apt update", RunOpt_Refresh|RunOpt_Retry_On_Timeout)
+ *          && chsrc_retry_with_next_source (os_ubuntu));
+ *
+ * @dependency 变量 source
+ */
+#define chsrc_retry_with_next_source(for_what) chsrc_use_next_fallback_source (for_what##_sources, &source)
+
+
+/**
+ * 一次调用处理多个目标时 (如 chsrc set ubuntu,ros)，清除上一个目标留下的状态
+ */
+static void
+chsrc_reset_target_status ()
+{
+  ProgStatus_Preflight_Paths_n   = 0;
+  ProgStatus_Preflight_Passed_Url = NULL;
+  ProgStatus_Fallback_Sources_n  = 0;
+  ProgStatus_Fallback_Pos        = 0;
+  ProgStatus_Git_Probe           = false;
+  ProgStatus_Git_Probe_Prefix    = NULL;
+  ProgStatus_Git_Probe_Suffix    = NULL;
+  ProgStatus_Measure_Target      = NULL;
+}
+
+
+/**
+ * 自动测速选择镜像站和源
+ *
+ * @translation Done
+ */
+#define auto_select_mirror(s) select_mirror_autoly(s##_sources, s##_sources_n, (char*)#s+3)
+int
+select_mirror_autoly (SourceInfo *sources, size_t size, const char *target_name)
+{
+  {
+  char *msg = NULL;
+
+  if (CliOpt_Parallel)
+    msg = CliOpt_InEnglish ? "Measuring speed in parallel. We recommend you use the default sequential measure for more referential results"
+                           : "即将并行测速，建议使用默认的顺序测速以获得更具参考意义的结果";
+  else
+    msg = CliOpt_InEnglish ? "Measuring speed in sequence" : "顺序测速中";
+
+  xy_log_brkt (App_Name, bdpurple (CliOpt_InEnglish ? "MEASURE" : "测速"), msg);
+  say ("");
+  }
+
+  if (0==size || 1==size)
+    {
+      char *msg1 = CliOpt_InEnglish ? "Currently " : "当前 ";
+      char *msg2 = CliOpt_InEnglish ? "No any source, please contact maintainers: chsrc issue" : " 无任何可用源，请联系维护者: chsrc issue";
+      chsrc_error (xy_strjoin (3, msg1, target_name, msg2));
+      exit (Exit_MatinerIssue);
+    }
+
+  if (CliOpt_DryRun)
+    {
+      return 1; // Dry Run 时，跳过测速
+    }
+
+  bool only_one = false;
+  if (2==size) only_one = true;
+
+  /** --------------------------------------------- */
+  bool exist_curl = chsrc_check_program_quietly_when_exist ("curl");
+  if (!exist_curl)
+    {
+      char *msg = CliOpt_InEnglish ? "No curl, unable to measure speed" : "没有curl命令，无法测速";
+      chsrc_error (msg);
+      exit (Exit_UserCause);
+    }
+  /** --------------------------------------------- */
+
+  /* 总测速记录值 */
+  double speed_records[size];
+  /* 每个源测得最快速度时所经由的出口 */
+  char  *route_records[size];
+  ProgStatus_Measure_Target = target_name;
+  measure_speed_for_every_source_via_routes (sources, size, speed_records, route_records);
+  if (CliOpt_Routes_n <= 1) say ("");
+
+  if (CliOpt_RankByMedian)
+    {
+      char *msg = CliOpt_InEnglish ? "Ranking by the long-term median of measurement history"
+                                   : "按历史测速的中位数排序";
+      chsrc_info (msg);
+      chsrc_history_apply_median (sources, size, speed_records, route_records);
+    }
+
+  /* DEBUG */
+  /*
+  for (int i=0; i<size; i++)
+    {
+      printf ("speed_records[%d] = %f\n", i, speed_records[i]);
+    }
+  */
+
+  int fast_idx = get_max_ele_idx_in_dbl_ary (speed_records, size);
+
+  if (ProgStatus_Preflight_Paths_n > 0)
+    fast_idx = chsrc_preflight_select (sources, size, speed_records);
+
+  chsrc_record_fallback_sources (sources, size, speed_records, fast_idx);
+
+  if (only_one)
+    {
+      char *msg1 = CliOpt_InEnglish ? "NOTICE  mirror site: " : "镜像站提示: ";
+      char   *is = CliOpt_InEnglish ? " is " : " 是 ";
+      char *msg2 = CliOpt_InEnglish ? "'s ONLY mirror available currently, thanks for their generous support"
+                                    : " 目前唯一可用镜像站，感谢他们的慷慨支持";
+      const char *name = CliOpt_InEnglish ? sources[fast_idx].mirror->abbr
+                                          : sources[fast_idx].mirror->name;
+      say (xy_strjoin (5, msg1, bdgreen(name), green(is), green(target_name), green(msg2)));
+    }
+  else
+    {
+      char *msg = CliOpt_InEnglish ? "FASTEST mirror site: " : "最快镜像站: ";
+      const char *name = CliOpt_InEnglish ? sources[fast_idx].mirror->abbr
+                                          : sources[fast_idx].mirror->name;
+      say (xy_2strjoin (msg, green(name)));
+    }
+
+  if (CliOpt_Routes_n > 0)
+    {
+      char *msg = CliOpt_InEnglish ? "FASTEST via: " : "最快出口: ";
+      say (xy_2strjoin (msg, green (chsrc_measure_route_name (route_records[fast_idx]))));
+    }
+
+  // https://github.com/RubyMetric/chsrc/pull/71
+  if (ProgMode_CMD_Measure)
+    {
+      char *msg = CliOpt_InEnglish ? "URL of above source: " : "镜像源地址: ";
+      say (xy_2strjoin (msg, green(sources[fast_idx].url)));
+    }
+
+  return fast_idx;
+}
+
+
+#define use_specific_mirror_or_auto_select(input, s) \
+  (NULL!=(input)) ? find_mirror(s, input) : auto_select_mirror(s)
+
+
+
+bool
+source_is_upstream (SourceInfo *source)
+{
+  return xy_streql (source->mirror->code, "upstream");
+}
+
+bool
+source_is_userdefine (SourceInfo *source)
+{
+  return xy_streql (source->mirror->code, "user");
+}
+
+bool
+source_has_empty_url (SourceInfo *source)
+{
+  return source->url == NULL;
+}
+
+/**
+ * 用户*只可能*通过下面三种方式来换源，无论哪一种都会返回一个 SourceInfo 出来
+ *
+ * 1. 用户指定 MirrorCode
+ * 2. 用户什么都没指定 (将测速选择最快镜像)
+ * 3. 用户给了一个 URL
+ *
+ * @dependency 变量 option
+ * @dependency 变量 source
+ */
+#define chsrc_yield_source(for_what) \
+  SourceInfo source; \
+  if (is_url (option)) \
+    { \
+      SourceInfo __tmp = { &UserDefine, option }; \
+      source = __tmp; \
+    } \
+  else \
+    { \
+      int __index = use_specific_mirror_or_auto_select (option, for_what); \
+      source = for_what##_sources[__index]; \
+    }
+
+
+
+#define split_between_source_changing_process   puts ("--------------------------------")
+
+/**
+ * 用于 _setsrc 函数
+ *
+ * 1. 告知用户选择了什么源和镜像
+ * 2. 对选择的源和镜像站进行一定的校验
+ *
+ * @translation Done
+ */
+#define chsrc_confirm_source confirm_source(&source)
+void
+confirm_source (SourceInfo *source)
+{
+  // 由于实现问题，我们把本应该独立出去的默认上游源，也放在了可以换源的数组中，而且放在第一个
+  // chsrc 已经规避用户使用未实现的 `chsrc reset`
+  // 但是某些用户可能摸索着强行使用 chsrc set target upstream，从而执行起该禁用的功能，
+  // 之所以禁用，是因为有的 reset 我们并没有实现，我们在这里阻止这些邪恶的用户
+  if (source_is_upstream (source) && source_has_empty_url (source))
+    {
+      char *msg = CliOpt_InEnglish ? "Not implement RESET for the target yet" : "暂未对该目标实现重置";
+      chsrc_error (msg);
+      exit (Exit_Unsupported);
+    }
+  else if (source_has_empty_url (source))
+    {
+      char *msg = CliOpt_InEnglish ? "URL of the source doesn't exist, please report a bug to the dev team" : \
+                                     "该源URL不存在，请向开发团队提交bug";
+      chsrc_error (msg);
+      exit (Exit_FatalBug);
+    }
+  else
+    {
+      char *msg = CliOpt_InEnglish ? "SELECT  mirror site: " : "选中镜像站: ";
+      say (xy_strjoin (5, msg, green (source->mirror->abbr), " (", green (source->mirror->code), ")"));
+    }
+
+  if (ProgStatus_Preflight_Paths_n > 0 && !CliOpt_DryRun
+      && ProgStatus_Preflight_Passed_Url != source->url)
+    {
+      double begin = chsrc_now_seconds ();
+      char *failed = NULL;
+      chsrc_preflight_run (&source->url, 1, &failed);
+      chsrc_preflight_say_time (1, begin);
+
+      if (failed)
+        {
+          char *msg = CliOpt_InEnglish ? "The source failed the preflight check, nothing has been changed: "
+                                       : "该源未通过预检，未做任何改动: ";
+          chsrc_error (xy_2strjoin (msg, failed));
+          exit (Exit_UserCause);
+        }
+      ProgStatus_Preflight_Passed_Url = source->url;
+    }
+
+  split_between_source_changing_process;
+}
+
+#define chsrc_yield_source_and_confirm(for_what) chsrc_yield_source(for_what);chsrc_confirm_source
+
+
+#define ChsrcTypeAuto     "auto"
+#define ChsrcTypeReset    "reset"
+#define ChsrcTypeSemiAuto "semiauto"
+#define ChsrcTypeManual   "manual"
+#define ChsrcTypeUntested "untested"
+
+#define MSG_EN_PUBLIC_URL "If the URL you specify is a public service, you are invited to contribute: chsrc issue"
+#define MSG_CN_PUBLIC_URL "若您指定的URL为公有服务，邀您参与贡献: chsrc issue"
+
+#define MSG_EN_FULLY_AUTO "Fully-Auto changed source. "
+#define MSG_CN_FULLY_AUTO "全自动换源完成"
+
+#define MSG_EN_SEMI_AUTO  "Semi-Auto changed source. "
+#define MSG_CN_SEMI_AUTO  "半自动换源完成"
+
+#define MSG_EN_THANKS     "Thanks to the mirror site: "
+#define MSG_CN_THANKS     "感谢镜像提供方: "
+
+#define MSG_EN_BETTER     "If you have a better source changing method , please help: chsrc issue"
+#define MSG_CN_BETTER     "若您有更好的换源方案，邀您帮助: chsrc issue"
+
+#define MSG_EN_CONSTRAINT "Implementation constraints require manual operation according to the above prompts. "
+#define MSG_CN_CONSTRAINT "因实现约束需按上述提示手工操作"
+
+#define MSG_EN_STILL      "Still need to operate manually according to the above prompts. "
+#define MSG_CN_STILL      "仍需按上述提示手工操作"
+
+#define thank_mirror(msg) chsrc_log(xy_2strjoin(msg,purple(CliOpt_InEnglish?source->mirror->abbr:source->mirror->name)))
+
+/**
+ * @param source    可为NULL
+ * @param last_word 5种选择：ChsrcTypeAuto | ChsrcTypeReset | ChsrcTypeSemiAuto | ChsrcTypeManual | ChsrcTypeUntested
+ * @translation Done
+ */
+void
+chsrc_conclude (SourceInfo *source, const char *last_word)
+{
+  split_between_source_changing_process;
+
+  if (xy_streql (ChsrcTypeAuto, last_word))
+    {
+      if (source)
+        {
+          if (source_is_userdefine (source))
+            {
+              char *msg = CliOpt_InEnglish ? MSG_EN_FULLY_AUTO      MSG_EN_PUBLIC_URL \
+                                           : MSG_CN_FULLY_AUTO ", " MSG_CN_PUBLIC_URL;
+              chsrc_log (msg);
+            }
+          else
+            {
+              char *msg = CliOpt_InEnglish ? MSG_EN_FULLY_AUTO      MSG_EN_THANKS \
+                                           : MSG_CN_FULLY_AUTO ", " MSG_CN_THANKS;
+              thank_mirror (msg);
+            }
+        }
+      else
+        {
+          char *msg = CliOpt_InEnglish ? MSG_EN_FULLY_AUTO : MSG_CN_FULLY_AUTO;
+          chsrc_log (msg);
+        }
+    }
+  else if (xy_streql (ChsrcTypeReset, last_word))
+    {
+      // source_is_upstream (source)
+      char *msg = CliOpt_InEnglish ? "Has been reset to the upstream default source" : "已重置为上游默认源";
+      chsrc_log (purple (msg));
+    }
+  else if (xy_streql (ChsrcTypeSemiAuto, last_word))
+    {
+      if (source)
+        {
+          if (source_is_userdefine (source))
+            {
+              char *msg = CliOpt_InEnglish ? MSG_EN_SEMI_AUTO      MSG_EN_STILL      MSG_EN_PUBLIC_URL \
+                                           : MSG_CN_SEMI_AUTO ", " MSG_CN_STILL "。" MSG_CN_PUBLIC_URL;
+              chsrc_log (msg);
+            }
+          else
+            {
+              char *msg = CliOpt_InEnglish ? MSG_EN_SEMI_AUTO      MSG_EN_STILL      MSG_EN_THANKS \
+                                           : MSG_CN_SEMI_AUTO ", " MSG_CN_STILL "。" MSG_CN_THANKS;
+              thank_mirror (msg);
+            }
+        }
+      else
+        {
+          char *msg = CliOpt_InEnglish ? MSG_EN_SEMI_AUTO      MSG_EN_STILL \
+                                       : MSG_CN_SEMI_AUTO ", " MSG_CN_STILL;
+          chsrc_log (msg);
+        }
+
+      char *msg = CliOpt_InEnglish ? MSG_EN_BETTER : MSG_CN_BETTER;
+      chsrc_warn (msg);
+    }
+  else if (xy_streql (ChsrcTypeManual, last_word))
+    {
+      if (source)
+        {
+          if (source_is_userdefine (source))
+            {
+              char *msg = CliOpt_InEnglish ? MSG_EN_CONSTRAINT      MSG_EN_PUBLIC_URL \
+                                           : MSG_CN_CONSTRAINT "; " MSG_CN_PUBLIC_URL;
+              chsrc_log (msg);
+            }
+          else
+            {
+              char *msg = CliOpt_InEnglish ? MSG_EN_CONSTRAINT      MSG_EN_THANKS \
+                                           : MSG_CN_CONSTRAINT ", " MSG_CN_THANKS;
+              thank_mirror (msg);
+            }
+        }
+      else
+        {
+          char *msg = CliOpt_InEnglish ? MSG_EN_CONSTRAINT : MSG_CN_CONSTRAINT;
+          chsrc_log (msg);
+        }
+      char *msg = CliOpt_InEnglish ? MSG_EN_BETTER : MSG_CN_BETTER;
+      chsrc_warn (msg);
+    }
+  else if (xy_streql (ChsrcTypeUntested, last_word))
+    {
+      if (source)
+        {
+          if (source_is_userdefine (source))
+            {
+              char *msg = CliOpt_InEnglish ? MSG_EN_PUBLIC_URL : MSG_CN_PUBLIC_URL;
+              chsrc_log (msg);
+            }
+          else
+            {
+              char *msg = CliOpt_InEnglish ? MSG_EN_THANKS : MSG_CN_THANKS;
+              thank_mirror (msg);
+            }
+        }
+      else
+        {
+          char *msg = CliOpt_InEnglish ? "Auto changed source" : "自动换源完成";
+          chsrc_log (msg);
+        }
+
+      char *msg = CliOpt_InEnglish ? "The method hasn't been tested or has any feedback, please report usage: chsrc issue" : "该换源步骤已实现但未经测试或存在任何反馈，请报告使用情况: chsrc issue";
+      chsrc_warn (msg);
+    }
+  else
+    {
+      say (last_word);
+    }
+}
+
+
+
+/**
+ * 平台信息: CPU 架构、内核、权限以及 os-release
+ *
+ * 均直接通过系统调用与读取文件获得，不运行任何外部命令。首次使用时一次性收集，此后一直复用
+ */
+#define ETC_OS_RELEASE         "/etc/os-release"
+#define USR_LIB_OS_RELEASE     "/usr/lib/os-release"
+#define Chsrc_Max_OS_Release   64
+
+typedef struct PlatformFacts_t {
+  char *sysname;   /* 如 Linux, NetBSD */
+  char *release;   /* 内核版本，如 6.1.0-13-amd64, 9.3 */
+  char *machine;   /* CPU 架构，如 x86_64, aarch64 */
+  bool  is_root;   /* 有效用户是否为 root */
+
+  int   os_release_n;
+  char *os_release_key[Chsrc_Max_OS_Release];
+  char *os_release_val[Chsrc_Max_OS_Release];
+} PlatformFacts;
+
+static PlatformFacts ProgStatus_Platform;
+static bool          ProgStatus_Platform_Loaded = false;
+
+/**
+ * 按 os-release(5) 解析一行的值: 去掉引号，并处理双引号中的 \ 转义
+ */
+static char *
+os_release_unquote (const char *val)
+{
+  char *ret = xy_malloc0 (strlen (val) + 1);
+  char *cur = ret;
+  char quote = 0;
+  if ('"'==*val || '\''==*val)
+    quote = *val++;
+
+  for (const char *p = val; *p; p++)
+    {
+      if (quote && *p==quote) break;
+      if ('"'==quote && '\\'==*p && p[1])
+        p++;
+      *cur++ = *p;
+    }
+  return xy_str_strip (ret);
+}
+
+static void
+platform_load_os_release ()
+{
+  FILE *f = fopen (ETC_OS_RELEASE, "r");
+  if (!f) f = fopen (USR_LIB_OS_RELEASE, "r");
+  if (!f) return;
+
+  char line[1024];
+  while (fgets (line, sizeof line, f) && ProgStatus_Platform.os_release_n < Chsrc_Max_OS_Release)
+    {
+      char *eq = strchr (line, '=');
+      if ('#'==line[0] || !eq) continue;
+      *eq = '\0';
+
+      char *val = xy_str_delete_suffix (eq + 1, "\n");
+      int i = ProgStatus_Platform.os_release_n++;
+      ProgStatus_Platform.os_release_key[i] = xy_str_strip (xy_strdup (line));
+      ProgStatus_Platform.os_release_val[i] = os_release_unquote (val);
+    }
+  fclose (f);
+}
+
+/**
+ * @return 本机的平台信息，只在第一次调用时收集
+ */
+static const PlatformFacts *
+chsrc_platform ()
+{
+  if (ProgStatus_Platform_Loaded)
+    return &ProgStatus_Platform;
+  ProgStatus_Platform_Loaded = true;
+
+  PlatformFacts *pf = &ProgStatus_Platform;
+#if XY_On_Windows
+  pf->sysname = "Windows";
+  pf->release = "";
+  pf->machine = "";
+  /* Windows 上的 recipe 不需要 root 权限 */
+  pf->is_root = true;
+#else
+  struct utsname un;
+  if (0==uname (&un))
+    {
+      pf->sysname = xy_strdup (un.sysname);
+      pf->release = xy_strdup (un.release);
+      pf->machine = xy_strdup (un.machine);
+    }
+  else
+    {
+      pf->sysname = pf->release = pf->machine = "";
+    }
+  pf->is_root = 0==geteuid ();
+  platform_load_os_release ();
+#endif
+  return pf;
+}
+
+/**
+ * 获取 os-release 中某一项的值，引号已被去掉
+ *
+ * @return 不存在该项 (或不存在 os-release 文件) 时返回 NULL
+ */
+static char *
+chsrc_os_release (const char *key)
+{
+  const PlatformFacts *pf = chsrc_platform ();
+  for (int i=0; i<pf->os_release_n; i++)
+    {
+      if (xy_streql (pf->os_release_key[i], key))
+        return pf->os_release_val[i];
+    }
+  return NULL;
+}
+
+
+void
+chsrc_ensure_root ()
+{
+  if (chsrc_platform ()->is_root)
+    return;
+
+  char *msg = CliOpt_InEnglish ? "Use sudo before the command or switch to root to ensure the necessary permissions"
+                               : "请在命令前使用 sudo 或切换为root用户来保证必要的权限";
+  chsrc_error (msg);
+  exit (Exit_UserCause);
+}
+
+
+#define RunOpt_Default                0x0000  // 默认若命令运行失败，直接退出
+#define RunOpt_Refresh                0x0002  // 刷新软件源元数据 (如 apt update)，默认超时为 Chsrc_Refresh_Timeout
+#define RunOpt_Retry_On_Timeout       0x0004  // 超时时不退出，而返回 Run_Timeout，以便调用者换用下一个镜像站重试
+#define RunOpt_Dont_Notify_On_Success 0x0010  // 运行成功不提示用户，只有运行失败时才提示用户
+#define RunOpt_No_Last_New_Line       0x0100  // 不输出最后的空行
+#define RunOpt_Dont_Abort_On_Failure  0x1000  // 命令运行失败也不退出
+
+/* 高 16 位存放该命令的超时秒数，如 RunOpt_Timeout(120)|RunOpt_Default */
+#define RunOpt_Timeout(sec)           ((sec) << 16)
+#define RunOpt_Get_Timeout(opt)       (((opt) >> 16) & 0x7fff)
+
+#define Chsrc_Refresh_Timeout 600
+
+/* chsrc_run() 的返回值 */
+#define Run_Succ    0
+#define Run_Failed  1
+#define Run_Timeout 2
+
+/**
+ * 运行一条命令
+ *
+ * 超时秒数依次取自 -cmd-timeout、RunOpt_Timeout()、RunOpt_Refresh 的默认值，都没有时不限时。
+ * 超时后终止该命令的整个进程组
+ *
+ * @return Run_Succ, Run_Failed 或 Run_Timeout；若失败且未指定不退出，则不会返回
+ */
+static int
+chsrc_run (const char *cmd, int run_option)
+{
+  if (CliOpt_InEnglish)
+    xy_log_brkt (blue (App_Name), bdblue ("RUN"), blue (cmd));
+  else
+    xy_log_brkt (blue (App_Name), bdblue ("运行"), blue (cmd));
+
+  if (CliOpt_DryRun)
+    {
+      return Run_Succ; // Dry Run 此时立即结束，并不真正执行
+    }
+
+  int timeout = RunOpt_Get_Timeout (run_option);
+  if (CliOpt_Cmd_Timeout >= 0)
+    timeout = CliOpt_Cmd_Timeout;
+  else if (0==timeout && (run_option & RunOpt_Refresh))
+    timeout = Chsrc_Refresh_Timeout;
+
+  /* 不含管道、重定向等的命令直接以 argv 运行，不再经过 /bin/sh */
+  XyProc proc = xy_spawn_cmd_timeout (cmd, 0, timeout);
+  int status = Run_Succ;
+  if (xy_proc_succ (&proc))
+    {
+      if (! (RunOpt_Dont_Notify_On_Success & run_option))
+        {
+          log_cmd_result (true, &proc);
+        }
+    }
+  else if (proc.timed_out)
+    {
+      status = Run_Timeout;
+      log_cmd_result (false, &proc);
+      char buf[256];
+      sprintf (buf, CliOpt_InEnglish ? "Command did not finish within %d seconds (adjust with -cmd-timeout)"
+                                     : "命令未能在 %d 秒内完成 (可用 -cmd-timeout 调整)", timeout);
+      if (run_option & (RunOpt_Retry_On_Timeout|RunOpt_Dont_Abort_On_Failure))
+        chsrc_warn (buf);
+      else
+        {
+          chsrc_error (buf);
+          exit (Exit_Timeout);
+        }
+    }
+  else
+    {
+      status = Run_Failed;
+      log_cmd_result (false, &proc);
+      if (! (run_option & RunOpt_Dont_Abort_On_Failure))
+        {
+          char *msg = CliOpt_InEnglish ? "Fatal error, forced end" : "关键错误，强制结束";
+          chsrc_error (msg);
+          exit (Exit_FatalUnkownError);
+        }
+    }
+
+  if (! (RunOpt_No_Last_New_Line & run_option))
+    {
+      br();
+    }
+  return status;
+}
+
+
+/**
+ * 立即按 -refresh 指定的策略刷新，参数见 chsrc_refresh()
+ */
+static int
+chsrc_refresh_now (const char *metadata_cmd, const char *targeted_cmd, const char *full_cmd, int run_option)
+{
+  const char *cmd = metadata_cmd;
+  switch (CliOpt_Refresh)
+    {
+    case RefreshPolicy_None:
+      {
+        char *msg = CliOpt_InEnglish ? "Skipped refreshing (-refresh=none), please run later: "
+                                     : "已按 -refresh=none 跳过刷新，稍后请自行运行: ";
+        chsrc_note2 (xy_2strjoin (msg, metadata_cmd));
+        return Run_Succ;
+      }
+    case RefreshPolicy_Targeted:
+      if (targeted_cmd) cmd = targeted_cmd;
+      break;
+    case RefreshPolicy_Full:
+      if (full_cmd)
+        {
+          /* 升级可能很久，不使用刷新的默认超时 */
+          return chsrc_run (full_cmd, run_option);
+        }
+      break;
+    }
+  return chsrc_run (cmd, run_option | RunOpt_Refresh);
+}
+
+
+/**
+ * 一次处理多个目标时，刷新推迟到所有目标换源完成之后，
+ * 每个包管理器 (以刷新命令的第一个词区分，如 apt, pacman, dnf) 只刷新一次
+ */
+typedef struct RefreshIntent_t
+{
+  char       *manager;
+  const char *metadata_cmd;
+  const char *targeted_cmd;
+  const char *full_cmd;
+  int         run_option;
+  bool        pending;
+}
+RefreshIntent;
+
+#define Chsrc_Max_Refresh_Intents 8
+
+bool          ProgStatus_Defer_Refresh = false;
+RefreshIntent ProgStatus_Refresh_Intents[Chsrc_Max_Refresh_Intents];
+int           ProgStatus_Refresh_Intents_n = 0;
+
+static char *
+refresh_manager_of (const char *cmd)
+{
+  const char *end = strchr (cmd, ' ');
+  size_t len = end ? (size_t) (end - cmd) : strlen (cmd);
+  char *manager = xy_malloc0 (len + 1);
+  memcpy (manager, cmd, len);
+  return manager;
+}
+
+static RefreshIntent *
+refresh_intent_of (const char *manager)
+{
+  for (int i=0; i<ProgStatus_Refresh_Intents_n; i++)
+    {
+      if (xy_streql (ProgStatus_Refresh_Intents[i].manager, manager))
+        return &ProgStatus_Refresh_Intents[i];
+    }
+  return NULL;
+}
+
+
+/**
+ * 换源后刷新软件源，遵循 -refresh 指定的策略，默认只刷新元数据
+ *
+ * 处理多个目标时只登记刷新意图，由 chsrc_flush_refresh() 统一执行；
+ * 同一包管理器被多个目标登记时，targeted 刷新退化为 metadata 刷新
+ *
+ * @param  metadata_cmd  只刷新元数据的命令，如 "pacman -Syy"
+ * @param  targeted_cmd  只刷新本次换源涉及的仓库的命令，为 NULL 时使用 metadata_cmd
+ * @param  full_cmd      刷新并升级整个系统的命令，如 "pacman -Syyu"，为 NULL 时使用 metadata_cmd
+ *
+ * @return 同 chsrc_run()，不刷新或推迟刷新时为 Run_Succ
+ */
+static int
+chsrc_refresh (const char *metadata_cmd, const char *targeted_cmd, const char *full_cmd, int run_option)
+{
+  if (!ProgStatus_Defer_Refresh)
+    return chsrc_refresh_now (metadata_cmd, targeted_cmd, full_cmd, run_option);
+
+  char *manager = refresh_manager_of (metadata_cmd);
+  RefreshIntent *intent = refresh_intent_of (manager);
+
+  if (intent)
+    {
+      if (intent->pending && !xy_streql (intent->targeted_cmd, targeted_cmd))
+        intent->targeted_cmd = NULL;
+      else if (!intent->pending)
+        intent->targeted_cmd = targeted_cmd;
+      intent->pending = true;
+    }
+  else if (ProgStatus_Refresh_Intents_n < Chsrc_Max_Refresh_Intents)
+    {
+      intent = &ProgStatus_Refresh_Intents[ProgStatus_Refresh_Intents_n++];
+      intent->manager      = manager;
+      intent->metadata_cmd = metadata_cmd;
+      intent->targeted_cmd = targeted_cmd;
+      intent->full_cmd     = full_cmd;
+      /* 推迟后已无法换用其他源重试 */
+      intent->run_option   = run_option & ~RunOpt_Retry_On_Timeout;
+      intent->pending      = true;
+    }
+  else
+    {
+      return chsrc_refresh_now (metadata_cmd, targeted_cmd, full_cmd, run_option);
+    }
+
+  char *msg = CliOpt_InEnglish ? "Refresh deferred until all targets are done: "
+                               : "刷新将在所有目标换源完成后进行: ";
+  chsrc_note2 (xy_2strjoin (msg, manager));
+  return Run_Succ;
+}
+
+
+/**
+ * recipe 换源过程中已经以新源刷新过 manager 的元数据 (如 pacman -Sy xxx-keyring)，
+ * 此前登记的同一包管理器的刷新不再需要
+ *
+ * @return 已满足返回 true；-refresh=full 时仍需升级，返回 false，由调用者继续调用 chsrc_refresh()
+ */
+static bool
+chsrc_refresh_satisfied (const char *manager)
+{
+  if (RefreshPolicy_Full==CliOpt_Refresh)
+    return false;
+
+  RefreshIntent *intent = refresh_intent_of (manager);
+  if (intent) intent->pending = false;
+  return true;
+}
+
+
+/**
+ * 执行所有推迟的刷新，每个包管理器一次
+ *
+ * 某个刷新失败后仍继续执行其余的刷新
+ *
+ * @return 登记时未指定 RunOpt_Dont_Abort_On_Failure 的刷新都成功返回 true，
+ *         否则返回 false，此时调用者应像未推迟时那样以失败退出
+ */
+static bool
+chsrc_flush_refresh ()
+{
+  bool all_succ = true;
+  for (int i=0; i<ProgStatus_Refresh_Intents_n; i++)
+    {
+      RefreshIntent *intent = &ProgStatus_Refresh_Intents[i];
+      if (!intent->pending) continue;
+      intent->pending = false;
+      int status = chsrc_refresh_now (intent->metadata_cmd, intent->targeted_cmd, intent->full_cmd,
+                                      intent->run_option | RunOpt_Dont_Abort_On_Failure);
+      if (Run_Succ!=status && !(intent->run_option & RunOpt_Dont_Abort_On_Failure))
+        all_succ = false;
+    }
+  ProgStatus_Defer_Refresh = false;
+  return all_succ;
+}
+
+
+/**
+ * 返回 str 中内容恰为 line 的那一行的开头，找不到时返回 NULL
+ */
+static const char *
+find_whole_line (const char *str, const char *line)
+{
+  size_t len = strlen (line);
+  for (const char *p = strstr (str, line); p; p = strstr (p + 1, line))
+    {
+      bool at_begin = (p==str || '\n'==p[-1]);
+      bool at_end   = ('\n'==p[len] || '\0'==p[len]);
+      if (at_begin && at_end) return p;
+    }
+  return NULL;
+}
+
+/**
+ * 取出一行中的第一个 URL (包括 sparse+https:// 这样带前缀的写法)，注释行不算
+ *
+ * @return 没有时返回 NULL
+ */
+static char *
+chsrc_url_in_line (const char *line, size_t len)
+{
+  const char *p = line, *end = line + len;
+  while (p < end && (' '==*p || '\t'==*p)) p++;
+  if (p < end && ('#'==*p || ';'==*p)) return NULL;
+  if (p + 1 < end && (('-'==p[0] && '-'==p[1]) || ('/'==p[0] && '/'==p[1]))) return NULL;
+
+  for (; p + 3 <= end; p++)
+    {
+      if (0!=strncmp (p, "://", 3)) continue;
+
+      const char *b = p;
+      while (b > line && (isalnum ((unsigned char) b[-1]) || strchr ("+.-", b[-1]))) b--;
+      if (b==p) continue;
+
+      const char *e = p + 3;
+      while (e < end && !isspace ((unsigned char) *e) && !strchr ("\"'`,;<>[](){}", *e)) e++;
+      if (e==p + 3) continue;
+      return xy_strndup (b, e - b);
+    }
+  return NULL;
+}
+
+/**
+ * 在进程内显示配置文件，其中未被注释掉、含有 URL 的行 (即与源相关的行) 会高亮显示，
+ * 最后再单独列出这些 URL
+ */
+static void
+chsrc_view_file (const char *path)
+{
+  path = xy_uniform_path (path);
+
+  if (!xy_file_exist (path))
+    {
+      char *msg = CliOpt_InEnglish ? "File doesn't exist: " : "文件不存在: ";
+      chsrc_note2 (xy_2strjoin (msg, path));
+      return;
+    }
+
+  size_t len = 0;
+  char *content = xy_file_read (path, &len);
+  if (!content)
+    {
+      char *msg = CliOpt_InEnglish ? "Unable to read " : "无法读取 ";
+      chsrc_warn2 (xy_2strjoin (msg, path));
+      return;
+    }
+
+  xy_log_brkt (blue (App_Name), bdblue (CliOpt_InEnglish ? "VIEW" : "查看"), blue (path));
+
+  char *urls = NULL;
+  for (char *line = content; line < content + len; )
+    {
+      char *nl = memchr (line, '\n', content + len - line);
+      size_t n = nl ? (size_t) (nl - line) : (size_t) (content + len - line);
+      char *url = chsrc_url_in_line (line, n);
+      if (url)
+        {
+          char *text = xy_strndup (line, n);
+          printf ("%s\n", bdgreen (text));
+
+          /* 同一地址常出现在多行 (如 main 与 updates) 中，只列一次 */
+          if (!urls)
+            urls = url;
+          else if (!find_whole_line (urls, url))
+            urls = xy_strjoin (3, urls, "\n", url);
+        }
+      else
+        {
+          fwrite (line, 1, n, stdout);
+          putchar ('\n');
+        }
+      line += n + 1;
+    }
+
+  if (urls)
+    xy_log_brkt (blue (App_Name), bdblue (CliOpt_InEnglish ? "SOURCE" : "源"), blue (urls));
+  fflush (stdout);
+}
+
+static void
+chsrc_ensure_dir (const char *dir)
+{
+  dir = xy_uniform_path (dir);
+
+  if (xy_dir_exist (dir))
+    {
+      return;
+    }
+
+  // 不存在就生成
+  if (!CliOpt_DryRun && !xy_mkdir_p (dir))
+    {
+      char *msg = CliOpt_InEnglish ? "Unable to create directory " : "无法创建目录 ";
+      chsrc_error (xy_2strjoin (msg, dir));
+      exit (Exit_FatalUnkownError);
+    }
+  char *msg = CliOpt_DryRun ? (CliOpt_InEnglish ? "Directory doesn't exist, will be created " : "目录不存在，将自动创建 ")
+                            : (CliOpt_InEnglish ? "Directory doesn't exist, created automatically " : "目录不存在，已自动创建 ");
+  chsrc_note2 (xy_2strjoin (msg, dir));
+}
+
+/**
+ * Dry Run 时的计划模式: 修改文件的函数照常在内存中算出新内容，但不写入磁盘，
+ * 而是打印与原内容的 unified diff
+ *
+ * 同一文件在一次运行中被多次修改时，后面的修改基于前面计划写入的内容
+ */
+#define Chsrc_Max_Planned_Files 32
+
+typedef struct PlannedFile_t
+{
+  char *path;
+  char *content;
+}
+PlannedFile;
+
+PlannedFile ProgStatus_Planned_Files[Chsrc_Max_Planned_Files];
+int         ProgStatus_Planned_Files_n = 0;
+
+static PlannedFile *
+planned_file_of (const char *path)
+{
+  for (int i=0; i<ProgStatus_Planned_Files_n; i++)
+    if (xy_streql (ProgStatus_Planned_Files[i].path, path))
+      return &ProgStatus_Planned_Files[i];
+  return NULL;
+}
+
+/**
+ * 读取将被修改的文件，Dry Run 时读到的是本次运行中计划写入的内容
+ *
+ * @return 文件不存在时返回 NULL
+ */
+static char *
+chsrc_read_file_for_change (const char *path)
+{
+  path = xy_uniform_path (path);
+
+  PlannedFile *planned = CliOpt_DryRun ? planned_file_of (path) : NULL;
+  if (planned) return xy_strdup (planned->content);
+
+  if (!xy_file_exist (path)) return NULL;
+
+  char *content = xy_file_read (path, NULL);
+  if (!content)
+    {
+      char *msg = CliOpt_InEnglish ? "Unable to read " : "无法读取 ";
+      if (CliOpt_DryRun)
+        {
+          /* 比如非 root 用户预览对 /etc 下文件的修改 */
+          chsrc_warn2 (xy_2strjoin (msg, path));
+          return xy_strdup ("");
+        }
+      chsrc_error (xy_2strjoin (msg, path));
+      exit (Exit_FatalUnkownError);
+    }
+  return content;
+}
+
+static void
+print_diff (const char *diff)
+{
+  char *copy = xy_strdup (diff);
+  char *next = NULL;
+  for (char *line = copy; *line; line = next)
+    {
+      next = strchr (line, '\n');
+      if (next) *next++ = '\0';
+      else next = line + strlen (line);
+
+      if (xy_str_start_with (line, "---") || xy_str_start_with (line, "+++"))
+        puts (bold (line));
+      else if ('@'==line[0]) puts (purple (line));
+      else if ('-'==line[0]) puts (red (line));
+      else if ('+'==line[0]) puts (green (line));
+      else puts (line);
+    }
+  free (copy);
+}
+
+/**
+ * 用 content 整体替换文件内容，见 xy_file_write()
+ *
+ * Dry Run 时不写入，只记下新内容并打印 diff
+ */
+static void
+chsrc_write_file_content (const char *path, const char *content)
+{
+  path = xy_uniform_path (path);
+
+  if (CliOpt_DryRun)
+    {
+      char *old = chsrc_read_file_for_change (path);
+      const char *shown = _xy_expand_home (path);
+      char *old_name = old ? xy_2strjoin ('/'==shown[0] ? "a" : "a/", shown) : "/dev/null";
+      char *new_name = xy_2strjoin ('/'==shown[0] ? "b" : "b/", shown);
+      char *diff = xy_str_diff (old ? old : "", content, old_name, new_name);
+      if (diff) print_diff (diff);
+      else chsrc_note2 (xy_2strjoin (CliOpt_InEnglish ? "No change to " : "内容不变: ", path));
+
+      PlannedFile *planned = planned_file_of (path);
+      if (!planned && ProgStatus_Planned_Files_n < Chsrc_Max_Planned_Files)
+        {
+          planned = &ProgStatus_Planned_Files[ProgStatus_Planned_Files_n++];
+          planned->path = (char *) path;
+        }
+      if (planned) planned->content = xy_strdup (content);
+      return;
+    }
+
+  chsrc_journal_record (path);
+  if (!xy_file_write (path, content, strlen (content)))
+    {
+      char *msg = CliOpt_InEnglish ? "Unable to write " : "无法写入 ";
+      chsrc_error (xy_2strjoin (msg, path));
+      exit (Exit_FatalUnkownError);
+    }
+}
+
+#define FileWrite_Overwrite 0
+#define FileWrite_Append    1
+#define FileWrite_Prepend   2
+
+/**
+ * 把 str 作为一行 (或几行) 写入文件，不经过 shell，因此 str 中可以含有任意引号
+ *
+ * 新内容整体写入临时文件后再替换原文件，见 xy_file_write()，中途中断不会留下被截断的文件；
+ * Dry Run 时只打印 diff，见 chsrc_write_file_content()
+ */
+static void
+chsrc_write_file (const char *str, const char *file, int how)
+{
+  file = xy_uniform_path (file);
+  char *dir = xy_parent_dir (file);
+  chsrc_ensure_dir (dir);
+
+  const char *tag = NULL;
+  if (FileWrite_Overwrite==how) tag = CliOpt_InEnglish ? "WRITE"   : "写入";
+  if (FileWrite_Append==how)    tag = CliOpt_InEnglish ? "APPEND"  : "追加";
+  if (FileWrite_Prepend==how)   tag = CliOpt_InEnglish ? "PREPEND" : "插入开头";
+  xy_log_brkt (blue (App_Name), bdblue (tag), blue (xy_strjoin (4, file, ": '", str, "'")));
+
+  const char *old = NULL;
+  if (FileWrite_Overwrite!=how)
+    old = chsrc_read_file_for_change (file);
+  if (!old) old = "";
+
+  char *content = NULL;
+  if (FileWrite_Overwrite==how)
+    content = xy_2strjoin (str, "\n");
+  else if (FileWrite_Append==how)
+    {
+      /* 原文件最后一行没有换行符时，不要接在它后面 */
+      const char *sep = (old[0] && !xy_str_end_with (old, "\n")) ? "\n" : "";
+      content = xy_strjoin (4, old, sep, str, "\n");
+    }
+  else
+    content = xy_strjoin (3, str, "\n", old);
+
+  chsrc_write_file_content (file, content);
+}
+
+static void
+chsrc_append_to_file (const char *str, const char *file)
+{
+  chsrc_write_file (str, file, FileWrite_Append);
+}
+
+static void
+chsrc_prepend_to_file (const char *str, const char *file)
+{
+  chsrc_write_file (str, file, FileWrite_Prepend);
+}
+
+static void
+chsrc_overwrite_file (const char *str, const char *file)
+{
+  chsrc_write_file (str, file, FileWrite_Overwrite);
+}
+
+/**
+ * 在文件中维护一个由 chsrc 管理的块:
+ *
+ *   # >>> chsrc <name> >>>
+ *   ...
+ *   # <<< chsrc <name> <<<
+ *
+ * 已有该块时原地替换 (多余的同名块一并删除)，否则追加到文件末尾，
+ * 因此反复换源后文件中始终只有一个块
+ *
+ * @param  name     块名，一般为目标名，如 brew
+ * @param  content  块的内容，不含首尾标记，可以有多行；为 NULL 时删除该块
+ */
+static void
+chsrc_write_managed_block (const char *name, const char *content, const char *file)
+{
+  file = xy_uniform_path (file);
+  char *begin = xy_strjoin (3, "# >>> chsrc ", name, " >>>");
+  char *end   = xy_strjoin (3, "# <<< chsrc ", name, " <<<");
+  char *block = content ? xy_strjoin (6, begin, "\n", content, "\n", end, "\n") : "";
+
+  if (content)
+    {
+      char *dir = xy_parent_dir (file);
+      chsrc_ensure_dir (dir);
+    }
+
+  const char *old = chsrc_read_file_for_change (file);
+  if (!old) old = "";
+
+  char *result = xy_strdup ("");
+  const char *rest = old;
+  bool placed = false;
+  for (;;)
+    {
+      const char *b = find_whole_line (rest, begin);
+      const char *e = b ? find_whole_line (b, end) : NULL;
+      if (!b || !e) break;
+
+      e += strlen (end);
+      if ('\n'==*e) e++;
+      result = xy_2strjoin (result, xy_strndup (rest, b - rest));
+      if (!placed)
+        {
+          result = xy_2strjoin (result, block);
+          placed = true;
+        }
+      rest = e;
+    }
+  result = xy_2strjoin (result, rest);
+
+  if (!placed && !content)
+    return;
+
+  if (!placed)
+    {
+      /* 原文件最后一行没有换行符时，不要接在它后面 */
+      const char *sep = (result[0] && !xy_str_end_with (result, "\n")) ? "\n" : "";
+      result = xy_strjoin (3, result, sep, block);
+    }
+
+  if (content)
+    xy_log_brkt (blue (App_Name), bdblue (CliOpt_InEnglish ? "WRITE" : "写入"),
+                 blue (CliOpt_DryRun ? file : xy_strjoin (3, file, ":\n", block)));
+  else
+    xy_log_brkt (blue (App_Name), bdblue (CliOpt_InEnglish ? "REMOVE" : "删除"),
+                 blue (xy_strjoin (3, file, ": ", begin)));
+
+  chsrc_write_file_content (file, result);
+}
+
+
+/**
+ * 一个 recipe 往同一文件的管理块中写入多行时，先暂存，
+ * 最后由 chsrc_commit_staged_files() 对每个块调用一次 chsrc_write_managed_block()
+ */
+#define Chsrc_Max_Staged_Files 8
+
+typedef struct StagedFile_t
+{
+  char       *file;
+  char       *lines;
+  const char *block;
+}
+StagedFile;
+
+StagedFile ProgStatus_Staged_Files[Chsrc_Max_Staged_Files];
+int        ProgStatus_Staged_Files_n = 0;
+
+/**
+ * 暂存写入 file 中名为 block 的管理块的一行
+ */
+static void
+chsrc_stage_to_block (const char *block, const char *str, const char *file)
+{
+  file = xy_uniform_path (file);
+  for (int i=0; i<ProgStatus_Staged_Files_n; i++)
+    {
+      StagedFile *staged = &ProgStatus_Staged_Files[i];
+      if (xy_streql (staged->file, file) && xy_streql (staged->block, block))
+        {
+          staged->lines = xy_strjoin (3, staged->lines, "\n", str);
+          return;
+        }
+    }
+
+  if (ProgStatus_Staged_Files_n >= Chsrc_Max_Staged_Files)
+    {
+      /* 不应发生，直接写入也不影响结果 */
+      chsrc_write_managed_block (block, str, file);
+      return;
+    }
+  StagedFile *staged = &ProgStatus_Staged_Files[ProgStatus_Staged_Files_n++];
+  staged->file  = (char *) file;
+  staged->lines = xy_strdup (str);
+  staged->block = block;
+}
+
+/**
+ * 把暂存的内容写入各文件，每个块一次写入，Dry Run 时显示每个文件的 diff
+ */
+static void
+chsrc_commit_staged_files ()
+{
+  for (int i=0; i<ProgStatus_Staged_Files_n; i++)
+    {
+      StagedFile *staged = &ProgStatus_Staged_Files[i];
+      chsrc_write_managed_block (staged->block, staged->lines, staged->file);
+    }
+  ProgStatus_Staged_Files_n = 0;
+}
+
+/**
+ * 备份仓库: 修改文件前把它的内容以哈希命名存为快照，相同内容只保存一份
+ *
+ *   <store>/objects/<hash>   文件快照
+ *   <store>/index            每行一条记录: 时间戳 \t 哈希 \t 原文件路径
+ *
+ * root 用户使用 /var/lib/chsrc/backups，其他用户使用 $XDG_STATE_HOME/chsrc/backups
+ * 或 ~/.local/state/chsrc/backups；Windows 上为 %LOCALAPPDATA%\chsrc\backups
+ */
+static char *
+chsrc_backup_store_dir ()
+{
+  if (xy_on_windows)
+    return xy_2strjoin (chsrc_cache_dir (), "\\backups");
+
+#ifndef XY_On_Windows
+  if (0==geteuid ())
+    return "/var/lib/chsrc/backups";
+#endif
+
+  char *xdg = getenv ("XDG_STATE_HOME");
+  if (xdg && *xdg)
+    return xy_2strjoin (xdg, "/chsrc/backups");
+  return xy_2strjoin (xy_os_home, "/.local/state/chsrc/backups");
+}
+
+static char *
+backup_object_path (const char *hash)
+{
+  const char *sep = xy_on_windows ? "\\" : "/";
+  return xy_strjoin (5, chsrc_backup_store_dir (), sep, "objects", sep, hash);
+}
+
+static char *
+backup_index_path ()
+{
+  return xy_strjoin (3, chsrc_backup_store_dir (), xy_on_windows ? "\\" : "/", "index");
+}
+
+/**
+ * FNV-1a 64 位哈希，十六进制表示
+ */
+static char *
+backup_hash (const char *content, size_t len)
+{
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i=0; i<len; i++)
+    {
+      h ^= (unsigned char) content[i];
+      h *= 1099511628211ULL;
+    }
+  char buf[17];
+  snprintf (buf, sizeof buf, "%016llx", (unsigned long long) h);
+  return xy_strdup (buf);
+}
+
+/**
+ * 备份记录以文件的绝对路径为准，这样从不同目录、经由不同写法备份的同一文件能对应起来
+ */
+static char *
+backup_abs_path (const char *path)
+{
+  path = _xy_expand_home (xy_uniform_path (path));
+#ifdef XY_On_Windows
+  char full[_MAX_PATH];
+  if (_fullpath (full, path, sizeof full))
+    return xy_strdup (full);
+#else
+  char full[PATH_MAX];
+  if (realpath (path, full))
+    return xy_strdup (full);
+#endif
+  return xy_strdup (path);
+}
+
+/**
+ * 把 src 复制为快照 obj。Linux 上优先用 FICLONE 共享数据块 (Btrfs, XFS 等)，
+ * 其次用 copy_file_range 在内核中复制，都不支持时才写入已读出的 content
+ */
+static bool
+backup_save_object (const char *src, const char *obj, const char *content, size_t len)
+{
+#ifdef XY_On_Linux
+  char *tmp = xy_2strjoin (obj, ".XXXXXX");
+  int out = mkstemp (tmp);
+  if (out < 0) return false;
+
+  bool copied = false;
+  int in = open (src, O_RDONLY);
+  if (in >= 0)
+    {
+#ifdef FICLONE
+      copied = (0==ioctl (out, FICLONE, in));
+#endif
+#ifdef SYS_copy_file_range
+      if (!copied)
+        {
+          size_t done = 0;
+          copied = true;
+          while (done < len)
+            {
+              ssize_t n = syscall (SYS_copy_file_range, in, NULL, out, NULL, len - done, 0);
+              if (n < 0 && EINTR==errno) continue;
+              if (n <= 0) { copied = false; break; }
+              done += n;
+            }
+        }
+#endif
+      close (in);
+    }
+
+  bool ok = true;
+  if (!copied)
+    {
+      /* 可能已复制了一部分 */
+      ok = (0==ftruncate (out, 0)) && (0==lseek (out, 0, SEEK_SET));
+      size_t done = 0;
+      while (ok && done < len)
+        {
+          ssize_t n = write (out, content + done, len - done);
+          if (n < 0 && EINTR==errno) continue;
+          if (n <= 0) ok = false;
+          else done += n;
+        }
+    }
+  ok = ok && (0==fsync (out));
+  ok = (0==close (out)) && ok;
+  if (!ok || 0!=rename (tmp, obj))
+    {
+      unlink (tmp);
+      return false;
+    }
+  return true;
+#else
+  (void) src;
+  return xy_file_write (obj, content, len);
+#endif
+}
+
+
+/**
+ * 把文件的当前内容存入仓库，已有相同内容时不再复制
+ *
+ * 哈希相同但内容不同 (碰撞) 时，依次改用 <hash>-1, <hash>-2, ... 命名，
+ * 因此同一个名字总是对应同一份内容
+ *
+ * @return 快照的名字，无法读取或保存时返回 NULL
+ */
+static char *
+backup_snapshot (const char *abs)
+{
+  size_t len = 0;
+  char *content = xy_file_read (abs, &len);
+  if (!content) return NULL;
+
+  char *base = backup_hash (content, len);
+  char *hash = base;
+  char *obj = backup_object_path (hash);
+  bool ok = xy_mkdir_p (xy_parent_dir (obj));
+  for (int i=1; ok; i++)
+    {
+      if (!xy_file_exist (obj))
+        {
+          ok = backup_save_object (abs, obj, content, len);
+          break;
+        }
+
+      size_t old_len = 0;
+      char *old = xy_file_read (obj, &old_len);
+      bool same = old && old_len==len && 0==memcmp (old, content, len);
+      free (old);
+      if (same) break;
+
+      char suffix[16];
+      snprintf (suffix, sizeof suffix, "-%d", i);
+      hash = xy_2strjoin (base, suffix);
+      obj = backup_object_path (hash);
+    }
+  free (content);
+  return ok ? hash : NULL;
+}
+
+
+typedef struct BackupEntry_t
+{
+  long long  time;
+  char      *hash;
+  char      *path;
+}
+BackupEntry;
+
+/**
+ * 读取备份仓库的索引，按备份时间先后排列
+ *
+ * @return 记录条数
+ */
+static int
+chsrc_load_backups (BackupEntry **entries)
+{
+  *entries = NULL;
+  char *content = xy_file_read (backup_index_path (), NULL);
+  if (!content) return 0;
+
+  int n = 0, cap = 0;
+  char *next = NULL;
+  for (char *line = content; *line; line = next)
+    {
+      next = strchr (line, '\n');
+      if (next) *next++ = '\0';
+      else next = line + strlen (line);
+
+      char *field[3] = {0};
+      char *cur = line;
+      int i = 0;
+      for (; i<3 && cur; i++)
         {
-          char *msg = CliOpt_InEnglish ? "Auto changed source" : "自动换源完成";
-          chsrc_log (msg);
+          field[i] = cur;
+          cur = strchr (cur, '\t');
+          if (cur) *cur++ = '\0';
         }
+      if (i < 3) continue;
+
+      if (n >= cap)
+        *entries = realloc (*entries, sizeof (BackupEntry) * (cap = cap ? cap * 2 : 16));
+      BackupEntry *e = &(*entries)[n++];
+      e->time = atoll (field[0]);
+      e->hash = field[1];
+      e->path = tool_cache_unescape (field[2]);
+    }
+  return n;
+}
 
-      char *msg = CliOpt_InEnglish ? "The method hasn't been tested or has any feedback, please report usage: chsrc issue" : "该换源步骤已实现但未经测试或存在任何反馈，请报告使用情况: chsrc issue";
-      chsrc_warn (msg);
+/**
+ * 修改文件前备份它
+ *
+ * 内容与该文件上一次的备份相同时什么都不做；内容已存在于仓库中 (比如改回了以前的样子) 时只追加一条记录
+ */
+static void
+chsrc_backup (const char *path)
+{
+  bool exist = xy_file_exist (path);
+
+  if (!exist)
+    {
+      char *msg = CliOpt_InEnglish ? "File doesn't exist, skip backup: " : "文件不存在,跳过备份: ";
+      chsrc_note2 (xy_2strjoin (msg, path));
+      return;
     }
-  else
+
+  xy_log_brkt (blue (App_Name), bdblue (CliOpt_InEnglish ? "BACKUP" : "备份"), blue (path));
+  if (CliOpt_DryRun) return;
+
+  char *abs = backup_abs_path (path);
+  char *hash = backup_snapshot (abs);
+  if (!hash)
     {
-      say (last_word);
+      char *msg = CliOpt_InEnglish ? "Unable to save the backup into " : "无法把备份保存至 ";
+      chsrc_error (xy_2strjoin (msg, chsrc_backup_store_dir ()));
+      exit (Exit_FatalUnkownError);
     }
-}
 
+  BackupEntry *entries = NULL;
+  int n = chsrc_load_backups (&entries);
+  const char *last_hash = NULL;
+  for (int i=0; i<n; i++)
+    if (xy_streql (entries[i].path, abs)) last_hash = entries[i].hash;
+  bool unchanged = last_hash && xy_streql (last_hash, hash);
+  free (entries);
 
+  if (unchanged)
+    {
+      chsrc_note2 (xy_2strjoin (CliOpt_InEnglish ? "Unchanged since the last backup " : "内容与上次备份相同 ", hash));
+      return;
+    }
 
-void
-chsrc_ensure_root ()
-{
-  char *euid = getenv ("$EUID");
-  if (NULL==euid)
+  bool ok = true;
+  FILE *f = fopen (backup_index_path (), "a");
+  if (f)
     {
-      char *buf = xy_run ("id -u", 0, NULL);
-      if (0!=atoi(buf)) goto not_root;
-      else return;
+      ok = fprintf (f, "%lld\t%s\t%s\n", (long long) time (NULL), hash, tool_cache_escape (abs)) > 0;
+      ok = (0==fclose (f)) && ok;
     }
-  else
+  if (!ok || !f)
     {
-      if (0!=atoi(euid)) goto not_root;
-      else return;
+      char *msg = CliOpt_InEnglish ? "Unable to save the backup into " : "无法把备份保存至 ";
+      chsrc_error (xy_2strjoin (msg, chsrc_backup_store_dir ()));
+      exit (Exit_FatalUnkownError);
     }
 
-  char *msg = NULL;
-not_root:
-  msg = CliOpt_InEnglish ? "Use sudo before the command or switch to root to ensure the necessary permissions"
-                         : "请在命令前使用 sudo 或切换为root用户来保证必要的权限";
-  chsrc_error (msg);
-  exit (Exit_UserCause);
+  chsrc_note2 (xy_strjoin (4, CliOpt_InEnglish ? "Backup saved as " : "备份已保存为 ", hash,
+                           CliOpt_InEnglish ? ", restore it with: chsrc reset backup " : "，可用以下命令恢复: chsrc reset backup ", hash));
 }
 
-
-#define RunOpt_Default                0x0000  // 默认若命令运行失败，直接退出
-#define RunOpt_Dont_Notify_On_Success 0x0010  // 运行成功不提示用户，只有运行失败时才提示用户
-#define RunOpt_No_Last_New_Line       0x0100  // 不输出最后的空行
-#define RunOpt_Dont_Abort_On_Failure  0x1000  // 命令运行失败也不退出
-
+/**
+ * 用于 chsrc list backup
+ */
 static void
-chsrc_run (const char *cmd, int run_option)
+chsrc_list_backups ()
 {
-  if (CliOpt_InEnglish)
-    xy_log_brkt (blue (App_Name), bdblue ("RUN"), blue (cmd));
-  else
-    xy_log_brkt (blue (App_Name), bdblue ("运行"), blue (cmd));
+  BackupEntry *entries = NULL;
+  int n = chsrc_load_backups (&entries);
+  if (0==n)
+    {
+      chsrc_note2 (CliOpt_InEnglish ? "No backups yet" : "暂无备份");
+      return;
+    }
 
-  if (CliOpt_DryRun)
+  for (int i=0; i<n; i++)
     {
-      return; // Dry Run 此时立即结束，并不真正执行
+      char when[32];
+      time_t t = (time_t) entries[i].time;
+      strftime (when, sizeof when, "%Y-%m-%d %H:%M:%S", localtime (&t));
+      printf ("%s  %s  %s\n", when, green (entries[i].hash), entries[i].path);
     }
+  free (entries);
+}
+
+/**
+ * 用于 chsrc reset backup <hash>，把快照恢复到它原来的路径
+ *
+ * 恢复前先备份当前内容，因此恢复本身也可以再撤回
+ *
+ * @param  id  快照的哈希，可以只给出前缀
+ */
+static void
+chsrc_restore_backup (const char *id)
+{
+  BackupEntry *entries = NULL;
+  int n = chsrc_load_backups (&entries);
 
-  int status = system (cmd);
-  if (0==status)
+  /* 同一快照可能对应多条记录，以最近一次为准 */
+  BackupEntry *found = NULL;
+  for (int i=n-1; i>=0; i--)
     {
-      if (! (RunOpt_Dont_Notify_On_Success & run_option))
+      if (!xy_str_start_with (entries[i].hash, id)) continue;
+      if (found && !xy_streql (found->hash, entries[i].hash))
         {
-          log_cmd_result (true, status);
+          char *msg = CliOpt_InEnglish ? "Ambiguous backup id: " : "备份编号不唯一: ";
+          chsrc_error (xy_2strjoin (msg, id));
+          exit (Exit_UserCause);
         }
+      if (!found) found = &entries[i];
     }
-  else
+  if (!found)
     {
-      log_cmd_result (false, status);
-      if (! (run_option & RunOpt_Dont_Abort_On_Failure))
-        {
-          char *msg = CliOpt_InEnglish ? "Fatal error, forced end" : "关键错误，强制结束";
-          chsrc_error (msg);
-          exit (Exit_FatalUnkownError);
-        }
+      char *msg = CliOpt_InEnglish ? "No such backup, see `chsrc list backup`: " : "没有该备份，请通过 chsrc list backup 查看: ";
+      chsrc_error (xy_2strjoin (msg, id));
+      exit (Exit_UserCause);
     }
 
-  if (! (RunOpt_No_Last_New_Line & run_option))
+  size_t len = 0;
+  char *content = xy_file_read (backup_object_path (found->hash), &len);
+  if (!content)
     {
-      br();
+      char *msg = CliOpt_InEnglish ? "The backup is missing from the store: " : "备份仓库中缺少该快照: ";
+      chsrc_error (xy_2strjoin (msg, found->hash));
+      exit (Exit_FatalUnkownError);
+    }
+
+  chsrc_backup (found->path);
+  xy_log_brkt (blue (App_Name), bdblue (CliOpt_InEnglish ? "RESTORE" : "恢复"),
+               blue (xy_strjoin (3, found->hash, " -> ", found->path)));
+  if (CliOpt_DryRun) return;
+
+  chsrc_journal_record (found->path);
+  if (!xy_file_write (found->path, content, len))
+    {
+      char *msg = CliOpt_InEnglish ? "Unable to write " : "无法写入 ";
+      chsrc_error (xy_2strjoin (msg, found->path));
+      exit (Exit_FatalUnkownError);
     }
+  chsrc_succ2 (xy_2strjoin (CliOpt_InEnglish ? "Restored " : "已恢复 ", found->path));
 }
 
 
-static void
-chsrc_view_file (const char *path)
+/**
+ * 换源事务: 一次运行中被修改的每个文件，第一次修改前都把原内容存入备份仓库，
+ * 并在日志 <store>/journal 中记一行: 哈希 (文件原本不存在时为 -) \t 路径
+ *
+ * 正常结束时由 chsrc_journal_commit() 把日志移入 <store>/transactions/，供 chsrc undo 撤销；
+ * 中途出错退出时按日志自动回滚；进程被强行终止时日志留在原处，由 chsrc undo 回滚
+ */
+bool  ProgStatus_Journal_Open  = false;
+char *ProgStatus_Journal_Paths = NULL; /* 已记录的文件，每行一个 */
+
+static char *
+journal_path ()
 {
-  char *cmd = NULL;
-  path = xy_uniform_path (path);
-  if (xy_on_windows)
+  return xy_strjoin (3, chsrc_backup_store_dir (), xy_on_windows ? "\\" : "/", "journal");
+}
+
+static char *
+transactions_dir ()
+{
+  return xy_strjoin (3, chsrc_backup_store_dir (), xy_on_windows ? "\\" : "/", "transactions");
+}
+
+/**
+ * 按日志把文件恢复为修改前的样子，后修改的先恢复
+ *
+ * 会在 atexit 中调用，因此出错时只警告，不退出
+ *
+ * @return 是否全部恢复
+ */
+static bool
+journal_rollback (const char *journal)
+{
+  char *content = xy_file_read (journal, NULL);
+  if (!content) return false;
+
+  char **lines = NULL;
+  int n = 0, cap = 0;
+  for (char *line = strtok (content, "\n"); line; line = strtok (NULL, "\n"))
     {
-      cmd = xy_2strjoin ("type ", path);
+      if (n >= cap)
+        lines = realloc (lines, sizeof (char *) * (cap = cap ? cap * 2 : 64));
+      lines[n++] = line;
     }
-  else
+
+  bool all_ok = true;
+  for (int i=n-1; i>=0; i--)
     {
-      cmd = xy_2strjoin ("cat ", path);
+      char *tab = strchr (lines[i], '\t');
+      if (!tab) continue;
+      *tab = '\0';
+      const char *hash = lines[i];
+      char *path = tool_cache_unescape (tab + 1);
+
+      bool ok = true;
+      if (xy_streql (hash, "-"))
+        {
+          xy_log_brkt (blue (App_Name), bdblue (CliOpt_InEnglish ? "REMOVE" : "删除"), blue (path));
+          if (!CliOpt_DryRun)
+            ok = (0==remove (path) || !xy_file_exist (path));
+        }
+      else
+        {
+          xy_log_brkt (blue (App_Name), bdblue (CliOpt_InEnglish ? "RESTORE" : "恢复"),
+                       blue (xy_strjoin (3, hash, " -> ", path)));
+          size_t len = 0;
+          char *old = xy_file_read (backup_object_path (hash), &len);
+          if (!CliOpt_DryRun)
+            ok = old && xy_file_write (path, old, len);
+        }
+
+      if (!ok)
+        {
+          char *msg = CliOpt_InEnglish ? "Unable to restore " : "无法恢复 ";
+          chsrc_warn2 (xy_2strjoin (msg, path));
+          all_ok = false;
+        }
     }
-  chsrc_run (cmd, RunOpt_Dont_Notify_On_Success|RunOpt_No_Last_New_Line);
+  free (lines);
+  return all_ok;
 }
 
 static void
-chsrc_ensure_dir (const char *dir)
+chsrc_journal_atexit ()
 {
-  dir = xy_uniform_path (dir);
+  if (!ProgStatus_Journal_Open) return;
+  ProgStatus_Journal_Open = false;
+
+  chsrc_warn2 (CliOpt_InEnglish ? "Not finished, rolling back the files changed in this run"
+                                : "换源未能完成，正在回滚本次修改过的文件");
+  char *journal = journal_path ();
+  if (journal_rollback (journal))
+    remove (journal);
+  else
+    chsrc_warn2 (CliOpt_InEnglish ? "Run `chsrc undo` to retry the rollback" : "请运行 chsrc undo 重试回滚");
+}
 
-  if (xy_dir_exist (dir))
+/**
+ * 在修改 path 之前调用，本次运行中第一次修改该文件时记下它的原内容
+ */
+static void
+chsrc_journal_record (const char *path)
+{
+  if (CliOpt_DryRun) return;
+
+  char *abs = backup_abs_path (path);
+  if (ProgStatus_Journal_Paths && find_whole_line (ProgStatus_Journal_Paths, abs))
+    return;
+
+  char *journal = journal_path ();
+  if (!ProgStatus_Journal_Open)
     {
-      return;
+      if (xy_file_exist (journal))
+        {
+          chsrc_error (CliOpt_InEnglish ? "The last run was interrupted, please run `chsrc undo` first to roll it back"
+                                        : "上次换源被中断，请先运行 chsrc undo 回滚");
+          exit (Exit_UserCause);
+        }
+      static bool registered = false;
+      if (!registered)
+        {
+          atexit (chsrc_journal_atexit);
+          registered = true;
+        }
+      ProgStatus_Journal_Open = true;
+      ProgStatus_Journal_Paths = xy_strdup ("");
     }
 
-  // 不存在就生成
-  char *mkdir_cmd = NULL;
-  if (xy_on_windows)
+  char *hash = "-";
+  bool ok = xy_mkdir_p (chsrc_backup_store_dir ());
+  if (ok && xy_file_exist (abs))
     {
-      mkdir_cmd = "md ";  // 已存在时返回 errorlevel = 1
+      hash = backup_snapshot (abs);
+      ok = (NULL != hash);
     }
-  else
+
+  FILE *f = ok ? fopen (journal, "a") : NULL;
+  if (f)
+    {
+      ok = fprintf (f, "%s\t%s\n", hash, tool_cache_escape (abs)) > 0;
+      ok = (0==fflush (f)) && ok;
+#ifndef XY_On_Windows
+      /* 日志必须先于文件的修改落盘 */
+      ok = (0==fsync (fileno (f))) && ok;
+#endif
+      ok = (0==fclose (f)) && ok;
+    }
+  if (!ok || !f)
     {
-      mkdir_cmd = "mkdir -p ";
+      char *msg = CliOpt_InEnglish ? "Unable to write the journal into " : "无法写入事务日志: ";
+      chsrc_error (xy_2strjoin (msg, chsrc_backup_store_dir ()));
+      exit (Exit_FatalUnkownError);
     }
-  char *cmd = xy_2strjoin (mkdir_cmd, dir);
-  cmd = xy_str_to_quietcmd (cmd);
-  chsrc_run (cmd, RunOpt_No_Last_New_Line|RunOpt_Dont_Notify_On_Success);
-  char *msg = CliOpt_InEnglish ? "Directory doesn't exist, created automatically " : "目录不存在，已自动创建 ";
-  chsrc_note2 (xy_2strjoin (msg, dir));
+  ProgStatus_Journal_Paths = xy_strjoin (3, ProgStatus_Journal_Paths, abs, "\n");
+}
+
+/**
+ * 已有事务 (含已撤销的) 的最大序号加一
+ */
+static int
+transaction_next_seq (const char *dir)
+{
+  int max = 0;
+  DIR *d = opendir (dir);
+  if (d)
+    {
+      struct dirent *ent;
+      while ((ent = readdir (d)))
+        {
+          char *dash = strchr (ent->d_name, '-');
+          if (dash && atoi (dash + 1) > max) max = atoi (dash + 1);
+        }
+      closedir (d);
+    }
+  return max + 1;
 }
 
+/**
+ * 本次运行顺利结束，保留日志供 chsrc undo 使用
+ */
 static void
-chsrc_append_to_file (const char *str, const char *file)
+chsrc_journal_commit ()
 {
-  file = xy_uniform_path (file);
-  char *dir = xy_parent_dir (file);
-  chsrc_ensure_dir (dir);
+  if (!ProgStatus_Journal_Open) return;
+  ProgStatus_Journal_Open = false;
+  ProgStatus_Journal_Paths = NULL;
 
-  char *cmd = NULL;
-  if (xy_on_windows)
+  char *dir = transactions_dir ();
+  bool ok = xy_mkdir_p (dir);
+
+  /* 以 <补零的时间>-<递增序号> 命名，同一秒内的多次运行也按先后排列；
+   * 并发提交时序号可能相同，所以用不会覆盖已有文件的方式改名，冲突时换下一个序号 */
+  for (int seq = transaction_next_seq (dir); ok; seq++)
     {
-      cmd = xy_strjoin (4, "echo ", str, " >> ", file);
+      char name[64];
+      snprintf (name, sizeof name, "%012lld-%08d", (long long) time (NULL), seq);
+      char *dst = xy_strjoin (3, dir, xy_on_windows ? "\\" : "/", name);
+#ifdef XY_On_Windows
+      if (0==rename (journal_path (), dst)) break;
+      ok = (EEXIST==errno || EACCES==errno);
+#else
+      if (0==link (journal_path (), dst))
+        {
+          unlink (journal_path ());
+          break;
+        }
+      ok = (EEXIST==errno);
+#endif
     }
-  else
+  if (!ok)
     {
-      cmd = xy_strjoin (4, "echo '", str, "' >> ", file);
+      /* 日志留在原处，下次会被当作中断的事务 */
+      chsrc_warn2 (CliOpt_InEnglish ? "Unable to save the transaction journal" : "无法保存事务日志");
+      return;
     }
-  chsrc_run (cmd, RunOpt_No_Last_New_Line|RunOpt_Dont_Notify_On_Success);
+  chsrc_note2 (CliOpt_InEnglish ? "Run `chsrc undo` to revert the file changes of this run"
+                                : "可运行 chsrc undo 撤销本次对文件的修改");
 }
 
+/**
+ * 用于 chsrc undo: 先回滚被中断的事务，否则撤销最近一次尚未撤销的事务
+ */
 static void
-chsrc_prepend_to_file (const char *str, const char *file)
+chsrc_undo ()
 {
-  file = xy_uniform_path (file);
-  char *dir = xy_parent_dir (file);
-  chsrc_ensure_dir (dir);
+  char *journal = journal_path ();
+  if (xy_file_exist (journal))
+    {
+      chsrc_note2 (CliOpt_InEnglish ? "Rolling back the interrupted run" : "正在回滚上次被中断的换源");
+      if (!journal_rollback (journal))
+        exit (Exit_FatalUnkownError);
+      if (!CliOpt_DryRun) remove (journal);
+      chsrc_succ2 (CliOpt_InEnglish ? "Rolled back" : "回滚完成");
+      return;
+    }
 
-  char *cmd = NULL;
-  if (xy_on_windows)
+  /* 事务名等长，见 chsrc_journal_commit()，取名字最大的即最近的 */
+  char *dir = transactions_dir ();
+  char *latest = NULL;
+  DIR *d = opendir (dir);
+  if (d)
     {
-      xy_unimplement;
+      struct dirent *ent;
+      while ((ent = readdir (d)))
+        {
+          if ('.'==ent->d_name[0] || xy_str_end_with (ent->d_name, ".undone")) continue;
+          if (!latest || strcmp (ent->d_name, latest) > 0)
+            latest = xy_strdup (ent->d_name);
+        }
+      closedir (d);
     }
-  else
+  if (!latest)
     {
-      cmd = xy_strjoin (4, "sed -i '1i ", str, "' ", file);
+      chsrc_note2 (CliOpt_InEnglish ? "Nothing to undo" : "没有可撤销的修改");
+      return;
     }
-  chsrc_run (cmd, RunOpt_No_Last_New_Line|RunOpt_Dont_Notify_On_Success);
+
+  char *txn = xy_strjoin (3, dir, xy_on_windows ? "\\" : "/", latest);
+  if (!journal_rollback (txn))
+    exit (Exit_FatalUnkownError);
+  if (!CliOpt_DryRun) rename (txn, xy_2strjoin (txn, ".undone"));
+  chsrc_succ2 (CliOpt_InEnglish ? "Undone" : "撤销完成");
 }
 
+/**
+ * 通过环境变量换源的 target 不再分别往各个 shell 配置文件里写 export，
+ * 而是统一写入 chsrc 生成的环境文件，每种 shell 方言一个:
+ *
+ *   ~/.config/chsrc/env.sh    (sh/bash/zsh)
+ *   ~/.config/chsrc/env.fish  (fish)
+ *
+ * 每个 target 在其中占一个管理块，各 rc 文件中只需一次性加入 source 它们的钩子
+ */
+#define Chsrc_Env_Dir       "~/.config/chsrc"
+#define Chsrc_Env_Sh_File   Chsrc_Env_Dir "/env.sh"
+#define Chsrc_Env_Fish_File Chsrc_Env_Dir "/env.fish"
+
+/**
+ * 若 rc 文件中还没有钩子，则加入它；同时删除以前直接写在 rc 中的该 target 的块
+ */
 static void
-chsrc_overwrite_file (const char *str, const char *file)
+chsrc_hook_env_file (const char *target, const char *hook, const char *rcfile)
 {
-  file = xy_uniform_path (file);
-  char *dir = xy_parent_dir (file);
-  chsrc_ensure_dir (dir);
+  rcfile = xy_uniform_path (rcfile);
+  const char *old = chsrc_read_file_for_change (rcfile);
 
-  char *cmd = NULL;
-  if (xy_on_windows)
+  if (!old || !find_whole_line (old, "# >>> chsrc env >>>"))
     {
-      cmd = xy_strjoin (4, "echo ", str, " > ", file);
+      chsrc_backup (rcfile);
+      chsrc_write_managed_block ("env", hook, rcfile);
     }
-  else
+  chsrc_write_managed_block (target, NULL, rcfile);
+}
+
+/**
+ * 把 target 的所有环境变量写入 chsrc 的环境文件，并确保各 shell 会加载它们
+ *
+ * @param  target  管理块名，如 brew
+ * @param  names   环境变量名
+ * @param  values  对应的值
+ */
+static void
+chsrc_write_env_vars (const char *target, const char *names[], const char *values[], int n)
+{
+  char *sh = xy_strdup (""), *fish = xy_strdup ("");
+  for (int i=0; i<n; i++)
     {
-      cmd = xy_strjoin (4, "echo '", str, "' > ", file);
+      const char *sep = i ? "\n" : "";
+      sh   = xy_strjoin (6, sh,   sep, "export ",  names[i], "=\"", values[i]);
+      sh   = xy_2strjoin (sh, "\"");
+      fish = xy_strjoin (6, fish, sep, "set -gx ", names[i], " \"", values[i]);
+      fish = xy_2strjoin (fish, "\"");
     }
-  chsrc_run (cmd, RunOpt_Default);
+  chsrc_write_managed_block (target, sh,   Chsrc_Env_Sh_File);
+  chsrc_write_managed_block (target, fish, Chsrc_Env_Fish_File);
+
+  char *sh_hook   = "[ -f " Chsrc_Env_Sh_File " ] && . " Chsrc_Env_Sh_File;
+  char *fish_hook = "test -f " Chsrc_Env_Fish_File "; and source " Chsrc_Env_Fish_File;
+
+  chsrc_hook_env_file (target, sh_hook, "~/.zshrc");
+
+  if (xy_file_exist ("~/.bashrc"))
+    chsrc_hook_env_file (target, sh_hook, "~/.bashrc");
+
+  if (xy_file_exist ("~/.config/fish/config.fish"))
+    chsrc_hook_env_file (target, fish_hook, "~/.config/fish/config.fish");
 }
 
-static void
-chsrc_backup (const char *path)
+
+static int
+cmp_path (const void *a, const void *b)
 {
-  char *cmd = NULL;
-  bool exist = xy_file_exist (path);
+  return strcmp (*(char * const *) a, *(char * const *) b);
+}
 
-  if (!exist)
+/**
+ * 展开文件名部分的通配符 * 和 ?，跳过旧版 chsrc 留下的 .bak 备份
+ *
+ * @return 匹配的文件数，结果按文件名排序
+ */
+static int
+chsrc_expand_path_glob (const char *pattern, char **paths, int max)
+{
+  if (!strpbrk (pattern, "*?"))
     {
-      char *msg = CliOpt_InEnglish ? "File doesn't exist, skip backup: " : "文件不存在,跳过备份: ";
-      chsrc_note2 (xy_2strjoin (msg, path));
-      return;
+      paths[0] = xy_strdup (pattern);
+      return 1;
     }
 
-  if (xy_on_bsd || xy_on_macos)
+  char *dir = xy_parent_dir (pattern);
+  const char *base = pattern + strlen (dir) + 1;
+
+  /* 把通配符转换为正则，其余字符都按字面量处理 */
+  char *regex = xy_strdup ("^");
+  for (const char *c = base; *c; c++)
     {
-      /* BSD 和 macOS 的 cp 不支持 --backup 选项 */
-      cmd = xy_strjoin (5, "cp -f ", path, " ", path, ".bak");
+      char lit[3] = {'\\', *c, '\0'};
+      if ('*'==*c)       regex = xy_2strjoin (regex, ".*");
+      else if ('?'==*c)  regex = xy_2strjoin (regex, ".");
+      else if (strchr (".^$[]()|+\\", *c))
+                         regex = xy_2strjoin (regex, lit);
+      else               regex = xy_2strjoin (regex, lit + 1);
     }
-  else if (xy_on_windows)
+  XyRegex *re = xy_regex_compile (xy_2strjoin (regex, "$"));
+
+  int n = 0;
+  DIR *d = re ? opendir (dir) : NULL;
+  if (d)
     {
-      // /Y 表示覆盖
-      cmd = xy_strjoin (5, "copy /Y ", path, " ", path, ".bak" );
+      const char *sub[2*XyRegex_Max_Groups];
+      struct dirent *ent;
+      while (n < max && (ent = readdir (d)))
+        {
+          if (xy_str_end_with (ent->d_name, ".bak")) continue;
+          if (xy_regex_search (re, ent->d_name, strlen (ent->d_name), 0, sub))
+            paths[n++] = xy_strjoin (3, dir, xy_on_windows ? "\\" : "/", ent->d_name);
+        }
+      closedir (d);
     }
-  else
+  xy_regex_free (re);
+  qsort (paths, n, sizeof (char *), cmp_path);
+  return n;
+}
+
+
+#define Chsrc_Max_Rewrite_Files 64
+
+/**
+ * 用内置的正则引擎改写文件，代替 sed -E -i，不启动任何子进程
+ *
+ * 每个文件只读取一次，依次应用所有规则后整体写回，见 xy_str_rewrite()；
+ * Dry Run 时只打印每个文件的 diff
+ *
+ * @param  path    文件名部分可以含有通配符，如 /etc/yum.repos.d/Rocky-*.repo
+ * @param  rules   改写规则，相当于 sed -E 的 s@pattern@replace@g
+ * @param  backup  改写前是否备份每个文件，见 chsrc_backup()
+ *
+ * @return 改写过的文件数
+ */
+static int
+chsrc_rewrite_file (const char *path, const XyRewrite *rules, int rules_n, bool backup)
+{
+  path = xy_uniform_path (path);
+
+  for (int i=0; i<rules_n; i++)
+    {
+      char *log = xy_strjoin (6, path, ": s@", rules[i].pattern, "@", rules[i].replace, "@g");
+      xy_log_brkt (blue (App_Name), bdblue (CliOpt_InEnglish ? "REWRITE" : "改写"), blue (log));
+    }
+
+  char *paths[Chsrc_Max_Rewrite_Files];
+  int paths_n = chsrc_expand_path_glob (path, paths, Chsrc_Max_Rewrite_Files);
+  int changed_n = 0;
+
+  for (int i=0; i<paths_n; i++)
     {
-      cmd = xy_strjoin (5, "cp ", path, " ", path, ".bak --backup='t'");
+      char *content = chsrc_read_file_for_change (paths[i]);
+      if (!content)
+        {
+          char *msg = CliOpt_InEnglish ? "File doesn't exist, skip rewriting: " : "文件不存在，跳过改写: ";
+          chsrc_note2 (xy_2strjoin (msg, paths[i]));
+          continue;
+        }
+
+      int count = 0;
+      char *result = xy_str_rewrite (content, rules, rules_n, &count);
+      if (!result)
+        {
+          char *msg = CliOpt_InEnglish ? "Invalid rewriting rule for " : "改写规则有误: ";
+          chsrc_error (xy_2strjoin (msg, paths[i]));
+          exit (Exit_FatalUnkownError);
+        }
+      else if (0==count)
+        {
+          char *msg = CliOpt_InEnglish ? "Nothing to replace in " : "未找到需要替换的内容: ";
+          chsrc_note2 (xy_2strjoin (msg, paths[i]));
+        }
+      else
+        {
+          if (backup) chsrc_backup (paths[i]);
+          chsrc_write_file_content (paths[i], result);
+          changed_n++;
+        }
     }
 
-  chsrc_run (cmd, RunOpt_No_Last_New_Line|RunOpt_Dont_Notify_On_Success);
-  chsrc_note2 (xy_strjoin (3,
-                            CliOpt_InEnglish ? "Backup file name is " : "备份文件名为 ",
-                            path, ".bak"));
+  if (0==paths_n)
+    {
+      char *msg = CliOpt_InEnglish ? "No file matches " : "没有匹配的文件: ";
+      chsrc_note2 (xy_2strjoin (msg, path));
+    }
+  return changed_n;
 }
 
 
@@ -1201,28 +4541,14 @@ chsrc_get_cpuarch ()
         exit (Exit_UserCause);
     }
 #else
-
-  bool exist;
-
-  exist = chsrc_check_program_quietly ("arch");
-  if (exist)
-    {
-      ret = xy_run ("arch", 0, NULL);
-      return ret;
-    }
-
-  exist = chsrc_check_program_quietly ("uname");
-  if (exist)
-    {
-      ret = xy_run ("uname -m", 0, NULL);
-      return ret;
-    }
-  else
+  ret = chsrc_platform ()->machine;
+  if (!ret[0])
     {
       char *msg = CliOpt_InEnglish ? "Unable to detect CPU type" : "无法检测到CPU类型";
       chsrc_error (msg);
       exit (Exit_UserCause);
     }
+  return ret;
 #endif
 }
 
@@ -8,7 +8,7 @@
  * Contributors  :  Nil Null  <nil@null.org>
  *               |
  * Created On    : <2023-08-28>
- * Last Modified : <2024-08-23>
+ * Last Modified : <2026-10-18>
  *
  * xy: 襄阳、咸阳
  * Corss-Platform C utilities for CLI applications in Ruby flavor
@@ -29,6 +29,24 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <sys/stat.h>
+
+#ifndef _WIN32
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <limits.h>
+  #include <poll.h>
+  #include <signal.h>
+  #include <spawn.h>
+  #include <sys/wait.h>
+  #include <time.h>
+  extern char **environ;
+#endif
+
+#if defined(__linux__) || defined(__linux)
+  #include <sys/xattr.h>
+#endif
+
 /* Global */
 bool xy_enable_color = true;
 
@@ -42,6 +60,8 @@ bool xy_enable_color = true;
   #define xy_on_bsd false
   #define xy_os_devnull "nul"
   #include <windows.h>
+  #include <direct.h>
+  #include <io.h>
   #define xy_useutf8() SetConsoleOutputCP (65001)
 
 #elif defined(__linux__) || defined(__linux)
@@ -232,6 +252,19 @@ xy_strdup (const char *str)
   return new;
 }
 
+/**
+ * 最多复制 str 的前 n 个字节
+ */
+static char *
+xy_strndup (const char *str, size_t n)
+{
+  size_t len = strlen (str);
+  if (len > n) len = n;
+  char *new = xy_malloc0 (len + 1);
+  memcpy (new, str, len);
+  return new;
+}
+
 #define _XY_Str_Bold      1
 #define _XY_Str_Faint     2
 #define _XY_Str_Italic    3
@@ -320,17 +353,14 @@ xy_streql (const char *str1, const char *str2)
   return strcmp (str1, str2) == 0 ? true : false;
 }
 
+#ifdef XY_On_Windows
+/* 仅 Windows 上经由 shell 执行命令时使用，其他平台直接重定向子进程的 fd */
 static char *
 xy_str_to_quietcmd (const char *cmd)
 {
-  char *ret = NULL;
-#ifdef _WIN32
-  ret = xy_2strjoin (cmd, " >nul 2>nul ");
-#else
-  ret = xy_2strjoin (cmd, " 1>/dev/null 2>&1 ");
-#endif
-  return ret;
+  return xy_2strjoin (cmd, " >nul 2>nul ");
 }
+#endif
 
 static bool
 xy_str_end_with (const char *str, const char *suffix)
@@ -591,6 +621,624 @@ _xy_log_brkt (int level, const char *prompt1, const char *prompt2, const char *c
 /******************************************************
  *                      System
  ******************************************************/
+/**
+ * 子进程的运行结果
+ *
+ * 在非 Windows 平台上由 posix_spawn() 直接创建子进程，不经过 /bin/sh
+ */
+typedef struct XyProc_t {
+  int    exit_code;  /* 正常退出时的退出码；被信号终止或无法启动时为 -1 */
+  int    signal;     /* 被信号终止时的信号值，否则为 0 */
+  char  *out;        /* 捕获的 stdout，以 '\0' 结尾；未捕获时为 NULL */
+  size_t out_len;
+  char  *err;        /* 捕获的 stderr，同上 */
+  size_t err_len;
+  bool   timed_out;  /* 因超时被终止 */
+} XyProc;
+
+#define XyProc_Capture_Stdout 0x01
+#define XyProc_Capture_Stderr 0x02
+#define XyProc_Quiet          0x04 /* 丢弃未捕获的 stdout 与 stderr */
+
+static void
+xy_proc_free (XyProc *proc)
+{
+  free (proc->out); proc->out = NULL; proc->out_len = 0;
+  free (proc->err); proc->err = NULL; proc->err_len = 0;
+}
+
+static bool
+xy_proc_succ (const XyProc *proc)
+{
+  return 0==proc->exit_code && 0==proc->signal;
+}
+
+/**
+ * 逐行处理子进程 stdout 的回调
+ *
+ * @param  line  指向内部行缓冲区，不含换行符，且已以 '\0' 结尾；只在回调期间有效
+ * @param  len   行的长度
+ * @return 返回 false 时停止读取
+ */
+typedef bool (*XyLineFunc) (const char *line, size_t len, void *ctx);
+
+/**
+ * 可复用、可增长的行缓冲区。数据直接读入其中，回调拿到的是指向缓冲区内部的指针，
+ * 因此每一行都不会被额外复制，行的长度也不受限制
+ */
+typedef struct XyLineBuf_t {
+  char  *buf;
+  size_t len;
+  size_t cap;
+  size_t scanned;  /* [0, scanned) 中已确认没有换行符 */
+} XyLineBuf;
+
+/**
+ * 保证缓冲区尾部至少有 n 字节 (另加结尾的 '\0') 可供写入
+ */
+static char *
+_xy_linebuf_reserve (XyLineBuf *lb, size_t n)
+{
+  if (lb->len + n + 1 > lb->cap)
+    {
+      while (lb->len + n + 1 > lb->cap)
+        lb->cap = lb->cap ? lb->cap * 2 : 8192;
+      lb->buf = realloc (lb->buf, lb->cap);
+    }
+  return lb->buf + lb->len;
+}
+
+/**
+ * 对缓冲区中所有完整的行调用 func，并把剩下的半行移到缓冲区开头
+ *
+ * @param  eof  为 true 时，最后没有换行符的一行也会交给 func
+ * @return func 要求停止时返回 false
+ */
+static bool
+_xy_linebuf_dispatch (XyLineBuf *lb, XyLineFunc func, void *ctx, bool eof)
+{
+  size_t start = 0;
+  for (size_t i = lb->scanned; i < lb->len; i++)
+    {
+      if ('\n'!=lb->buf[i])
+        continue;
+      lb->buf[i] = '\0';
+      if (!func (lb->buf + start, i - start, ctx))
+        return false;
+      start = i + 1;
+    }
+
+  if (eof && start < lb->len)
+    {
+      lb->buf[lb->len] = '\0';
+      if (!func (lb->buf + start, lb->len - start, ctx))
+        return false;
+      start = lb->len;
+    }
+
+  memmove (lb->buf, lb->buf + start, lb->len - start);
+  lb->len -= start;
+  lb->scanned = lb->len;
+  return true;
+}
+
+/**
+ * 将命令行切分为 argv，支持单引号、双引号与反斜杠转义
+ *
+ * @return 以 NULL 结尾的 argv；命令中含有管道、重定向、变量展开、通配符等
+ *         必须由 shell 解释的内容时，返回 NULL
+ */
+static char **
+xy_cmd_split (const char *cmd)
+{
+  size_t cap = 8, argc = 0;
+  char **argv = malloc (sizeof (char *) * cap);
+  char *word = malloc (strlen (cmd) + 1);
+  size_t len = 0;
+  bool in_word = false;
+
+  for (const char *p = cmd; ; p++)
+    {
+      char c = *p;
+
+      if ('\0'==c || ' '==c || '\t'==c)
+        {
+          if (in_word)
+            {
+              word[len] = '\0';
+              if (argc + 1 >= cap)
+                argv = realloc (argv, sizeof (char *) * (cap *= 2));
+              argv[argc++] = xy_strdup (word);
+              len = 0;
+              in_word = false;
+            }
+          if ('\0'==c) break;
+          continue;
+        }
+
+      /* 行首的 ~ 与 VAR=value 都要 shell 展开 */
+      if (!in_word && '~'==c)
+        goto need_shell;
+      if (0==argc && '='==c)
+        goto need_shell;
+
+      if ('\''==c)
+        {
+          const char *end = strchr (p + 1, '\'');
+          if (!end) goto need_shell;
+          memcpy (word + len, p + 1, end - p - 1);
+          len += end - p - 1;
+          p = end;
+          in_word = true;
+          continue;
+        }
+
+      if ('"'==c)
+        {
+          for (p++; *p && '"'!=*p; p++)
+            {
+              if ('$'==*p || '`'==*p) goto need_shell;
+              if ('\\'==*p && p[1] && strchr ("\"\\$`", p[1])) p++;
+              word[len++] = *p;
+            }
+          if ('"'!=*p) goto need_shell;
+          in_word = true;
+          continue;
+        }
+
+      if ('\\'==c)
+        {
+          if (!p[1]) goto need_shell;
+          word[len++] = *++p;
+          in_word = true;
+          continue;
+        }
+
+      if (strchr ("|&;<>()$`*?[]{}#\n", c))
+        goto need_shell;
+
+      word[len++] = c;
+      in_word = true;
+    }
+
+  free (word);
+  if (0==argc)
+    {
+      free (argv);
+      return NULL;
+    }
+  argv[argc] = NULL;
+  return argv;
+
+need_shell:
+  for (size_t i=0; i<argc; i++)
+    free (argv[i]);
+  free (argv);
+  free (word);
+  return NULL;
+}
+
+static void
+xy_argv_free (char **argv)
+{
+  if (!argv) return;
+  for (char **a = argv; *a; a++)
+    free (*a);
+  free (argv);
+}
+
+#ifndef _WIN32
+static void
+_xy_buf_append (char **buf, size_t *len, size_t *cap, const char *data, size_t n)
+{
+  if (*len + n + 1 > *cap)
+    {
+      while (*len + n + 1 > *cap)
+        *cap = *cap ? *cap * 2 : 4096;
+      *buf = realloc (*buf, *cap);
+    }
+  memcpy (*buf + *len, data, n);
+  *len += n;
+  (*buf)[*len] = '\0';
+}
+
+static int
+_xy_pipe_cloexec (int fds[2])
+{
+  if (0!=pipe (fds))
+    return -1;
+  fcntl (fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl (fds[1], F_SETFD, FD_CLOEXEC);
+  return 0;
+}
+#endif
+
+static XyProc _xy_spawn_cmd (const char *cmd, int flags, XyLineFunc func, void *ctx, int timeout_sec);
+
+#ifndef _WIN32
+static double
+_xy_now ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+_xy_sleep_ms (long ms)
+{
+  struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+  nanosleep (&ts, NULL);
+}
+
+/**
+ * 终止整个进程组: 先 SIGTERM，3 秒后仍未退出则 SIGKILL
+ *
+ * @return waitpid() 得到的状态
+ */
+static int
+_xy_kill_group (pid_t pid)
+{
+  int status = 0;
+  kill (-pid, SIGTERM);
+  kill (-pid, SIGCONT);
+  for (int i=0; i<30; i++)
+    {
+      if (pid==waitpid (pid, &status, WNOHANG))
+        {
+          /* 组长已退出，组内其他进程也不再留 */
+          kill (-pid, SIGKILL);
+          return status;
+        }
+      _xy_sleep_ms (100);
+    }
+  kill (-pid, SIGKILL);
+  while (waitpid (pid, &status, 0) < 0 && EINTR==errno);
+  return status;
+}
+
+/**
+ * 子进程结束后，把终端前台交还给我们自己的进程组
+ */
+static void
+_xy_tty_take_back (bool own_tty)
+{
+  if (!own_tty) return;
+  /* 后台进程组调用 tcsetpgrp() 会收到 SIGTTOU */
+  void (*old_handler) (int) = signal (SIGTTOU, SIG_IGN);
+  tcsetpgrp (STDIN_FILENO, getpgrp ());
+  signal (SIGTTOU, old_handler);
+}
+#endif
+
+/**
+ * func 非 NULL 时，stdout 不再存入 proc.out，而是逐行交给 func
+ *
+ * timeout_sec > 0 时，子进程在新的进程组中运行 (若我们持有终端，则把前台交给它，以便其仍可交互)，
+ * 超时后终止整个进程组，并设置 proc.timed_out
+ */
+static XyProc
+_xy_spawn (char *const argv[], int flags, XyLineFunc func, void *ctx, int timeout_sec)
+{
+  XyProc proc = { -1, 0, NULL, 0, NULL, 0, false };
+
+#ifdef _WIN32
+  /* Windows 上没有 posix_spawn，拼回命令行交给 xy_spawn_cmd() */
+  char *cmd = xy_strdup ("");
+  for (int i=0; argv[i]; i++)
+    cmd = xy_strjoin (4, cmd, i ? " \"" : "\"", argv[i], "\"");
+  return _xy_spawn_cmd (cmd, flags, func, ctx, timeout_sec);
+#else
+  bool cap_out = func || (flags & XyProc_Capture_Stdout);
+  bool cap_err = flags & XyProc_Capture_Stderr;
+  int out_fds[2] = {-1, -1}, err_fds[2] = {-1, -1};
+
+  if ((cap_out && 0!=_xy_pipe_cloexec (out_fds))
+      || (cap_err && 0!=_xy_pipe_cloexec (err_fds)))
+    return proc;
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init (&actions);
+
+  if (cap_out)
+    posix_spawn_file_actions_adddup2 (&actions, out_fds[1], STDOUT_FILENO);
+  else if (flags & XyProc_Quiet)
+    posix_spawn_file_actions_addopen (&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+  if (cap_err)
+    posix_spawn_file_actions_adddup2 (&actions, err_fds[1], STDERR_FILENO);
+  else if (flags & XyProc_Quiet)
+    posix_spawn_file_actions_addopen (&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+  /* 子进程的输出与我们自己的输出交错时，要先把自己的缓冲区刷出去 */
+  fflush (stdout);
+  fflush (stderr);
+
+  posix_spawnattr_t attr;
+  posix_spawnattr_init (&attr);
+  if (timeout_sec > 0)
+    {
+      /* 自成一组，超时后才能连同其子进程一起终止 */
+      posix_spawnattr_setflags (&attr, POSIX_SPAWN_SETPGROUP);
+      posix_spawnattr_setpgroup (&attr, 0);
+    }
+
+  pid_t pid;
+  int ret = posix_spawnp (&pid, argv[0], &actions, &attr, argv, environ);
+  posix_spawn_file_actions_destroy (&actions);
+  posix_spawnattr_destroy (&attr);
+
+  if (cap_out) close (out_fds[1]);
+  if (cap_err) close (err_fds[1]);
+
+  if (0!=ret)
+    {
+      if (cap_out) close (out_fds[0]);
+      if (cap_err) close (err_fds[0]);
+      /* 与 shell 一致，找不到命令为 127，无法执行为 126 */
+      proc.exit_code = ENOENT==ret ? 127 : 126;
+      return proc;
+    }
+
+  double deadline = timeout_sec > 0 ? _xy_now () + timeout_sec : 0;
+  bool own_tty = timeout_sec > 0 && isatty (STDIN_FILENO) && tcgetpgrp (STDIN_FILENO)==getpgrp ();
+  if (own_tty)
+    {
+      tcsetpgrp (STDIN_FILENO, pid);
+      /* 子进程可能在拿到前台之前就读了终端而被 SIGTTIN 停下 */
+      kill (-pid, SIGCONT);
+    }
+
+  size_t out_cap = 0, err_cap = 0;
+  XyLineBuf lines = {0};
+  struct pollfd fds[2];
+  int nfds = 0;
+  if (cap_out) fds[nfds++] = (struct pollfd) { out_fds[0], POLLIN, 0 };
+  if (cap_err) fds[nfds++] = (struct pollfd) { err_fds[0], POLLIN, 0 };
+
+  /* 两个管道要同时读，否则子进程可能因其中一个写满而阻塞 */
+  int open_n = nfds;
+  char buf[8192];
+  while (open_n > 0)
+    {
+      int wait_ms = -1;
+      if (deadline)
+        {
+          double left = deadline - _xy_now ();
+          if (left <= 0)
+            {
+              proc.timed_out = true;
+              break;
+            }
+          wait_ms = (int) (left * 1000) + 1;
+        }
+      int pr = poll (fds, nfds, wait_ms);
+      if (pr < 0)
+        {
+          if (EINTR==errno) continue;
+          break;
+        }
+      if (0==pr)
+        continue;
+      for (int i=0; i<nfds; i++)
+        {
+          if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            continue;
+          bool to_lines = func && fds[i].fd==out_fds[0];
+          ssize_t n = to_lines ? read (fds[i].fd, _xy_linebuf_reserve (&lines, sizeof buf), sizeof buf)
+                               : read (fds[i].fd, buf, sizeof buf);
+          if (n > 0)
+            {
+              if (to_lines)
+                {
+                  lines.len += n;
+                  /* 提前停止时关闭管道，子进程继续写入会收到 SIGPIPE，与 `cmd | head` 相同 */
+                  if (_xy_linebuf_dispatch (&lines, func, ctx, false))
+                    continue;
+                  func = NULL;
+                }
+              else if (cap_out && fds[i].fd==out_fds[0])
+                {
+                  _xy_buf_append (&proc.out, &proc.out_len, &out_cap, buf, n);
+                  continue;
+                }
+              else
+                {
+                  _xy_buf_append (&proc.err, &proc.err_len, &err_cap, buf, n);
+                  continue;
+                }
+            }
+          else if (n < 0 && EINTR==errno)
+            continue;
+          else if (to_lines)
+            {
+              _xy_linebuf_dispatch (&lines, func, ctx, true);
+              func = NULL;
+            }
+          close (fds[i].fd);
+          fds[i].fd = -1;
+          open_n--;
+        }
+    }
+
+  free (lines.buf);
+
+  /* 超时后不再等待管道关闭，进程组外的后代进程可能一直持有它们 */
+  for (int i=0; i<nfds; i++)
+    if (fds[i].fd >= 0)
+      close (fds[i].fd);
+
+  /* 即使没有任何输出，捕获的结果也是空串而非 NULL */
+  if ((flags & XyProc_Capture_Stdout) && !proc.out) proc.out = xy_strdup ("");
+  if (cap_err && !proc.err) proc.err = xy_strdup ("");
+
+  int status = 0;
+  while (!proc.timed_out)
+    {
+      pid_t r = waitpid (pid, &status, deadline ? WNOHANG : 0);
+      if (pid==r)
+        break;
+      if (r < 0 && EINTR!=errno)
+        {
+          _xy_tty_take_back (own_tty);
+          return proc;
+        }
+      if (deadline && _xy_now () >= deadline)
+        proc.timed_out = true;
+      else if (deadline)
+        _xy_sleep_ms (20);
+    }
+
+  if (proc.timed_out)
+    status = _xy_kill_group (pid);
+
+  _xy_tty_take_back (own_tty);
+
+  if (WIFEXITED (status))
+    proc.exit_code = WEXITSTATUS (status);
+  else if (WIFSIGNALED (status))
+    proc.signal = WTERMSIG (status);
+
+  return proc;
+#endif
+}
+
+/**
+ * func 与 timeout_sec 见 _xy_spawn()；Windows 上暂不支持超时
+ */
+static XyProc
+_xy_spawn_cmd (const char *cmd, int flags, XyLineFunc func, void *ctx, int timeout_sec)
+{
+#ifdef _WIN32
+  XyProc proc = { -1, 0, NULL, 0, NULL, 0, false };
+  /* Windows 上无法分别捕获 stderr，XyProc_Capture_Stderr 时 err 总为空 */
+  if (flags & XyProc_Capture_Stderr)
+    proc.err = xy_strdup ("");
+
+  const char *real = (flags & XyProc_Quiet) && !(flags & XyProc_Capture_Stdout) && !func
+                     ? xy_str_to_quietcmd (cmd) : cmd;
+
+  if (func)
+    {
+      FILE *stream = popen (real, "r");
+      if (!stream) return proc;
+      XyLineBuf lines = {0};
+      size_t n;
+      bool go_on = true;
+      while (go_on && (n = fread (_xy_linebuf_reserve (&lines, 8192), 1, 8192, stream)) > 0)
+        {
+          lines.len += n;
+          go_on = _xy_linebuf_dispatch (&lines, func, ctx, false);
+        }
+      if (go_on)
+        _xy_linebuf_dispatch (&lines, func, ctx, true);
+      free (lines.buf);
+      proc.exit_code = pclose (stream);
+    }
+  else if (flags & XyProc_Capture_Stdout)
+    {
+      FILE *stream = popen (real, "r");
+      if (!stream) return proc;
+      size_t cap = 4096;
+      proc.out = malloc (cap);
+      size_t n;
+      while ((n = fread (proc.out + proc.out_len, 1, cap - proc.out_len - 1, stream)) > 0)
+        {
+          proc.out_len += n;
+          if (proc.out_len + 1 >= cap)
+            proc.out = realloc (proc.out, cap *= 2);
+        }
+      proc.out[proc.out_len] = '\0';
+      proc.exit_code = pclose (stream);
+    }
+  else
+    {
+      proc.exit_code = system (real);
+    }
+  return proc;
+#else
+  char **argv = xy_cmd_split (cmd);
+  if (argv)
+    {
+      XyProc proc = _xy_spawn (argv, flags, func, ctx, timeout_sec);
+      xy_argv_free (argv);
+      return proc;
+    }
+
+  char *sh_argv[] = { "/bin/sh", "-c", (char *) cmd, NULL };
+  return _xy_spawn (sh_argv, flags, func, ctx, timeout_sec);
+#endif
+}
+
+/**
+ * 执行一条命令行
+ *
+ * 若命令不需要 shell (见 xy_cmd_split())，则直接以 argv 创建子进程；
+ * 否则，或在 Windows 上，交给 shell 执行
+ */
+static XyProc
+xy_spawn_cmd (const char *cmd, int flags)
+{
+  return _xy_spawn_cmd (cmd, flags, NULL, NULL, 0);
+}
+
+/**
+ * 同 xy_spawn_cmd()，但运行超过 timeout_sec 秒后终止其整个进程组，此时 timed_out 为 true
+ *
+ * @param  timeout_sec  为 0 时不限时
+ */
+static XyProc
+xy_spawn_cmd_timeout (const char *cmd, int flags, int timeout_sec)
+{
+  return _xy_spawn_cmd (cmd, flags, NULL, NULL, timeout_sec);
+}
+
+/**
+ * 执行一条命令行，并将其 stdout 逐行流式交给 func，不会把全部输出存入内存
+ *
+ * func 返回 false 时提前停止，此后子进程若继续写入 stdout 则会收到 SIGPIPE 而退出，
+ * 此时返回的退出状态不代表命令本身是否成功
+ *
+ * 需要把全部输出作为一整块连续内存时，使用 xy_spawn_cmd (cmd, XyProc_Capture_Stdout)
+ *
+ * @param  flags  可为 XyProc_Capture_Stderr 或 XyProc_Quiet；stdout 总是交给 func
+ */
+static XyProc
+xy_run_iter (const char *cmd, int flags, XyLineFunc func, void *ctx)
+{
+  return _xy_spawn_cmd (cmd, flags & ~XyProc_Capture_Stdout, func, ctx, 0);
+}
+
+typedef struct XyRunLine_t {
+  unsigned long n;
+  unsigned long count;
+  void (*iter_func) (const char *);
+  char *line;      /* 目前为止的最后一行 */
+  size_t line_cap;
+  size_t line_len;
+} XyRunLine;
+
+static bool
+_xy_run_line (const char *line, size_t len, void *ctx)
+{
+  XyRunLine *r = (XyRunLine *) ctx;
+
+  /* 上一行已确定不是目标行 */
+  if (r->count && r->iter_func)
+    r->iter_func (r->line);
+
+  r->count++;
+  if (len + 2 > r->line_cap)
+    r->line = realloc (r->line, r->line_cap = len + 2);
+  memcpy (r->line, line, len);
+  r->line[len] = '\n';
+  r->line[len + 1] = '\0';
+  r->line_len = len + 1;
+
+  /* 到达目标行后不再读取 */
+  return r->n != r->count;
+}
+
 /**
  * 执行cmd，返回某行输出结果，并对已经遍历过的行执行iter_func
  *
@@ -599,42 +1247,106 @@ _xy_log_brkt (int level, const char *prompt1, const char *prompt2, const char *c
  *                    该函数会返回这一行的内容
  * @param  iter_func  对遍历时经过的行的内容，进行函数调用
  *
- * @note 返回的字符串最后面一般有换行符号
+ * @note 返回的字符串最后面总有换行符号，需由调用者释放
+ * @note 基于 xy_run_iter()，行的长度不受限制，到达第 n 行后即不再读取
  *
  * 由于目标行会被返回出来，所以 iter_func() 并不执行目标行，只会执行遍历过的行
  */
 static char *
 xy_run (const char *cmd,  unsigned long n,  void (*iter_func) (const char *))
 {
-  const int size = 512;
-  char *buf = (char *) malloc (size);
+  XyRunLine r = { n, 0, iter_func, NULL, 0, 0 };
+  XyProc proc = xy_run_iter (cmd, 0, _xy_run_line, &r);
+  xy_proc_free (&proc);
 
-  FILE *stream = popen (cmd, "r");
-  if (stream == NULL)
+  if (proc.exit_code < 0 && 0==proc.signal && 0==r.count)
     {
       fprintf (stderr, "xy: 命令执行失败\n");
       return NULL;
     }
+  return r.line;
+}
+
+static bool
+_xy_is_executable_file (const char *path)
+{
+  struct stat st;
+  if (0!=stat (path, &st) || !S_ISREG (st.st_mode))
+    return false;
+#ifdef _WIN32
+  /* WindowsApps 下的应用执行别名大小为 0，运行它们只会打开 Microsoft Store */
+  return st.st_size > 0;
+#else
+  return 0==access (path, X_OK);
+#endif
+}
+
+/**
+ * 在 PATH 中查找可执行文件，不创建任何子进程
+ *
+ * Windows 上，若 prog 没有扩展名，则依次尝试 PATHEXT 中的各个扩展名
+ *
+ * @return 找到时返回完整路径，否则返回 NULL
+ */
+static char *
+xy_which (const char *prog)
+{
+#ifdef _WIN32
+  const char sep = ';';
+  const char *dir_sep = "\\";
+  const char *pathext = getenv ("PATHEXT");
+  if (!pathext || !*pathext) pathext = ".COM;.EXE;.BAT;.CMD";
+  /* 已带扩展名时只尝试原名 */
+  if (strchr (prog, '.')) pathext = "";
+#else
+  const char sep = ':';
+  const char *dir_sep = "/";
+  const char *pathext = "";
+#endif
 
-  char *ret = NULL;
-  unsigned long count = 0;
+  /* 带有路径时不再查找 PATH */
+  if (strchr (prog, '/') || (xy_on_windows && strchr (prog, '\\')))
+    return _xy_is_executable_file (prog) ? xy_strdup (prog) : NULL;
 
+  const char *path = getenv ("PATH");
+  if (!path) return NULL;
+
+  const char *dir = path;
   while (true)
     {
-      if (NULL == fgets (buf, size, stream))
-        break;
-      ret = buf;
-      count += 1;
-      if (n == count)
-        break;
-      if (iter_func)
+      const char *end = strchr (dir, sep);
+      size_t dir_len = end ? (size_t) (end - dir) : strlen (dir);
+      /* POSIX 规定 PATH 中的空项表示当前目录 */
+      char *d = dir_len ? xy_strndup (dir, dir_len) : xy_strdup (".");
+      char *base = xy_strjoin (3, d, dir_sep, prog);
+      free (d);
+
+      if (_xy_is_executable_file (base))
+        return base;
+
+      const char *ext = pathext;
+      while (*ext)
         {
-          iter_func (buf);
+          const char *ext_end = strchr (ext, ';');
+          size_t ext_len = ext_end ? (size_t) (ext_end - ext) : strlen (ext);
+          char *e = xy_strndup (ext, ext_len);
+          char *full = xy_2strjoin (base, e);
+          free (e);
+          if (ext_len && _xy_is_executable_file (full))
+            {
+              free (base);
+              return full;
+            }
+          free (full);
+          if (!ext_end) break;
+          ext = ext_end + 1;
         }
-    }
+      free (base);
 
-  pclose (stream);
-  return ret;
+      if (!end) break;
+      dir = end + 1;
+    }
+  return NULL;
 }
 
 #define xy_os_home _xy_os_home ()
@@ -689,44 +1401,54 @@ static bool
 xy_dir_exist (const char *path)
 {
   const char *dir = path;
-  if (xy_on_windows)
+  if (xy_str_start_with (path, "~"))
     {
-      if (xy_str_start_with (path, "~"))
-        {
-          dir = xy_2strjoin (xy_os_home, path + 1);
-        }
+      dir = xy_2strjoin (xy_os_home, path + 1);
     }
 
-  if (xy_on_windows)
-    {
 #ifdef XY_On_Windows
-      // 也可以用 opendir() #include <dirent.h>
-      DWORD attr = GetFileAttributesA (dir);
+  // 也可以用 opendir() #include <dirent.h>
+  DWORD attr = GetFileAttributesA (dir);
+  return attr != INVALID_FILE_ATTRIBUTES && (attr & FILE_ATTRIBUTE_DIRECTORY);
+#else
+  struct stat st;
+  return 0==stat (dir, &st) && S_ISDIR (st.st_mode);
+#endif
+}
 
-      if (attr == INVALID_FILE_ATTRIBUTES)
-        {
-          // Q: 我们应该报错吗？
-          return false;
-        }
-      else if (attr & FILE_ATTRIBUTE_DIRECTORY)
-        {
-          return true;
-        }
-      else
-        {
-          return false;
-        }
+/**
+ * 逐级创建目录，相当于 mkdir -p，支持 '~'
+ *
+ * @return 目录最终是否存在
+ */
+static bool
+xy_mkdir_p (const char *path)
+{
+  char *dir = xy_str_start_with (path, "~") ? xy_2strjoin (xy_os_home, path + 1)
+                                            : xy_strdup (path);
+
+  for (char *p = dir + 1; *p; p++)
+    {
+      if ('/'!=*p && '\\'!=*p)
+        continue;
+      char saved = *p;
+      *p = '\0';
+#ifdef XY_On_Windows
+      _mkdir (dir);
+#else
+      mkdir (dir, 0755);
 #endif
+      *p = saved;
     }
-  else
-    {
-      int status = system (xy_2strjoin ("test -d ", dir));
+#ifdef XY_On_Windows
+  _mkdir (dir);
+#else
+  mkdir (dir, 0755);
+#endif
 
-      if (0==status)
-        return true;
-      else
-        return false;
-    }
+  bool ok = xy_dir_exist (dir);
+  free (dir);
+  return ok;
 }
 
 /**
@@ -770,4 +1492,957 @@ xy_parent_dir (const char *path)
   return dir;
 }
 
+
+/******************************************************
+ *                      Regex
+ ******************************************************/
+/**
+ * 一个小巧的回溯式正则引擎，用于按行改写配置文件
+ *
+ * 不依赖 sed 或 <regex.h>，在所有平台上行为一致。支持 POSIX ERE 的常用子集:
+ *
+ *   字面量, ., [...], [^...], ^, $, *, +, ?, (...) 捕获组, |
+ *   转义 \. \/ 等，以及 \s \S \d \D \w \W
+ *
+ * 量词均为贪婪的；不支持 {m,n}，'{' 与 '}' 按字面量处理
+ */
+#define XyRegex_Max_Groups 10
+
+enum {
+  _XyRe_Char = 1,
+  _XyRe_Any,
+  _XyRe_Class,
+  _XyRe_Bol,
+  _XyRe_Eol,
+  _XyRe_Split,  /* 先尝试 x，失败后尝试 y */
+  _XyRe_Jmp,
+  _XyRe_Save,   /* 记录当前位置到 sub[x] */
+  _XyRe_Match
+};
+
+typedef struct _XyReInst_t {
+  int op;
+  int x, y;
+  unsigned char c;
+  unsigned char cls[32];  /* 字符集合的位图 */
+} _XyReInst;
+
+typedef struct XyRegex_t {
+  _XyReInst *prog;
+  int        n;
+  int        groups;    /* 捕获组数量，含整个匹配 */
+  bool       anchored;  /* 以 ^ 开头，只需从行首尝试 */
+} XyRegex;
+
+
+enum {
+  _XyReN_Empty = 1,
+  _XyReN_Lit,
+  _XyReN_Any,
+  _XyReN_Class,
+  _XyReN_Bol,
+  _XyReN_Eol,
+  _XyReN_Cat,
+  _XyReN_Alt,
+  _XyReN_Quest,
+  _XyReN_Star,
+  _XyReN_Plus,
+  _XyReN_Paren
+};
+
+typedef struct _XyReNode_t {
+  int type;
+  struct _XyReNode_t *l, *r;
+  unsigned char c;
+  unsigned char cls[32];
+  int group;
+} _XyReNode;
+
+typedef struct _XyReParser_t {
+  const char *p;
+  _XyReNode  *nodes;
+  int         nodes_n;
+  int         groups;
+  bool        failed;
+} _XyReParser;
+
+static _XyReNode *
+_xy_re_node (_XyReParser *ps, int type, _XyReNode *l, _XyReNode *r)
+{
+  _XyReNode *node = &ps->nodes[ps->nodes_n++];
+  node->type = type;
+  node->l = l;
+  node->r = r;
+  return node;
+}
+
+static void
+_xy_re_cls_set (unsigned char *cls, int c)
+{
+  cls[c >> 3] |= 1 << (c & 7);
+}
+
+static bool
+_xy_re_cls_has (const unsigned char *cls, int c)
+{
+  return cls[c >> 3] & (1 << (c & 7));
+}
+
+/**
+ * 把 \s \d \w 及其大写形式加入 cls
+ *
+ * @return 不是这几种转义时返回 false
+ */
+static bool
+_xy_re_cls_escape (unsigned char *cls, char e)
+{
+  unsigned char tmp[32] = {0};
+  const char *set = NULL;
+  switch (e)
+    {
+    case 's': case 'S': set = " \t\r\n\v\f"; break;
+    case 'd': case 'D': set = "0123456789"; break;
+    case 'w': case 'W': set = "0123456789_abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ"; break;
+    default: return false;
+    }
+  for (; *set; set++)
+    _xy_re_cls_set (tmp, (unsigned char) *set);
+  bool negate = (e >= 'A' && e <= 'Z');
+  for (int i=0; i<32; i++)
+    cls[i] |= negate ? (unsigned char) ~tmp[i] : tmp[i];
+  return true;
+}
+
+static char
+_xy_re_literal_escape (char e)
+{
+  if ('n'==e) return '\n';
+  if ('t'==e) return '\t';
+  return e;
+}
+
+static bool
+_xy_re_nullable (const _XyReNode *node)
+{
+  switch (node->type)
+    {
+    case _XyReN_Lit: case _XyReN_Any: case _XyReN_Class:
+      return false;
+    case _XyReN_Cat:
+      return _xy_re_nullable (node->l) && _xy_re_nullable (node->r);
+    case _XyReN_Alt:
+      return _xy_re_nullable (node->l) || _xy_re_nullable (node->r);
+    case _XyReN_Plus: case _XyReN_Paren:
+      return _xy_re_nullable (node->l);
+    default:
+      return true;
+    }
+}
+
+static _XyReNode *_xy_re_parse_alt (_XyReParser *ps);
+
+static _XyReNode *
+_xy_re_parse_class (_XyReParser *ps)
+{
+  _XyReNode *node = _xy_re_node (ps, _XyReN_Class, NULL, NULL);
+  bool negate = false;
+  if ('^'==*ps->p)
+    {
+      negate = true;
+      ps->p++;
+    }
+
+  bool first = true;
+  while (*ps->p && (first || ']'!=*ps->p))
+    {
+      first = false;
+      int lo = (unsigned char) *ps->p++;
+      if ('\\'==lo && *ps->p)
+        {
+          if (_xy_re_cls_escape (node->cls, *ps->p))
+            {
+              ps->p++;
+              continue;
+            }
+          lo = (unsigned char) _xy_re_literal_escape (*ps->p++);
+        }
+      int hi = lo;
+      if ('-'==ps->p[0] && ps->p[1] && ']'!=ps->p[1])
+        {
+          hi = (unsigned char) ps->p[1];
+          ps->p += 2;
+        }
+      for (int c=lo; c<=hi; c++)
+        _xy_re_cls_set (node->cls, c);
+    }
+
+  if (']'!=*ps->p)
+    {
+      ps->failed = true;
+      return NULL;
+    }
+  ps->p++;
+
+  if (negate)
+    for (int i=0; i<32; i++)
+      node->cls[i] = ~node->cls[i];
+  return node;
+}
+
+static _XyReNode *
+_xy_re_parse_atom (_XyReParser *ps)
+{
+  char c = *ps->p++;
+  _XyReNode *node = NULL;
+  switch (c)
+    {
+    case '(':
+      {
+        if (ps->groups >= XyRegex_Max_Groups)
+          {
+            ps->failed = true;
+            return NULL;
+          }
+        int group = ps->groups++;
+        _XyReNode *inner = _xy_re_parse_alt (ps);
+        if (!inner || ')'!=*ps->p)
+          {
+            ps->failed = true;
+            return NULL;
+          }
+        ps->p++;
+        node = _xy_re_node (ps, _XyReN_Paren, inner, NULL);
+        node->group = group;
+        return node;
+      }
+    case '[':
+      return _xy_re_parse_class (ps);
+    case '.':
+      return _xy_re_node (ps, _XyReN_Any, NULL, NULL);
+    case '^':
+      return _xy_re_node (ps, _XyReN_Bol, NULL, NULL);
+    case '$':
+      return _xy_re_node (ps, _XyReN_Eol, NULL, NULL);
+    case '*': case '+': case '?':
+      /* 没有可重复的内容 */
+      ps->failed = true;
+      return NULL;
+    case '\\':
+      if (!*ps->p)
+        {
+          ps->failed = true;
+          return NULL;
+        }
+      c = *ps->p++;
+      node = _xy_re_node (ps, _XyReN_Class, NULL, NULL);
+      if (_xy_re_cls_escape (node->cls, c))
+        return node;
+      node->type = _XyReN_Lit;
+      node->c = (unsigned char) _xy_re_literal_escape (c);
+      return node;
+    default:
+      node = _xy_re_node (ps, _XyReN_Lit, NULL, NULL);
+      node->c = (unsigned char) c;
+      return node;
+    }
+}
+
+static _XyReNode *
+_xy_re_parse_repeat (_XyReParser *ps)
+{
+  _XyReNode *node = _xy_re_parse_atom (ps);
+  while (node && *ps->p && strchr ("*+?", *ps->p))
+    {
+      char q = *ps->p++;
+      /* 回溯引擎中，可匹配空串的内容被重复会导致死循环 */
+      if ('?'!=q && _xy_re_nullable (node))
+        {
+          ps->failed = true;
+          return NULL;
+        }
+      int type = '*'==q ? _XyReN_Star : ('+'==q ? _XyReN_Plus : _XyReN_Quest);
+      node = _xy_re_node (ps, type, node, NULL);
+    }
+  return node;
+}
+
+static _XyReNode *
+_xy_re_parse_cat (_XyReParser *ps)
+{
+  _XyReNode *node = NULL;
+  while (*ps->p && '|'!=*ps->p && ')'!=*ps->p)
+    {
+      _XyReNode *atom = _xy_re_parse_repeat (ps);
+      if (!atom) return NULL;
+      node = node ? _xy_re_node (ps, _XyReN_Cat, node, atom) : atom;
+    }
+  return node ? node : _xy_re_node (ps, _XyReN_Empty, NULL, NULL);
+}
+
+static _XyReNode *
+_xy_re_parse_alt (_XyReParser *ps)
+{
+  _XyReNode *node = _xy_re_parse_cat (ps);
+  while (node && '|'==*ps->p)
+    {
+      ps->p++;
+      _XyReNode *right = _xy_re_parse_cat (ps);
+      if (!right) return NULL;
+      node = _xy_re_node (ps, _XyReN_Alt, node, right);
+    }
+  return node;
+}
+
+static int
+_xy_re_count (const _XyReNode *node)
+{
+  switch (node->type)
+    {
+    case _XyReN_Empty: return 0;
+    case _XyReN_Cat:   return _xy_re_count (node->l) + _xy_re_count (node->r);
+    case _XyReN_Alt:   return 2 + _xy_re_count (node->l) + _xy_re_count (node->r);
+    case _XyReN_Quest: return 1 + _xy_re_count (node->l);
+    case _XyReN_Star:  return 2 + _xy_re_count (node->l);
+    case _XyReN_Plus:  return 1 + _xy_re_count (node->l);
+    case _XyReN_Paren: return 2 + _xy_re_count (node->l);
+    default:           return 1;
+    }
+}
+
+static int
+_xy_re_emit (XyRegex *re, int pc, const _XyReNode *node)
+{
+  _XyReInst *in = &re->prog[pc];
+  int split = 0;
+  switch (node->type)
+    {
+    case _XyReN_Empty:
+      return pc;
+    case _XyReN_Lit:
+      in->op = _XyRe_Char;
+      in->c = node->c;
+      return pc + 1;
+    case _XyReN_Any:
+      in->op = _XyRe_Any;
+      return pc + 1;
+    case _XyReN_Class:
+      in->op = _XyRe_Class;
+      memcpy (in->cls, node->cls, sizeof (in->cls));
+      return pc + 1;
+    case _XyReN_Bol:
+      in->op = _XyRe_Bol;
+      return pc + 1;
+    case _XyReN_Eol:
+      in->op = _XyRe_Eol;
+      return pc + 1;
+    case _XyReN_Cat:
+      pc = _xy_re_emit (re, pc, node->l);
+      return _xy_re_emit (re, pc, node->r);
+    case _XyReN_Alt:
+      {
+        in->op = _XyRe_Split;
+        in->x = pc + 1;
+        int jmp = _xy_re_emit (re, pc + 1, node->l);
+        re->prog[jmp].op = _XyRe_Jmp;
+        in->y = jmp + 1;
+        int end = _xy_re_emit (re, jmp + 1, node->r);
+        re->prog[jmp].x = end;
+        return end;
+      }
+    case _XyReN_Quest:
+      in->op = _XyRe_Split;
+      in->x = pc + 1;
+      in->y = _xy_re_emit (re, pc + 1, node->l);
+      return in->y;
+    case _XyReN_Star:
+      {
+        in->op = _XyRe_Split;
+        in->x = pc + 1;
+        int jmp = _xy_re_emit (re, pc + 1, node->l);
+        re->prog[jmp].op = _XyRe_Jmp;
+        re->prog[jmp].x = pc;
+        in->y = jmp + 1;
+        return jmp + 1;
+      }
+    case _XyReN_Plus:
+      split = _xy_re_emit (re, pc, node->l);
+      re->prog[split].op = _XyRe_Split;
+      re->prog[split].x = pc;
+      re->prog[split].y = split + 1;
+      return split + 1;
+    case _XyReN_Paren:
+      in->op = _XyRe_Save;
+      in->x = 2 * node->group;
+      pc = _xy_re_emit (re, pc + 1, node->l);
+      re->prog[pc].op = _XyRe_Save;
+      re->prog[pc].x = 2 * node->group + 1;
+      return pc + 1;
+    }
+  return pc;
+}
+
+/**
+ * @return 正则语法错误时返回 NULL
+ */
+static XyRegex *
+xy_regex_compile (const char *pattern)
+{
+  size_t len = strlen (pattern);
+  /* 每个字符最多产生一个原子节点、一个连接节点和一个量词节点 */
+  _XyReParser ps = { pattern, xy_malloc0 (sizeof (_XyReNode) * (3 * len + 4)), 0, 1, false };
+
+  _XyReNode *root = _xy_re_parse_alt (&ps);
+  if (!root || ps.failed || *ps.p)
+    {
+      free (ps.nodes);
+      return NULL;
+    }
+
+  /* 整个匹配作为第 0 组 */
+  _XyReNode *whole = _xy_re_node (&ps, _XyReN_Paren, root, NULL);
+  whole->group = 0;
+
+  XyRegex *re = xy_malloc0 (sizeof (XyRegex));
+  re->n = _xy_re_count (whole) + 1;
+  re->prog = xy_malloc0 (sizeof (_XyReInst) * re->n);
+  re->groups = ps.groups;
+  int end = _xy_re_emit (re, 0, whole);
+  re->prog[end].op = _XyRe_Match;
+  re->anchored = (_XyRe_Bol==re->prog[1].op);
+
+  free (ps.nodes);
+  return re;
+}
+
+static void
+xy_regex_free (XyRegex *re)
+{
+  if (!re) return;
+  free (re->prog);
+  free (re);
+}
+
+static bool
+_xy_re_step (const XyRegex *re, int pc, const char *sp, const char *bol, const char *eol, const char **sub)
+{
+  for (;;)
+    {
+      const _XyReInst *in = &re->prog[pc];
+      switch (in->op)
+        {
+        case _XyRe_Char:
+          if (sp==eol || (unsigned char) *sp != in->c) return false;
+          pc++; sp++;
+          break;
+        case _XyRe_Any:
+          if (sp==eol) return false;
+          pc++; sp++;
+          break;
+        case _XyRe_Class:
+          if (sp==eol || !_xy_re_cls_has (in->cls, (unsigned char) *sp)) return false;
+          pc++; sp++;
+          break;
+        case _XyRe_Bol:
+          if (sp!=bol) return false;
+          pc++;
+          break;
+        case _XyRe_Eol:
+          if (sp!=eol) return false;
+          pc++;
+          break;
+        case _XyRe_Jmp:
+          pc = in->x;
+          break;
+        case _XyRe_Split:
+          if (_xy_re_step (re, in->x, sp, bol, eol, sub)) return true;
+          pc = in->y;
+          break;
+        case _XyRe_Save:
+          {
+            const char *old = sub[in->x];
+            sub[in->x] = sp;
+            if (_xy_re_step (re, pc + 1, sp, bol, eol, sub)) return true;
+            sub[in->x] = old;
+            return false;
+          }
+        case _XyRe_Match:
+          return true;
+        }
+    }
+}
+
+/**
+ * 在 line 的 [from, len) 中寻找第一个匹配，^ 和 $ 分别匹配 line 的开头和结尾
+ *
+ * @param[out] sub  至少 2*XyRegex_Max_Groups 个元素，sub[2i] 与 sub[2i+1] 为第 i 组的起止，
+ *                  未参与匹配的组为 NULL
+ */
+static bool
+xy_regex_search (const XyRegex *re, const char *line, size_t len, size_t from, const char **sub)
+{
+  const char *eol = line + len;
+  for (const char *sp = line + from; sp <= eol; sp++)
+    {
+      for (int i=0; i<2*XyRegex_Max_Groups; i++) sub[i] = NULL;
+      if (_xy_re_step (re, 0, sp, line, eol, sub))
+        return true;
+      if (re->anchored) break;
+    }
+  return false;
+}
+
+
+/**
+ * 一条改写规则，相当于 sed 的 s@pattern@replace@g
+ *
+ * replace 中 \0 表示整个匹配，\1-\9 表示对应的捕获组，\\ 表示反斜杠，其余字符原样输出
+ */
+typedef struct XyRewrite_t {
+  const char *pattern;
+  const char *replace;
+} XyRewrite;
+
+static void
+_xy_strbuf_append (XyLineBuf *sb, const char *str, size_t len)
+{
+  memcpy (_xy_linebuf_reserve (sb, len), str, len);
+  sb->len += len;
+  sb->buf[sb->len] = '\0';
+}
+
+static void
+_xy_re_expand (XyLineBuf *sb, const char *replace, const char **sub)
+{
+  for (const char *r = replace; *r; r++)
+    {
+      if ('\\'==r[0] && r[1] >= '0' && r[1] <= '9')
+        {
+          int g = r[1] - '0';
+          if (sub[2*g] && sub[2*g+1])
+            _xy_strbuf_append (sb, sub[2*g], sub[2*g+1] - sub[2*g]);
+          r++;
+        }
+      else if ('\\'==r[0] && '\\'==r[1])
+        {
+          _xy_strbuf_append (sb, "\\", 1);
+          r++;
+        }
+      else
+        {
+          _xy_strbuf_append (sb, r, 1);
+        }
+    }
+}
+
+/**
+ * 逐行对 str 依次应用各条规则，每条规则替换行内所有不重叠的匹配
+ *
+ * @param[out] count  替换的总次数，可为 NULL
+ *
+ * @return 新字符串；有规则不是合法的正则时返回 NULL
+ */
+static char *
+xy_str_rewrite (const char *str, const XyRewrite *rules, int rules_n, int *count)
+{
+  XyRegex **res = xy_malloc0 (sizeof (XyRegex *) * (rules_n + 1));
+  for (int i=0; i<rules_n; i++)
+    {
+      res[i] = xy_regex_compile (rules[i].pattern);
+      if (!res[i])
+        {
+          for (int k=0; k<i; k++) xy_regex_free (res[k]);
+          free (res);
+          return NULL;
+        }
+    }
+
+  int total = 0;
+  XyLineBuf out = {0};
+  XyLineBuf cur = {0};
+  XyLineBuf next = {0};
+  const char *sub[2*XyRegex_Max_Groups];
+
+  _xy_strbuf_append (&out, "", 0);
+  const char *line = str;
+  while (*line)
+    {
+      const char *nl = strchr (line, '\n');
+      size_t line_len = nl ? (size_t) (nl - line) : strlen (line);
+
+      cur.len = 0;
+      _xy_strbuf_append (&cur, line, line_len);
+
+      for (int i=0; i<rules_n; i++)
+        {
+          next.len = 0;
+          _xy_strbuf_append (&next, "", 0);
+          size_t pos = 0;
+          bool after_match = false;
+          while (pos <= cur.len && xy_regex_search (res[i], cur.buf, cur.len, pos, sub))
+            {
+              size_t begin = sub[0] - cur.buf;
+              size_t end   = sub[1] - cur.buf;
+              if (end==begin && begin==pos && after_match)
+                {
+                  /* 同 sed，紧跟在上一个匹配之后的空匹配不算 */
+                  if (pos < cur.len) _xy_strbuf_append (&next, cur.buf + pos, 1);
+                  pos++;
+                  after_match = false;
+                  continue;
+                }
+              _xy_strbuf_append (&next, cur.buf + pos, begin - pos);
+              _xy_re_expand (&next, rules[i].replace, sub);
+              total++;
+              after_match = (end!=begin);
+              if (end==begin)
+                {
+                  /* 空匹配时前进一个字符，避免原地重复匹配 */
+                  if (end < cur.len) _xy_strbuf_append (&next, cur.buf + end, 1);
+                  end++;
+                }
+              pos = end;
+            }
+          if (pos < cur.len)
+            _xy_strbuf_append (&next, cur.buf + pos, cur.len - pos);
+
+          XyLineBuf tmp = cur; cur = next; next = tmp;
+        }
+
+      _xy_strbuf_append (&out, cur.buf, cur.len);
+      if (!nl) break;
+      _xy_strbuf_append (&out, "\n", 1);
+      line = nl + 1;
+    }
+
+  for (int i=0; i<rules_n; i++) xy_regex_free (res[i]);
+  free (res);
+  free (cur.buf);
+  free (next.buf);
+
+  if (count) *count = total;
+  return out.buf;
+}
+
+
+/******************************************************
+ *                      Diff
+ ******************************************************/
+
+typedef struct XyDiffLine_t {
+  const char *str;
+  size_t      len;   /* 含行尾的 '\n'，最后一行可能没有 */
+} XyDiffLine;
+
+typedef struct XyDiffOp_t {
+  char type;   /* ' ', '-', '+' */
+  int  oi;     /* 该操作处于旧内容的第几行 (从 0 开始) */
+  int  ni;
+} XyDiffOp;
+
+static XyDiffLine *
+_xy_diff_split (const char *str, int *n)
+{
+  int cap = 16;
+  XyDiffLine *lines = malloc (sizeof (XyDiffLine) * cap);
+  *n = 0;
+  for (const char *p = str; *p; )
+    {
+      const char *nl = strchr (p, '\n');
+      size_t len = nl ? (size_t) (nl - p + 1) : strlen (p);
+      if (*n >= cap) lines = realloc (lines, sizeof (XyDiffLine) * (cap *= 2));
+      lines[(*n)++] = (XyDiffLine) {p, len};
+      p += len;
+    }
+  return lines;
+}
+
+static bool
+_xy_diff_eq (XyDiffLine a, XyDiffLine b)
+{
+  return a.len==b.len && 0==memcmp (a.str, b.str, a.len);
+}
+
+static void
+_xy_diff_emit (XyLineBuf *sb, char type, XyDiffLine line)
+{
+  _xy_strbuf_append (sb, &type, 1);
+  _xy_strbuf_append (sb, line.str, line.len);
+  if (0==line.len || '\n'!=line.str[line.len-1])
+    _xy_strbuf_append (sb, "\n\\ No newline at end of file\n", 29);
+}
+
+/**
+ * 以 unified diff 格式 (上下文 3 行) 比较两段文本
+ *
+ * 先去掉相同的开头和结尾，对中间部分求最长公共子序列；中间部分过大时直接视为整体替换
+ *
+ * @param  old_name  旧内容的名字，出现在 --- 行，如 a/etc/apt/sources.list 或 /dev/null
+ * @param  new_name  新内容的名字，出现在 +++ 行
+ *
+ * @return 没有差异时返回 NULL
+ */
+static char *
+xy_str_diff (const char *old, const char *new, const char *old_name, const char *new_name)
+{
+  if (xy_streql (old, new)) return NULL;
+
+  int on = 0, nn = 0;
+  XyDiffLine *a = _xy_diff_split (old, &on);
+  XyDiffLine *b = _xy_diff_split (new, &nn);
+
+  int pre = 0;
+  while (pre < on && pre < nn && _xy_diff_eq (a[pre], b[pre])) pre++;
+  int suf = 0;
+  while (suf < on - pre && suf < nn - pre && _xy_diff_eq (a[on-1-suf], b[nn-1-suf])) suf++;
+
+  int m = on - pre - suf, k = nn - pre - suf;
+  XyDiffOp *ops = malloc (sizeof (XyDiffOp) * (on + nn + 1));
+  int ops_n = 0;
+  for (int i=0; i<pre; i++) ops[ops_n++] = (XyDiffOp) {' ', i, i};
+
+  /* lcs[i][j] 为 a[pre+i..] 与 b[pre+j..] 的最长公共子序列长度 */
+  int *lcs = NULL;
+  if ((long long) (m + 1) * (k + 1) <= 4000000LL)
+    {
+      lcs = calloc ((size_t) (m + 1) * (k + 1), sizeof (int));
+      for (int i=m-1; i>=0; i--)
+        for (int j=k-1; j>=0; j--)
+          lcs[i*(k+1)+j] = _xy_diff_eq (a[pre+i], b[pre+j]) ? lcs[(i+1)*(k+1)+j+1] + 1
+                         : (lcs[(i+1)*(k+1)+j] >= lcs[i*(k+1)+j+1] ? lcs[(i+1)*(k+1)+j] : lcs[i*(k+1)+j+1]);
+    }
+
+  int i = 0, j = 0;
+  while (i < m || j < k)
+    {
+      if (lcs && i < m && j < k && _xy_diff_eq (a[pre+i], b[pre+j]))
+        { ops[ops_n++] = (XyDiffOp) {' ', pre+i, pre+j}; i++; j++; }
+      else if (i < m && (j==k || !lcs || lcs[(i+1)*(k+1)+j] >= lcs[i*(k+1)+j+1]))
+        { ops[ops_n++] = (XyDiffOp) {'-', pre+i, pre+j}; i++; }
+      else
+        { ops[ops_n++] = (XyDiffOp) {'+', pre+i, pre+j}; j++; }
+    }
+  free (lcs);
+  for (int s=0; s<suf; s++) ops[ops_n++] = (XyDiffOp) {' ', on-suf+s, nn-suf+s};
+
+  XyLineBuf out = {0};
+  char *head = xy_strjoin (5, "--- ", old_name, "\n+++ ", new_name, "\n");
+  _xy_strbuf_append (&out, head, strlen (head));
+
+  const int ctx = 3;
+  for (int c=0; c<ops_n; )
+    {
+      if (' '==ops[c].type) { c++; continue; }
+
+      /* 相邻改动之间的相同行不超过 2*ctx 时并入同一个 hunk */
+      int last = c;
+      for (int t=c+1; t<ops_n && t - last <= 2*ctx + 1; t++)
+        if (' '!=ops[t].type) last = t;
+
+      int start = c - ctx < 0 ? 0 : c - ctx;
+      int end   = last + ctx + 1 > ops_n ? ops_n : last + ctx + 1;
+      int ocount = 0, ncount = 0;
+      for (int t=start; t<end; t++)
+        {
+          if ('+'!=ops[t].type) ocount++;
+          if ('-'!=ops[t].type) ncount++;
+        }
+
+      /* 同 diff -u，行数为 1 时省略 ",1" */
+      char orange[32], nrange[32], hunk[96];
+      int ofrom = ocount ? ops[start].oi + 1 : ops[start].oi;
+      int nfrom = ncount ? ops[start].ni + 1 : ops[start].ni;
+      if (1==ocount) snprintf (orange, sizeof orange, "%d", ofrom);
+      else snprintf (orange, sizeof orange, "%d,%d", ofrom, ocount);
+      if (1==ncount) snprintf (nrange, sizeof nrange, "%d", nfrom);
+      else snprintf (nrange, sizeof nrange, "%d,%d", nfrom, ncount);
+      snprintf (hunk, sizeof hunk, "@@ -%s +%s @@\n", orange, nrange);
+      _xy_strbuf_append (&out, hunk, strlen (hunk));
+      for (int t=start; t<end; t++)
+        {
+          XyDiffLine line = '+'==ops[t].type ? b[ops[t].ni] : a[ops[t].oi];
+          _xy_diff_emit (&out, ops[t].type, line);
+        }
+      c = end;
+    }
+
+  free (ops);
+  free (a);
+  free (b);
+  return out.buf;
+}
+
+
+/******************************************************
+ *                      File
+ ******************************************************/
+
+static const char *
+_xy_expand_home (const char *path)
+{
+  if (xy_str_start_with (path, "~"))
+    return xy_2strjoin (xy_os_home, path + 1);
+  return path;
+}
+
+/**
+ * 读取整个文件
+ *
+ * @param[out] len  文件长度，可为 NULL
+ *
+ * @return 以 '\0' 结尾的文件内容；无法读取时返回 NULL
+ */
+static char *
+xy_file_read (const char *path, size_t *len)
+{
+  FILE *fp = fopen (_xy_expand_home (path), "rb");
+  if (!fp) return NULL;
+
+  XyLineBuf sb = {0};
+  size_t n = 0;
+  do
+    {
+      char *dst = _xy_linebuf_reserve (&sb, 8192);
+      n = fread (dst, 1, 8192, fp);
+      sb.len += n;
+    }
+  while (n > 0);
+
+  bool failed = ferror (fp);
+  fclose (fp);
+  if (failed)
+    {
+      free (sb.buf);
+      return NULL;
+    }
+
+  _xy_linebuf_reserve (&sb, 0);
+  sb.buf[sb.len] = '\0';
+  if (len) *len = sb.len;
+  return sb.buf;
+}
+
+/**
+ * 原子地写入文件: 先写入同目录下的临时文件并 fsync，再 rename 到 path，
+ * 中途被打断也只会留下完整的旧文件或完整的新文件
+ *
+ * 覆盖已有文件时沿用其权限、属主和 SELinux 上下文，否则按 umask 创建；
+ * path 为符号链接时写入其指向的文件，链接本身保持不变
+ *
+ * @return 成功返回 true
+ */
+static bool
+xy_file_write (const char *path, const char *content, size_t len)
+{
+  path = _xy_expand_home (path);
+
+#ifdef XY_On_Windows
+  char *tmp = xy_2strjoin (path, ".xy-tmp");
+  FILE *fp = fopen (tmp, "wb");
+  if (!fp) return false;
+  bool ok = (fwrite (content, 1, len, fp) == len);
+  ok = (0==fflush (fp)) && ok;
+  ok = (0==_commit (_fileno (fp))) && ok;
+  ok = (0==fclose (fp)) && ok;
+  if (!ok || !MoveFileExA (tmp, path, MOVEFILE_REPLACE_EXISTING|MOVEFILE_WRITE_THROUGH))
+    {
+      remove (tmp);
+      return false;
+    }
+  return true;
+#else
+  char resolved[PATH_MAX];
+  if (realpath (path, resolved))
+    path = resolved;
+
+  char *tmp = xy_2strjoin (path, ".xy-XXXXXX");
+  int fd = mkstemp (tmp);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (0==stat (path, &st))
+    {
+      fchmod (fd, st.st_mode & 07777);
+      /* 非 root 时无法改属主，此时文件本就属于自己 */
+      (void) !fchown (fd, st.st_uid, st.st_gid);
+#if defined(__linux__) || defined(__linux)
+      char ctx[256];
+      ssize_t ctx_len = getxattr (path, "security.selinux", ctx, sizeof (ctx));
+      if (ctx_len > 0)
+        fsetxattr (fd, "security.selinux", ctx, ctx_len, 0);
+#endif
+    }
+  else
+    {
+      mode_t mask = umask (0);
+      umask (mask);
+      fchmod (fd, 0666 & ~mask);
+    }
+
+  bool ok = true;
+  size_t done = 0;
+  while (ok && done < len)
+    {
+      ssize_t n = write (fd, content + done, len - done);
+      if (n < 0 && EINTR==errno) continue;
+      if (n <= 0) ok = false;
+      else done += n;
+    }
+  ok = ok && (0==fsync (fd));
+  ok = (0==close (fd)) && ok;
+
+  if (!ok || 0!=rename (tmp, path))
+    {
+      unlink (tmp);
+      return false;
+    }
+
+  /* rename 本身也要落盘 */
+  char *dir = xy_strdup (path);
+  char *slash = strrchr (dir, '/');
+  if (slash)
+    {
+      *(slash==dir ? slash + 1 : slash) = '\0';
+      int dfd = open (dir, O_RDONLY);
+      if (dfd >= 0)
+        {
+          fsync (dfd);
+          close (dfd);
+        }
+    }
+  free (dir);
+  return true;
+#endif
+}
+
+/**
+ * 在临时目录中创建一个只属于自己的空文件，名字不可预测且以独占方式创建，
+ * 因此不会写入他人在共享的临时目录中预先放置的文件或符号链接
+ *
+ * @param  prefix  文件名前缀；Windows 上只取前 3 个字符
+ *
+ * @return 文件路径，失败时返回 NULL；用完后由调用者删除
+ */
+static char *
+xy_tmpfile_create (const char *prefix)
+{
+#ifdef XY_On_Windows
+  char dir[MAX_PATH], path[MAX_PATH];
+  if (0==GetTempPathA (sizeof dir, dir) || 0==GetTempFileNameA (dir, prefix, 0, path))
+    return NULL;
+  return xy_strdup (path);
+#else
+  const char *dir = getenv ("TMPDIR");
+  if (!dir || !*dir) dir = "/tmp";
+  char *path = xy_strjoin (4, dir, "/", prefix, "-XXXXXX");
+  int fd = mkstemp (path);
+  if (fd < 0)
+    {
+      free (path);
+      return NULL;
+    }
+  close (fd);
+  return path;
+#endif
+}
+
 #endif
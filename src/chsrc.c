@@ -13,7 +13,7 @@
  *                 |   Terrasse    <terrasse@qq.com>
  *                 |
  * Created On      : <2023-08-28>
- * Last Modified   : <2024-09-04>
+ * Last Modified   : <2026-10-18>
  *
  * chsrc: Change Source —— 全平台通用命令行换源工具
  * ------------------------------------------------------------*/
@@ -108,10 +108,12 @@ Chsrc_Usage[] = {
 
   "list (或 ls, 或 l)        列出可用镜像源，和可换源目标",
   "list mirror/target        列出可用镜像源，或可换源目标",
-  "list os/lang/ware         列出可换源的操作系统/编程语言/软件\n",
+  "list os/lang/ware         列出可换源的操作系统/编程语言/软件",
+  "list backup               列出修改文件前保存的备份\n",
 
   "measure <target>          对该目标所有源测速",
-  "cesu    <target>          \n",
+  "cesu    <target>          ",
+  "stats [target|mirror]     查看历史测速的百分位数、失败率与分时段表现\n",
 
   "list <target>             查看该目标可用源与支持功能",
   "get  <target>             查看该目标当前源的使用情况\n",
@@ -120,13 +122,21 @@ Chsrc_Usage[] = {
   "set  <target>  first      换源，使用维护团队测速第一的源",
   "set  <target> <mirror>    换源，指定使用某镜像站 (通过list <target>查看)",
   "set  <target> https://url 换源，用户自定义源URL",
-  "reset <target>            重置，使用上游默认使用的源\n",
+  "set  <t1>,<t2>,...        依次为多个目标换源，同一包管理器只在最后刷新一次",
+  "reset <target>            重置，使用上游默认使用的源",
+  "reset backup <hash>       把文件恢复为某个备份 (通过list backup查看)",
+  "undo                      撤销最近一次换源对文件的修改，或回滚被中断的换源\n",
 
   "选项:",
-  "-dry                      Dry Run，模拟换源过程，命令仅打印并不运行",
+  "-dry                      Dry Run，模拟换源过程，命令仅打印并不运行，对文件的修改以 diff 显示",
   "-para(llel)               并行测速 (默认的顺序测速更有参考意义)",
   "-local                    仅对本项目而非全局换源 (通过ls <target>查看支持情况)",
   "-ipv6                     使用IPv6测速",
+  "-interface <ifname>       经由指定网卡测速，可用逗号分隔多个，all 表示所有网卡",
+  "-source-ip <addr>         使用指定源地址测速，可用逗号分隔多个",
+  "-rank median              按历史测速的中位数而非本次测速结果挑选最快源",
+  "-cmd-timeout <秒>         换源时运行的每条命令的超时时间，超时后终止该命令，0 表示不限时",
+  "-refresh <policy>         换源后的刷新方式: none, metadata (默认，只刷新元数据), targeted, full (并升级系统)",
   "-en(glish)                使用英文输出",
   "-no-color                 无颜色输出\n",
 
@@ -142,10 +152,12 @@ Chsrc_Usage_English[] = {
 
   "list (or ls, or l)        List available mirror sites and supported targets",
   "list mirror/target        List available mirror sites or  supported targets",
-  "list os/lang/ware         List supported OS/Programming Language/Software\n",
+  "list os/lang/ware         List supported OS/Programming Language/Software",
+  "list backup               List the backups saved before files were changed\n",
 
   "measure <target>          Measure velocity of all sources of <target>",
-  "cesu    <target>          \n",
+  "cesu    <target>          ",
+  "stats [target|mirror]     View percentiles, failure rate and hour-of-day profile of measurement history\n",
 
   "list <target>             View available sources and supporting features for <target>",
   "get  <target>             View the current source state for <target>\n",
@@ -154,13 +166,21 @@ Chsrc_Usage_English[] = {
   "set  <target>  first      Change source, select the fastest source measured by the maintainers team",
   "set  <target> <mirror>    Change source, specify a mirror site (Via `list <target>`)",
   "set  <target> https://url Change source, using user-defined source URL",
-  "reset <target>            Reset  source to the upstream's default\n",
+  "set  <t1>,<t2>,...        Change source for several targets, refreshing each package manager once at the end",
+  "reset <target>            Reset  source to the upstream's default",
+  "reset backup <hash>       Restore a file from a backup (Via `list backup`)",
+  "undo                      Revert the file changes of the last run, or roll back an interrupted one\n",
 
   "Options:",
-  "-dry                      Dry Run. Simulate the source changing process, command only prints, not run",
+  "-dry                      Dry Run. Simulate the source changing process, command only prints, not run, file changes shown as diffs",
   "-para(llel)               Measure velocity in parallel",
   "-local                    Change source only for this project rather than globally (Via `ls <target>`)",
   "-ipv6                     Speed measurement using IPv6",
+  "-interface <ifname>       Measure via the given interface(s), comma separated, `all` for every interface",
+  "-source-ip <addr>         Measure from the given source address(es), comma separated",
+  "-rank median              Select the fastest source by the long-term median rather than this measurement",
+  "-cmd-timeout <seconds>    Kill any command run during source changing after this long, 0 for no limit",
+  "-refresh <policy>         How to refresh after changing: none, metadata (default), targeted, full (also upgrade)",
   "-en(glish)                Output in English",
   "-no-color                 Output without color\n",
 
@@ -470,6 +490,31 @@ iterate_targets_ (const char ***array, size_t size, const char *input, const cha
 
 #define iterate_targets(ary, input, target) iterate_targets_(ary, xy_arylen(ary), input, target)
 
+
+static const char **
+find_target_aliases_ (const char ***array, size_t size, const char *input)
+{
+  for (int i=0; i<size; i++)
+    for (int k=0; NULL!=array[i][k]; k++)
+      if (xy_streql (input, array[i][k]))
+        return array[i];
+  return NULL;
+}
+
+/**
+ * 查询 `input` 所属 target 的全部别名，第一个别名即该 target 的规范名
+ *
+ * @return 以 NULL 结尾的别名数组，未匹配时返回 NULL
+ */
+static const char **
+chsrc_find_target_aliases (const char *input)
+{
+  const char **aliases = find_target_aliases_ (pl_packagers, xy_arylen(pl_packagers), input);
+  if (!aliases) aliases = find_target_aliases_ (os_systems,   xy_arylen(os_systems),   input);
+  if (!aliases) aliases = find_target_aliases_ (wr_softwares, xy_arylen(wr_softwares), input);
+  return aliases;
+}
+
 typedef enum {
   TargetOp_Get_Source = 1,
   TargetOp_Set_Source,
@@ -553,6 +598,232 @@ get_target (const char *input, TargetOp code, char *option)
 }
 
 
+#define Chsrc_Max_Targets 16
+
+/**
+ * 对逗号分隔的多个目标 (如 ubuntu,ros) 依次换源或重置
+ *
+ * 各目标的刷新推迟到最后，每个包管理器只刷新一次，见 chsrc_refresh()
+ *
+ * @return 所有目标都找到返回true；有目标不存在时不对任何目标进行操作，返回false
+ */
+bool
+get_targets (const char *input, TargetOp code, char *option)
+{
+  if (!strchr (input, ','))
+    return get_target (input, code, option);
+
+  if (option && is_url (option))
+    {
+      char *msg = CliOpt_InEnglish ? "Cannot use a custom URL for multiple targets"
+                                   : "不能为多个目标指定同一个自定义源URL";
+      chsrc_error (msg);
+      exit (Exit_UserCause);
+    }
+
+  char *targets[Chsrc_Max_Targets];
+  int   targets_n = 0;
+
+  char *values = xy_strdup (input);
+  for (char *tok = strtok (values, ","); tok; tok = strtok (NULL, ","))
+    {
+      if (targets_n >= Chsrc_Max_Targets)
+        {
+          char *msg = CliOpt_InEnglish ? "Too many targets, ignore: " : "指定的目标过多，忽略: ";
+          chsrc_warn (xy_2strjoin (msg, tok));
+          continue;
+        }
+      if (!chsrc_find_target_aliases (tok))
+        {
+          char *msg = CliOpt_InEnglish ? "Unknown target: " : "未知的目标: ";
+          chsrc_error (xy_2strjoin (msg, tok));
+          return false;
+        }
+      targets[targets_n++] = tok;
+    }
+
+  ProgStatus_Defer_Refresh = true;
+  for (int i=0; i<targets_n; i++)
+    {
+      chsrc_reset_target_status ();
+      get_target (targets[i], code, option ? xy_strdup (option) : NULL);
+    }
+
+  /* 与单个目标时刷新失败一样以失败退出，本次的修改由日志回滚，见 chsrc_journal_atexit() */
+  if (!chsrc_flush_refresh ())
+    {
+      char *msg = CliOpt_InEnglish ? "Some deferred refreshes failed"
+                                   : "部分推迟的刷新失败";
+      chsrc_error (msg);
+      exit (Exit_FatalUnkownError);
+    }
+  return true;
+}
+
+
+/**
+ * 匹配带值的命令行选项，支持 -opt value 与 -opt=value 两种形式
+ *
+ * @param[in,out] i      当前参数的下标，若值为下一个参数，则会被移到值上
+ * @param[out]    value  选项的值，未给出值时为 NULL
+ *
+ * @return 该参数是否为此选项
+ */
+static bool
+cli_option_value (int argc, char const *argv[], int *i, const char *opt, const char **value)
+{
+  const char *arg = argv[*i];
+  *value = NULL;
+
+  if (xy_streql (arg, opt))
+    {
+      if (*i < argc)
+        {
+          *i += 1;
+          *value = argv[*i];
+        }
+      return true;
+    }
+
+  size_t len = strlen (opt);
+  if (0==strncmp (arg, opt, len) && '='==arg[len])
+    {
+      if (arg[len+1]) *value = arg + len + 1;
+      return true;
+    }
+  return false;
+}
+
+
+/**
+ * chsrc stats [target|mirror]
+ *
+ * 按 (目标, 镜像站, 出口) 分组汇报历史测速的百分位数、失败率，以及按 4 小时分段的中位吞吐
+ *
+ * @param  filter  目标名或镜像站 code，为 NULL 时汇报全部
+ */
+void
+cli_print_stats (const char *filter)
+{
+  size_t n = 0;
+  MeasureRecord *records = chsrc_history_load (&n);
+
+  const char *filter_target = NULL;
+  if (filter)
+    {
+      const char **aliases = chsrc_find_target_aliases (filter);
+      if (aliases) filter_target = aliases[0];
+    }
+
+  /* 先找出所有分组，每组以其第一条记录作为代表 */
+  size_t *groups = xy_malloc0 (sizeof (size_t) * (n + 1));
+  size_t groups_n = 0;
+
+  for (size_t i=0; i<n; i++)
+    {
+      MeasureRecord *r = &records[i];
+      if (filter_target && !xy_streql (r->target, filter_target)) continue;
+      if (filter && !filter_target && !xy_streql (r->mirror, filter)) continue;
+
+      bool found = false;
+      for (size_t g=0; g<groups_n; g++)
+        {
+          MeasureRecord *head = &records[groups[g]];
+          if (xy_streql (head->target, r->target) && xy_streql (head->mirror, r->mirror)
+              && xy_streql (head->route, r->route))
+            {
+              found = true; break;
+            }
+        }
+      if (!found) groups[groups_n++] = i;
+    }
+
+  if (0==groups_n)
+    {
+      char *msg = CliOpt_InEnglish ? "No measurement history yet, run chsrc measure <target> first"
+                                   : "暂无测速历史，请先运行 chsrc measure <target>";
+      chsrc_warn (msg);
+      free (groups); free (records);
+      return;
+    }
+
+  char *msg = CliOpt_InEnglish ? "Measurement history: " : "测速历史: ";
+  say (bdblue (xy_2strjoin (msg, chsrc_history_path ())));
+
+  double *speeds = xy_malloc0 (sizeof (double) * n);
+  double *rtts   = xy_malloc0 (sizeof (double) * n);
+  double *blocks = xy_malloc0 (sizeof (double) * n);
+
+  for (size_t g=0; g<groups_n; g++)
+    {
+      MeasureRecord *head = &records[groups[g]];
+      size_t total = 0, failed = 0, speeds_n = 0, rtts_n = 0;
+
+      for (size_t i=groups[g]; i<n; i++)
+        {
+          MeasureRecord *r = &records[i];
+          if (!xy_streql (head->target, r->target) || !xy_streql (head->mirror, r->mirror)
+              || !xy_streql (head->route, r->route))
+            continue;
+          total++;
+          if (r->failed) { failed++; continue; }
+          speeds[speeds_n++] = r->speed;
+          if (r->rtt_ms > 0) rtts[rtts_n++] = r->rtt_ms;
+        }
+
+      qsort (speeds, speeds_n, sizeof (double), chsrc_dbl_cmp);
+      qsort (rtts,   rtts_n,   sizeof (double), chsrc_dbl_cmp);
+
+      br ();
+      char line[128];
+      sprintf (line, CliOpt_InEnglish ? "  samples %zu, failure rate %.1f%%" : "  样本 %zu，失败率 %.1f%%",
+               total, 100.0 * failed / total);
+      char *route = head->route[0] ? xy_strjoin (3, " (", chsrc_measure_route_name (head->route), ")") : "";
+      say (xy_strjoin (5, bdgreen (head->mirror), " @ ", head->target, route, line));
+
+      if (speeds_n)
+        {
+          char *msg = CliOpt_InEnglish ? "    Throughput p10/p50/p90: " : "    吞吐 p10/p50/p90: ";
+          say (xy_strjoin (6, msg, to_human_readable_speed (chsrc_percentile (speeds, speeds_n, 0.1)),
+                           " / ", to_human_readable_speed (chsrc_percentile (speeds, speeds_n, 0.5)),
+                           " / ", to_human_readable_speed (chsrc_percentile (speeds, speeds_n, 0.9))));
+        }
+
+      if (rtts_n)
+        {
+          sprintf (line, "%.1f / %.1f / %.1f ms", chsrc_percentile (rtts, rtts_n, 0.1),
+                   chsrc_percentile (rtts, rtts_n, 0.5), chsrc_percentile (rtts, rtts_n, 0.9));
+          say (xy_2strjoin (CliOpt_InEnglish ? "    Latency    p10/p50/p90: " : "    延迟 p10/p50/p90: ", line));
+        }
+
+      /* 分时段: 每 4 小时一段，给出该段内的中位吞吐 */
+      char *profile = CliOpt_InEnglish ? "    By hour (median): " : "    分时段中位吞吐: ";
+      for (int b=0; b<6; b++)
+        {
+          size_t blocks_n = 0;
+          for (size_t i=groups[g]; i<n; i++)
+            {
+              MeasureRecord *r = &records[i];
+              if (r->failed || r->hour / 4 != b) continue;
+              if (!xy_streql (head->target, r->target) || !xy_streql (head->mirror, r->mirror)
+                  || !xy_streql (head->route, r->route))
+                continue;
+              blocks[blocks_n++] = r->speed;
+            }
+          qsort (blocks, blocks_n, sizeof (double), chsrc_dbl_cmp);
+
+          sprintf (line, "%02d-%02d ", b * 4, b * 4 + 4);
+          char *value = blocks_n ? to_human_readable_speed (chsrc_percentile (blocks, blocks_n, 0.5)) : "-";
+          profile = xy_strjoin (4, profile, b ? " | " : "", line, value);
+        }
+      say (profile);
+    }
+
+  free (speeds); free (rtts); free (blocks);
+  free (groups); free (records);
+}
+
+
 int
 main (int argc, char const *argv[])
 {
@@ -589,10 +860,82 @@ main (int argc, char const *argv[])
     {
       if (xy_str_start_with (argv[i], "-"))
         {
+          const char *opt_value = NULL;
+          int opt_pos = i;
+
           if (xy_streql (argv[i], "-ipv6"))
             {
               CliOpt_IPv6 = true;
             }
+          else if (cli_option_value (argc, argv, &i, "-rank", &opt_value))
+            {
+              if (opt_value && xy_streql (opt_value, "median"))
+                CliOpt_RankByMedian = true;
+              else if (opt_value && xy_streql (opt_value, "fresh"))
+                CliOpt_RankByMedian = false;
+              else
+                {
+                  char *msg = CliOpt_InEnglish ? "-rank only accepts fresh or median" : "-rank 仅接受 fresh 或 median";
+                  chsrc_error (msg); return 1;
+                }
+              if (i != opt_pos)
+                {
+                  cli_arg_Target_pos++;
+                  cli_arg_Mirror_pos++;
+                }
+            }
+          else if (cli_option_value (argc, argv, &i, "-refresh", &opt_value))
+            {
+              if      (opt_value && xy_streql (opt_value, "none"))     CliOpt_Refresh = RefreshPolicy_None;
+              else if (opt_value && xy_streql (opt_value, "metadata")) CliOpt_Refresh = RefreshPolicy_Metadata;
+              else if (opt_value && xy_streql (opt_value, "targeted")) CliOpt_Refresh = RefreshPolicy_Targeted;
+              else if (opt_value && xy_streql (opt_value, "full"))     CliOpt_Refresh = RefreshPolicy_Full;
+              else
+                {
+                  char *msg = CliOpt_InEnglish ? "-refresh only accepts none, metadata, targeted or full"
+                                               : "-refresh 仅接受 none, metadata, targeted 或 full";
+                  chsrc_error (msg); return 1;
+                }
+              if (i != opt_pos)
+                {
+                  cli_arg_Target_pos++;
+                  cli_arg_Mirror_pos++;
+                }
+            }
+          else if (cli_option_value (argc, argv, &i, "-cmd-timeout", &opt_value))
+            {
+              char *end = NULL;
+              long sec = opt_value ? strtol (opt_value, &end, 10) : -1;
+              if (!opt_value || end==opt_value || *end || sec < 0 || sec > 0x7fff)
+                {
+                  char *msg = CliOpt_InEnglish ? "-cmd-timeout needs a number of seconds (0 for no limit)"
+                                               : "-cmd-timeout 需要一个秒数 (0 表示不限时)";
+                  chsrc_error (msg); return 1;
+                }
+              CliOpt_Cmd_Timeout = (int) sec;
+              if (i != opt_pos)
+                {
+                  cli_arg_Target_pos++;
+                  cli_arg_Mirror_pos++;
+                }
+            }
+          else if (cli_option_value (argc, argv, &i, "-interface", &opt_value)
+                   || cli_option_value (argc, argv, &i, "-source-ip", &opt_value))
+            {
+              bool is_interface = xy_str_start_with (argv[opt_pos], "-interface");
+              if (!opt_value)
+                {
+                  char *msg = CliOpt_InEnglish ? "Missing value for option: " : "命令行选项缺少值 ";
+                  chsrc_error (xy_2strjoin (msg, argv[opt_pos])); return 1;
+                }
+              chsrc_add_measure_routes (opt_value, is_interface);
+              /* 值单独作为一个参数时，target 与 mirror 还要再向后移 */
+              if (i != opt_pos)
+                {
+                  cli_arg_Target_pos++;
+                  cli_arg_Mirror_pos++;
+                }
+            }
           else if (xy_streql (argv[i], "-local"))
             {
               CliOpt_Locally = true;
@@ -706,6 +1049,10 @@ main (int argc, char const *argv[])
             {
               cli_print_supported_wr (); return 0;
             }
+          else if (xy_streql (target, "backup") || xy_streql (target, "backups"))
+            {
+              chsrc_list_backups (); return 0;
+            }
 
           matched = get_target (target, TargetOp_List_Config, NULL);
           if (!matched) goto not_matched;
@@ -739,6 +1086,16 @@ main (int argc, char const *argv[])
     }
 
 
+  /* chsrc stats */
+  else if (xy_streql    (command, "stats")
+           || xy_streql (command, "stat"))
+    {
+      const char *filter = argc < cli_arg_Target_pos ? NULL : argv[cli_arg_Target_pos];
+      cli_print_stats (filter);
+      return 0;
+    }
+
+
   /* chsrc get */
   else if (xy_streql    (command, "get")
            || xy_streql (command, "g"))
@@ -775,8 +1132,9 @@ main (int argc, char const *argv[])
           mirrorCode_or_url = xy_strdup (argv[cli_arg_Mirror_pos]);
         }
 
-      matched = get_target (target, TargetOp_Set_Source, mirrorCode_or_url);
+      matched = get_targets (target, TargetOp_Set_Source, mirrorCode_or_url);
       if (!matched) goto not_matched;
+      chsrc_journal_commit ();
       return 0;
     }
 
@@ -793,10 +1151,33 @@ main (int argc, char const *argv[])
           return 1;
         }
 
-      ProgMode_CMD_Reset = true;
       target = argv[cli_arg_Target_pos];
-      matched = get_target (target, TargetOp_Reset_Source, NULL);
+      if (xy_streql (target, "backup"))
+        {
+          if (argc >= cli_arg_Mirror_pos && argv[cli_arg_Mirror_pos])
+            {
+              chsrc_restore_backup (argv[cli_arg_Mirror_pos]);
+              chsrc_journal_commit ();
+            }
+          else
+            {
+              chsrc_list_backups ();
+              chsrc_note2 (CliOpt_InEnglish ? "Restore one with: chsrc reset backup <hash>" : "恢复其中一个: chsrc reset backup <hash>");
+            }
+          return 0;
+        }
+
+      ProgMode_CMD_Reset = true;
+      matched = get_targets (target, TargetOp_Reset_Source, NULL);
       if (!matched) goto not_matched;
+      chsrc_journal_commit ();
+      return 0;
+    }
+
+  /* chsrc undo */
+  else if (xy_streql (command, "undo"))
+    {
+      chsrc_undo ();
       return 0;
     }
 
@@ -4,8 +4,8 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-10>
- * Last Modified : <2024-08-28>
- * Revision      :      2
+ * Last Modified : <2026-10-18>
+ * Revision      :      3
  * ------------------------------------------------------------*/
 
 /**
@@ -64,34 +64,23 @@ pl_dart_setsrc (char *option)
 
       if (xy_file_exist (xy_win_powershell_profile))
         {
-          chsrc_append_to_file (towrite1, xy_win_powershell_profile);
-          chsrc_append_to_file (towrite2, xy_win_powershell_profile);
+          chsrc_stage_to_block ("dart", towrite1, xy_win_powershell_profile);
+          chsrc_stage_to_block ("dart", towrite2, xy_win_powershell_profile);
         }
 
       if (xy_file_exist (xy_win_powershellv5_profile))
         {
-          chsrc_append_to_file (towrite1, xy_win_powershellv5_profile);
-          chsrc_append_to_file (towrite2, xy_win_powershellv5_profile);
+          chsrc_stage_to_block ("dart", towrite1, xy_win_powershellv5_profile);
+          chsrc_stage_to_block ("dart", towrite2, xy_win_powershellv5_profile);
         }
     }
   else
     {
-      char *zshrc  = "~/.zshrc";
-      char *bashrc = "~/.bashrc";
-
-      chsrc_backup (zshrc);
-      towrite1 = xy_strjoin (3, "export PUB_HOSTED_URL=\"", pub, "\"");
-      towrite2 = xy_strjoin (3, "export FLUTTER_STORAGE_BASE_URL=\"", flutter, "\"");
-      chsrc_append_to_file (towrite1, zshrc);
-      chsrc_append_to_file (towrite2, zshrc);
-
-      if (xy_file_exist (bashrc))
-        {
-          chsrc_backup (bashrc);
-          chsrc_append_to_file (towrite1, bashrc);
-          chsrc_append_to_file (towrite2, bashrc);
-        }
+      const char *names[]  = {"PUB_HOSTED_URL", "FLUTTER_STORAGE_BASE_URL"};
+      const char *values[] = {pub, flutter};
+      chsrc_write_env_vars ("dart", names, values, xy_arylen (names));
     }
+  chsrc_commit_staged_files ();
   chsrc_conclude (&source, ChsrcTypeAuto);
 }
 
@@ -111,7 +100,7 @@ pl_dart_feat (char *option)
   /* 该换源方案中，URL存在拼凑，因此不能让用户手动使用某URL来换源 */
   fi.can_user_define = false;
 
-  fi.note = "该换源通过写入环境变量实现，若多次换源，请手动清理profile文件";
+  fi.note = "该换源通过写入环境变量实现，Windows 上写入 PowerShell profile 中由 # >>> chsrc dart >>> 标记的块，其他系统统一保存在 ~/.config/chsrc/env.sh 与 env.fish 中";
   return fi;
 }
 
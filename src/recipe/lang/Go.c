@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-08-30>
- * Last Modified : <2024-08-09>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 static MirrorSite
@@ -34,8 +34,7 @@ def_sources_n(pl_go);
 void
 pl_go_check_cmd ()
 {
-  char *check_cmd = xy_str_to_quietcmd ("go version");
-  bool exist = query_program_exist (check_cmd, "go", Noisy_When_Exist|Noisy_When_NonExist);
+  bool exist = chsrc_check_program ("go");
 
   if (!exist)
     {
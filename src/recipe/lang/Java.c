@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-08-31>
- * Last Modified : <2024-08-09>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -24,8 +24,15 @@ def_sources_n(pl_java);
 void
 pl_java_check_cmd (bool *maven_exist, bool *gradle_exist)
 {
-  *maven_exist  = chsrc_check_program ("mvn");
-  *gradle_exist = chsrc_check_program ("gradle");
+  // 同时获取 mvn -v，供 pl_java_find_maven_config() 使用
+  ProgramProbe probes[] = {
+    {.name = "mvn", .args = "-v"},
+    {.name = "gradle"}
+  };
+  chsrc_detect_programs (probes, xy_arylen(probes), true);
+
+  *maven_exist  = probes[0].exist;
+  *gradle_exist = probes[1].exist;
 
   if (! *maven_exist && ! *gradle_exist)
     {
@@ -34,11 +41,22 @@ pl_java_check_cmd (bool *maven_exist, bool *gradle_exist)
     }
 }
 
+/**
+ * 从 mvn -v 的输出中找到 Maven home，mvn -v 的结果会被缓存，见 chsrc_program_output()
+ */
 char *
 pl_java_find_maven_config ()
 {
-  char *buf = xy_run ("mvn -v", 2, NULL);
-  char *maven_home = xy_str_delete_prefix (buf, "Maven home: ");
+  char *buf = chsrc_program_output ("mvn", "-v");
+  char *line = buf ? strstr (buf, "Maven home: ") : NULL;
+  if (!line)
+    {
+      chsrc_error ("无法从 mvn -v 的输出中找到 Maven home");
+      exit (Exit_UserCause);
+    }
+  char *end = strchr (line, '\n');
+  char *maven_home = end ? xy_strndup (line, end - line) : xy_strdup (line);
+  maven_home = xy_str_delete_prefix (maven_home, "Maven home: ");
   maven_home = xy_str_strip (maven_home);
 
   char *maven_config = xy_uniform_path (xy_2strjoin (maven_home, "/conf/settings.xml"));
@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-08-31>
- * Last Modified : <2024-08-15>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -46,7 +46,7 @@ pl_julia_setsrc (char *option)
 
   const char *towrite = xy_strjoin (3, "ENV[\"JULIA_PKG_SERVER\"] = \"", source.url, "\"");
 
-  chsrc_append_to_file (towrite, "~/.julia/config/startup.jl");
+  chsrc_write_managed_block ("julia", towrite, "~/.julia/config/startup.jl");
   chsrc_conclude (&source, ChsrcTypeUntested);
 }
 
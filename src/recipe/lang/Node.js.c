@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Mr. Will  <mr.will.com@outlook.com>
  * Created On    : <2023-08-30>
- * Last Modified : <2024-08-28>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 static MirrorSite
@@ -33,9 +33,17 @@ def_sources_n(pl_nodejs);
 void
 pl_nodejs_check_cmd (bool *npm_exist, bool *yarn_exist, bool *pnpm_exist)
 {
-  *npm_exist  = chsrc_check_program ("npm");
-  *yarn_exist = chsrc_check_program ("yarn");
-  *pnpm_exist = chsrc_check_program ("yarn");
+  // 同时获取 yarn --version，供 get_yarn_version() 使用
+  ProgramProbe probes[] = {
+    {.name = "npm"},
+    {.name = "yarn", .args = "--version"},
+    {.name = "pnpm"}
+  };
+  chsrc_detect_programs (probes, xy_arylen(probes), true);
+
+  *npm_exist  = probes[0].exist;
+  *yarn_exist = probes[1].exist;
+  *pnpm_exist = probes[2].exist;
 
   if (!*npm_exist && !*yarn_exist && !*pnpm_exist)
     {
@@ -45,12 +53,15 @@ pl_nodejs_check_cmd (bool *npm_exist, bool *yarn_exist, bool *pnpm_exist)
 }
 
 
+/**
+ * yarn --version 的结果会被缓存，见 chsrc_program_output()
+ */
 double
 get_yarn_version ()
 {
-  char *ver = xy_run ("yarn --version", 0, NULL);
-  double version = atof (ver);
-  return version;
+  char *ver = chsrc_program_output ("yarn", "--version");
+  if (!ver) return 0;
+  return atof (ver);
 }
 
 
@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-03>
- * Last Modified : <2024-08-17>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -38,20 +38,30 @@ pl_python_check_cmd (char **prog, bool *poetry_exist, bool *pdm_exist)
   *pdm_exist = false;
   *poetry_exist = false;
 
-  bool py_exist = false;
+  // 所有检测并发进行，只查找 PATH，不会运行 python，且会跳过会弹出 Microsoft Store 的应用执行别名
+  ProgramProbe probes[] = {
+    {.name = "python3"},
+    {.name = "python"},
+    {.name = "poetry"},
+    {.name = "pdm"}
+  };
+  chsrc_detect_programs (probes, xy_arylen(probes), false);
 
   // 由于Python2和Python3的历史，目前（2024-06）许多python命令实际上仍然是python2
   // https://gitee.com/RubyMetric/chsrc/issues/I9VZL2
-  // 因此我们首先测试 python3
-  py_exist = chsrc_check_program ("python3");
-
-  if (py_exist) *prog = "python3";
+  // 因此我们首先使用 python3
+  char *msg = CliOpt_InEnglish ? "command" : "命令";
+  if (probes[0].exist)
+    {
+      *prog = "python3";
+      log_check_result ("python3", msg, true);
+    }
   else
     {
-      // 不要调用 python 自己，而是使用 python --version，避免Windows弹出Microsoft Store
-      py_exist = chsrc_check_program ("python");
+      log_check_result ("python3", msg, false);
+      log_check_result ("python",  msg, probes[1].exist);
 
-      if (py_exist) *prog = "python";
+      if (probes[1].exist) *prog = "python";
       else
         {
           chsrc_error ("未找到 Python 相关命令，请检查是否存在");
@@ -59,8 +69,10 @@ pl_python_check_cmd (char **prog, bool *poetry_exist, bool *pdm_exist)
         }
     }
 
-  *poetry_exist = chsrc_check_program ("poetry");
-  *pdm_exist = chsrc_check_program ("pdm");
+  log_check_result ("poetry", msg, probes[2].exist);
+  log_check_result ("pdm",    msg, probes[3].exist);
+  *poetry_exist = probes[2].exist;
+  *pdm_exist    = probes[3].exist;
 }
 
 void
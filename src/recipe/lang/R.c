@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-21>
- * Last Modified : <2024-08-15>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -63,14 +63,15 @@ pl_r_setsrc (char *option)
   // 或者我们调用 r.exe --slave -e 上面的内容
   if (xy_on_windows)
     {
-      chsrc_append_to_file (towrite1, "~/Documents/.Rprofile");
-      chsrc_append_to_file (towrite2, "~/Documents/.Rprofile");
+      chsrc_stage_to_block ("r", towrite1, "~/Documents/.Rprofile");
+      chsrc_stage_to_block ("r", towrite2, "~/Documents/.Rprofile");
     }
   else
     {
-      chsrc_append_to_file (towrite1, "~/.Rprofile");
-      chsrc_append_to_file (towrite2, "~/.Rprofile");
+      chsrc_stage_to_block ("r", towrite1, "~/.Rprofile");
+      chsrc_stage_to_block ("r", towrite2, "~/.Rprofile");
     }
+  chsrc_commit_staged_files ();
   chsrc_conclude (&source, ChsrcTypeAuto);
 }
 
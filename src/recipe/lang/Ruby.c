@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-08-29>
- * Last Modified : <2024-09-04>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 static MirrorSite
@@ -41,16 +41,21 @@ pl_ruby_getsrc (char *option)
   chsrc_run ("bundle config get mirror.https://rubygems.org", RunOpt_Default);
 }
 
-void
-pl_ruby_remove_gem_source (const char *source)
+/**
+ * 收集 `gem sources -l` 输出中的各个源，ctx 为以 NULL 结尾的 char *[]
+ */
+static bool
+pl_ruby_collect_gem_source (const char *line, size_t len, void *ctx)
 {
-  char *cmd = NULL;
-  if (is_url (source))
+  char **sources = (char **) ctx;
+  if (is_url (line))
     {
-      cmd = xy_str_delete_suffix (source, "\n");
-      cmd = xy_2strjoin ("gem sources -r ", cmd);
-      chsrc_run (cmd, RunOpt_Default);
+      int i = 0;
+      while (sources[i]) i++;
+      if (i < 15)
+        sources[i] = xy_strndup (line, len);
     }
+  return true;
 }
 
 /**
@@ -67,7 +72,15 @@ pl_ruby_setsrc (char *option)
 
   char *cmd = NULL;
 
-  xy_run ("gem sources -l", 0, pl_ruby_remove_gem_source);
+  // 先读完全部输出再逐个删除，不在 gem 仍在运行时修改它的配置
+  char *gem_sources[16] = {0};
+  XyProc proc = xy_run_iter ("gem sources -l", 0, pl_ruby_collect_gem_source, gem_sources);
+  xy_proc_free (&proc);
+  for (int i=0; gem_sources[i]; i++)
+    {
+      cmd = xy_2strjoin ("gem sources -r ", gem_sources[i]);
+      chsrc_run (cmd, RunOpt_Default);
+    }
 
   cmd = xy_2strjoin ("gem source -a ", source.url);
   chsrc_run (cmd, RunOpt_Default);
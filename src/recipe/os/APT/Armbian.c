@@ -4,7 +4,7 @@
  * File Authors  : Shengwei Chen <414685209@qq.com>
  * Contributors  :  Aoran Zeng   <ccmywish@qq.com>
  * Created On    : <2024-06-14>
- * Last Modified : <2024-08-27>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -49,11 +49,9 @@ os_armbian_setsrc (char *option)
 
   chsrc_backup (OS_Armbian_SourceList);
 
-  char *cmd = xy_strjoin (3, "sed -E -i 's@https?[^ ]*armbian/?[^ ]*@", source.url,
-                             "@g' " OS_Armbian_SourceList);
-
-  chsrc_run (cmd, RunOpt_Default);
-  chsrc_run ("apt update", RunOpt_No_Last_New_Line);
+  XyRewrite rules[] = { {"https?[^ ]*armbian/?[^ ]*", source.url} };
+  chsrc_rewrite_file (OS_Armbian_SourceList, rules, xy_arylen (rules), false);
+  apt_refresh (OS_Armbian_SourceList, RunOpt_No_Last_New_Line);
   chsrc_conclude (&source, ChsrcTypeAuto);
 }
 
@@ -5,7 +5,7 @@
  *               |  Heng Guo  <2085471348@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-02>
- * Last Modified : <2024-08-16>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -48,6 +48,7 @@ os_debian_getsrc (char *option)
 void
 os_debian_setsrc_for_deb822 (char *option)
 {
+  apt_preflight_suites (OS_Is_Debian_Literally, true);
   chsrc_yield_source_and_confirm (os_debian);
 
   chsrc_note2 ("如果遇到无法拉取 HTTPS 源的情况，我们会使用 HTTP 源并需要您运行:");
@@ -55,14 +56,18 @@ os_debian_setsrc_for_deb822 (char *option)
 
   chsrc_backup (OS_Debian_SourceList_DEB822);
 
-  char *cmd = xy_strjoin (3, "sed -E -i 's@https?://.*/debian/?@", source.url, "@g' " OS_Debian_SourceList_DEB822);
-  chsrc_run (cmd, RunOpt_Default);
-
-  // debian-security 源和其他源不一样
-  cmd = xy_strjoin (3, "sed -E -i 's@https?://.*/debian-security/?@", source.url, "-security@g' " OS_Debian_SourceList_DEB822);
-  chsrc_run (cmd, RunOpt_Default);
-
-  chsrc_run ("apt update", RunOpt_No_Last_New_Line);
+  // apt update 超时后，换用测速排名下一位的镜像站重新改写
+  do
+    {
+      XyRewrite rules[] = {
+        {"https?://.*/debian/?", source.url},
+        // debian-security 源和其他源不一样
+        {"https?://.*/debian-security/?", xy_2strjoin (source.url, "-security")}
+      };
+      chsrc_rewrite_file (OS_Debian_SourceList_DEB822, rules, xy_arylen (rules), false);
+    }
+  while (Run_Timeout==apt_refresh (OS_Debian_SourceList_DEB822, RunOpt_Retry_On_Timeout|RunOpt_No_Last_New_Line)
+         && chsrc_retry_with_next_source (os_debian));
   chsrc_conclude (&source, ChsrcTypeAuto);
 }
 
@@ -87,6 +92,7 @@ os_debian_setsrc (char *option)
   // Docker环境下，Debian镜像可能不存在该文件
   bool sourcelist_exist = ensure_apt_sourcelist (OS_Is_Debian_Literally);
 
+  apt_preflight_suites (OS_Is_Debian_Literally, false);
   chsrc_yield_source_and_confirm (os_debian);
 
   chsrc_note2 ("如果遇到无法拉取 HTTPS 源的情况，我们会使用 HTTP 源并需要您运行:");
@@ -98,10 +104,14 @@ os_debian_setsrc (char *option)
       chsrc_backup (OS_Apt_SourceList);
     }
 
-  char *cmd = xy_strjoin (3, "sed -E -i \'s@https?://.*/debian/?@", source.url, "@g\' " OS_Apt_SourceList);
-
-  chsrc_run (cmd, RunOpt_Default);
-  chsrc_run ("apt update", RunOpt_No_Last_New_Line);
+  // apt update 超时后，换用测速排名下一位的镜像站重新改写
+  do
+    {
+      XyRewrite rules[] = { {"https?://.*/debian/?", source.url} };
+      chsrc_rewrite_file (OS_Apt_SourceList, rules, xy_arylen (rules), false);
+    }
+  while (Run_Timeout==apt_refresh (OS_Apt_SourceList, RunOpt_Retry_On_Timeout|RunOpt_No_Last_New_Line)
+         && chsrc_retry_with_next_source (os_debian));
   chsrc_conclude (&source, ChsrcTypeAuto);
 }
 
@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-29>
- * Last Modified : <2024-08-16>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -39,11 +39,9 @@ os_linuxmint_setsrc (char *option)
 
   chsrc_backup (OS_LinuxMint_SourceList);
 
-  char* cmd = xy_strjoin (3, "sed -E -i 's@https?://.*/.*/?@", source.url,
-                            "@g' " OS_LinuxMint_SourceList);
-
-  chsrc_run (cmd, RunOpt_Default);
-  chsrc_run ("apt update", RunOpt_No_Last_New_Line);
+  XyRewrite rules[] = { {"https?://.*/.*/?", source.url} };
+  chsrc_rewrite_file (OS_LinuxMint_SourceList, rules, xy_arylen (rules), false);
+  apt_refresh (OS_LinuxMint_SourceList, RunOpt_No_Last_New_Line);
   chsrc_conclude (&source, ChsrcTypeAuto);
   chsrc_warn2 ("完成后请不要再使用 mintsources（自带的图形化软件源设置工具）进行任何操作，因为在操作后，无论是否有按“确定”，mintsources 均会覆写我们刚才换源的内容");
 }
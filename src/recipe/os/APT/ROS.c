@@ -4,7 +4,7 @@
  * File Authors  :  Heng Guo  <2085471348@qq.com>
  * Contributors  : Aoran Zeng <ccmywish@qq.com>
  * Created On    : <2023-09-03>
- * Last Modified : <2024-08-23>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -38,14 +38,14 @@ os_ros_setsrc (char *option)
 
   chsrc_backup (OS_ROS_SourceList);
 
-  char *cmd  = NULL;
-  cmd = xy_strjoin(3, "sed -E -i \'s@https?://.*/ros/ubuntu/?@", source.url, "@/ros/ubuntug\' " OS_ROS_SourceList);
-  chsrc_run(cmd, RunOpt_Default);
+  XyRewrite rules[] = { {"https?://.*/ros/ubuntu/?", xy_2strjoin (source.url, "/ros/ubuntu/")} };
+  chsrc_rewrite_file (OS_ROS_SourceList, rules, xy_arylen (rules), false);
 
-  cmd = "apt-key adv --keyserver 'hkp://keyserver.ubuntu.com:80' --recv-key C1CF6E31E6BADE8868B172B4F42ED6FBAB17C654";
-  chsrc_run (cmd, RunOpt_Default);
+  // 密钥服务器无响应时 apt-key 会一直等待
+  char *cmd = "apt-key adv --keyserver 'hkp://keyserver.ubuntu.com:80' --recv-key C1CF6E31E6BADE8868B172B4F42ED6FBAB17C654";
+  chsrc_run (cmd, RunOpt_Timeout(120)|RunOpt_Default);
 
-  chsrc_run ("apt update", RunOpt_No_Last_New_Line);
+  apt_refresh (OS_ROS_SourceList, RunOpt_No_Last_New_Line);
   chsrc_conclude (&source, ChsrcTypeUntested);
 }
 
@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-29>
- * Last Modified : <2024-08-16>
+ * Last Modified : <2026-10-18>
  *
  * Raspberry Pi OS 树莓派操作系统，以前称为 Raspbian
  * ------------------------------------------------------------*/
@@ -39,11 +39,9 @@ os_raspberrypi_setsrc (char *option)
 
   chsrc_backup (OS_RaspberryPi_SourceList);
 
-  char *cmd = xy_strjoin (3, "sed -E -i 's@https?://.*/.*/?@", source.url,
-                            "@g' " OS_RaspberryPi_SourceList);
-
-  chsrc_run (cmd, RunOpt_Default);
-  chsrc_run ("apt update", RunOpt_No_Last_New_Line);
+  XyRewrite rules[] = { {"https?://.*/.*/?", source.url} };
+  chsrc_rewrite_file (OS_RaspberryPi_SourceList, rules, xy_arylen (rules), false);
+  apt_refresh (OS_RaspberryPi_SourceList, RunOpt_No_Last_New_Line);
   chsrc_conclude (&source, ChsrcTypeUntested);
 }
 
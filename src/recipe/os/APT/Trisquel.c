@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-29>
- * Last Modified : <2024-08-16>
+ * Last Modified : <2026-10-18>
  *
  * Trisquel基于Ubuntu开发，不含任何专有软件及专有固件，内核使用 Linux-libre
  * ------------------------------------------------------------*/
@@ -41,10 +41,9 @@ os_trisquel_setsrc (char *option)
 
   chsrc_backup (OS_Apt_SourceList);
 
-  char *cmd = xy_strjoin (3, "sed -E -i 's@https?://.*/trisquel/?@", source.url, "@g' /etc/apt/sources.list");
-
-  chsrc_run (cmd, RunOpt_Default);
-  chsrc_run ("apt update", RunOpt_No_Last_New_Line);
+  XyRewrite rules[] = { {"https?://.*/trisquel/?", source.url} };
+  chsrc_rewrite_file (OS_Apt_SourceList, rules, xy_arylen (rules), false);
+  apt_refresh (OS_Apt_SourceList, RunOpt_No_Last_New_Line);
   chsrc_conclude (&source, ChsrcTypeUntested);
 }
 
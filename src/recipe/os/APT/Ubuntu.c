@@ -5,7 +5,7 @@
  *               |  Heng Guo  <2085471348@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-08-30>
- * Last Modified : <2024-08-16>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -53,23 +53,28 @@ os_ubuntu_getsrc (char *option)
 void
 os_ubuntu_setsrc_for_deb822 (char *option)
 {
+  apt_preflight_suites (OS_Is_Ubuntu, false);
   chsrc_yield_source_and_confirm (os_ubuntu);
 
   chsrc_backup (OS_Ubuntu_SourceList_DEB822);
 
   char *arch = chsrc_get_cpuarch ();
-  char *cmd  = NULL;
-  if (strncmp (arch, "x86_64", 6)==0)
+  // apt update 超时后，换用测速排名下一位的镜像站重新改写
+  do
     {
-      cmd = xy_strjoin (3, "sed -E -i \'s@https?://.*/ubuntu/?@", source.url, "@g\' " OS_Ubuntu_SourceList_DEB822);
+      if (strncmp (arch, "x86_64", 6)==0)
+        {
+          XyRewrite rules[] = { {"https?://.*/ubuntu/?", source.url} };
+          chsrc_rewrite_file (OS_Ubuntu_SourceList_DEB822, rules, xy_arylen (rules), false);
+        }
+      else
+        {
+          XyRewrite rules[] = { {"https?://.*/ubuntu-ports/?", xy_2strjoin (source.url, "-ports")} };
+          chsrc_rewrite_file (OS_Ubuntu_SourceList_DEB822, rules, xy_arylen (rules), false);
+        }
     }
-  else
-    {
-      cmd = xy_strjoin (3, "sed -E -i \'s@https?://.*/ubuntu-ports/?@", source.url, "-ports@g\' " OS_Ubuntu_SourceList_DEB822);
-    }
-
-  chsrc_run (cmd, RunOpt_Default);
-  chsrc_run ("apt update", RunOpt_No_Last_New_Line);
+  while (Run_Timeout==apt_refresh (OS_Ubuntu_SourceList_DEB822, RunOpt_Retry_On_Timeout|RunOpt_No_Last_New_Line)
+         && chsrc_retry_with_next_source (os_ubuntu));
   chsrc_conclude (&source, ChsrcTypeAuto);
 }
 
@@ -90,6 +95,7 @@ os_ubuntu_setsrc (char *option)
 
   bool sourcelist_exist = ensure_apt_sourcelist (OS_Is_Ubuntu);
 
+  apt_preflight_suites (OS_Is_Ubuntu, false);
   chsrc_yield_source_and_confirm (os_ubuntu);
 
   // 不存在的时候，用的是我们生成的无效文件，不要备份
@@ -99,18 +105,22 @@ os_ubuntu_setsrc (char *option)
     }
 
   char *arch = chsrc_get_cpuarch ();
-  char *cmd  = NULL;
-  if (0==strncmp (arch, "x86_64", 6))
+  // apt update 超时后，换用测速排名下一位的镜像站重新改写
+  do
     {
-      cmd = xy_strjoin (3, "sed -E -i \'s@https?://.*/ubuntu/?@", source.url, "@g\' " OS_Apt_SourceList);
+      if (0==strncmp (arch, "x86_64", 6))
+        {
+          XyRewrite rules[] = { {"https?://.*/ubuntu/?", source.url} };
+          chsrc_rewrite_file (OS_Apt_SourceList, rules, xy_arylen (rules), false);
+        }
+      else
+        {
+          XyRewrite rules[] = { {"https?://.*/ubuntu-ports/?", xy_2strjoin (source.url, "-ports")} };
+          chsrc_rewrite_file (OS_Apt_SourceList, rules, xy_arylen (rules), false);
+        }
     }
-  else
-    {
-      cmd = xy_strjoin (3, "sed -E -i \'s@https?://.*/ubuntu-ports/?@", source.url, "-ports@g\' " OS_Apt_SourceList);
-    }
-
-  chsrc_run (cmd, RunOpt_Default);
-  chsrc_run ("apt update", RunOpt_No_Last_New_Line);
+  while (Run_Timeout==apt_refresh (OS_Apt_SourceList, RunOpt_Retry_On_Timeout|RunOpt_No_Last_New_Line)
+         && chsrc_retry_with_next_source (os_ubuntu));
   chsrc_conclude (&source, ChsrcTypeAuto);
 }
 
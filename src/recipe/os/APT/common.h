@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2024-06-14>
- * Last Modified : <2024-08-16>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 #define OS_Apt_SourceList   "/etc/apt/sources.list"
@@ -21,8 +21,6 @@
 #define OS_Ubuntu_SourceList_DEB822 "/etc/apt/sources.list.d/ubuntu.sources"
 
 
-#define ETC_OS_RELEASE    "/etc/os-release"
-
 #define OS_Is_Debian_Literally  1
 #define OS_Is_Ubuntu            2
 
@@ -37,6 +35,58 @@
 #define OS_RaspberryPi_SourceList OS_Apt_SourceList_D "raspi.list"
 
 
+/**
+ * 换源后刷新，full 时还会升级整个系统，见 chsrc_refresh()
+ *
+ * targeted 时只重新下载 changed_list 中各仓库的索引: 通过 Dir::Etc::sourcelist/sourceparts
+ * 让 apt-get 只看到这一个文件，List-Cleanup=0 保留其他仓库已下载的索引，最后用
+ * apt-cache gencaches 按完整配置重建包缓存，使之与所有仓库一致
+ *
+ * @param  changed_list  本次改写的源配置文件 (.list 或 DEB822 .sources)
+ */
+int
+apt_refresh (const char *changed_list, int run_option)
+{
+  char *targeted = xy_strjoin (3, "apt-get update -o Dir::Etc::sourcelist=", changed_list,
+                                  " -o Dir::Etc::sourceparts=- -o APT::Get::List-Cleanup=0"
+                                  " && apt-cache gencaches");
+  return chsrc_refresh ("apt update", targeted, "apt update && apt upgrade", run_option);
+}
+
+
+/**
+ * 为 Ubuntu/Debian 登记换源前需要预检的各个 suite 的 InRelease，见 chsrc_preflight_path()
+ *
+ * @param  with_security  Debian 的 debian-security 是否也一并换源
+ */
+void
+apt_preflight_suites (int debian_type, bool with_security)
+{
+  char *codename = chsrc_os_release ("VERSION_CODENAME");
+  if (!codename || !codename[0])
+    return;
+
+  if (debian_type == OS_Is_Ubuntu)
+    {
+      char *arch = chsrc_get_cpuarch ();
+      char *prefix = 0==strncmp (arch, "x86_64", 6) ? "" : "-ports";
+      chsrc_preflight_path (xy_strjoin (4, prefix, "/dists/", codename, "/InRelease"));
+      chsrc_preflight_path (xy_strjoin (4, prefix, "/dists/", codename, "-updates/InRelease"));
+      chsrc_preflight_path (xy_strjoin (4, prefix, "/dists/", codename, "-security/InRelease"));
+    }
+  else
+    {
+      chsrc_preflight_path (xy_strjoin (3, "/dists/", codename, "/InRelease"));
+      /* sid 没有 -updates 和 -security */
+      if (xy_streql (codename, "sid"))
+        return;
+      chsrc_preflight_path (xy_strjoin (3, "/dists/", codename, "-updates/InRelease"));
+      if (with_security)
+        chsrc_preflight_path (xy_strjoin (3, "-security/dists/", codename, "-security/InRelease"));
+    }
+}
+
+
 /**
  * 当不存在该文件时，我们只能拼凑一个假的出来，但该函数目前只适用于 Ubuntu 和 Debian
  * 因为其它的 Debian 变体可能不使用 OS_Apt_SourceList，也可能并不适用 `VERSION_CODENAME`
@@ -57,13 +107,11 @@ ensure_apt_sourcelist (int debian_type)
       chsrc_note2 ("将生成新的源配置文件");
     }
 
-  // 反向引用需要escape一下
-  char *codename = xy_run ("sed -nr 's/VERSION_CODENAME=(.*)/\\1/p' " ETC_OS_RELEASE, 0, NULL);
-  codename = xy_str_delete_suffix (codename, "\n");
+  char *codename = chsrc_os_release ("VERSION_CODENAME");
+  if (!codename) codename = "";
 
-  char *version_id = xy_run ("sed -nr 's/VERSION_ID=(.*)/\\1/p' " ETC_OS_RELEASE, 0, NULL);
-  version_id = xy_str_delete_suffix (codename, "\n");
-  double version = atof (version_id);
+  char *version_id = chsrc_os_release ("VERSION_ID");
+  double version = version_id ? atof (version_id) : 0;
 
   char *makeup = NULL;
 
@@ -117,8 +165,6 @@ ensure_apt_sourcelist (int debian_type)
         }
     }
 
-  FILE *f = fopen (OS_Apt_SourceList, "w");
-  fwrite (makeup, strlen (makeup), 1, f);
-  fclose (f);
+  chsrc_overwrite_file (xy_str_delete_suffix (makeup, "\n"), OS_Apt_SourceList);
   return false;
 }
@@ -4,7 +4,7 @@
  * File Authors  :  Heng Guo  <2085471348@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-26>
- * Last Modified : <2024-08-16>
+ * Last Modified : <2026-10-18>
  *
  * 名称为小写deepin，而非Deepin
  * ------------------------------------------------------------*/
@@ -45,12 +45,9 @@ os_deepin_setsrc (char *option)
 
   chsrc_backup (OS_Apt_SourceList);
 
-  char *cmd = xy_strjoin (3, "sed -E -i \'s@https?://.*/deepin/?@",
-                              source.url,
-                              "@g\' " OS_Apt_SourceList);
-
-  chsrc_run (cmd, RunOpt_Default);
-  chsrc_run ("apt update", RunOpt_No_Last_New_Line);
+  XyRewrite rules[] = { {"https?://.*/deepin/?", source.url} };
+  chsrc_rewrite_file (OS_Apt_SourceList, rules, xy_arylen (rules), false);
+  apt_refresh (OS_Apt_SourceList, RunOpt_No_Last_New_Line);
   chsrc_conclude (&source, ChsrcTypeUntested);
 }
 
@@ -4,7 +4,7 @@
  * File Authors  :  Heng Guo  <2085471348@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-06>
- * Last Modified : <2024-08-16>
+ * Last Modified : <2026-10-18>
  *
  * openKylin直接基于Linux内核开发，属于和Debian、openSUSE、Fedora、Arch
  * 同一级别的、根社区发布的系统
@@ -36,9 +36,9 @@ os_openkylin_setsrc (char *option)
 
   chsrc_backup (OS_Apt_SourceList);
 
-  char *cmd = xy_strjoin (3, "sed -E -i 's@https?://.*/openkylin/?@", source.url, "@g'" OS_Apt_SourceList);
-  chsrc_run (cmd, RunOpt_Default);
-  chsrc_run ("apt update", RunOpt_No_Last_New_Line);
+  XyRewrite rules[] = { {"https?://.*/openkylin/?", source.url} };
+  chsrc_rewrite_file (OS_Apt_SourceList, rules, xy_arylen (rules), false);
+  apt_refresh (OS_Apt_SourceList, RunOpt_No_Last_New_Line);
   chsrc_conclude (&source, ChsrcTypeUntested);
 }
 
@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-24>
- * Last Modified : <2024-08-16>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -41,12 +41,10 @@ os_alpine_setsrc (char *option)
 
   chsrc_yield_source_and_confirm (os_alpine);
 
-  char* cmd = xy_strjoin (3,
-            "sed -i 's#https\\?://dl-cdn.alpinelinux.org/alpine#", source.url, "#g' /etc/apk/repositories"
-            );
-  chsrc_run (cmd, RunOpt_Default);
+  XyRewrite rules[] = { {"https?://dl-cdn\\.alpinelinux\\.org/alpine", source.url} };
+  chsrc_rewrite_file ("/etc/apk/repositories", rules, xy_arylen (rules), false);
 
-  chsrc_run ("apk update", RunOpt_No_Last_New_Line);
+  chsrc_refresh ("apk update", NULL, "apk update && apk upgrade", RunOpt_No_Last_New_Line);
   chsrc_conclude (&source, ChsrcTypeUntested);
 }
 
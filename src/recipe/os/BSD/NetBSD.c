@@ -5,7 +5,7 @@
  *               |  Heng Guo  <2085471348@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-05>
- * Last Modified : <2024-08-16>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -51,8 +51,9 @@ os_netbsd_setsrc (char *option)
   chsrc_backup ("/usr/pkg/etc/pkgin/repositories.conf");
 
   char *arch = chsrc_get_cpuarch ();
-  char *vercmd  = "cat /etc/os-release | grep \"VERSION=\" | grep -Po \"[8-9].[0-9]+\"";
-  char *version = xy_run (vercmd, 0, NULL);
+  // NetBSD 的内核版本即系统版本，如 9.3, 10.0；但也可能带有后缀，如 9.3_STABLE, 10.99.10_PATCH
+  char *version = xy_strdup (chsrc_platform ()->release);
+  version[strspn (version, "0123456789.")] = '\0';
 
   char *url = xy_strjoin (5, source.url, arch, "/", version, "/All");
   chsrc_overwrite_file (url, "/usr/pkg/etc/pkgin/repositories.conf");
@@ -4,7 +4,7 @@
  * File Authors  : Heng Guo <2085471348@qq.com>
  * Contributors  : Nil Null <nil@null.org>
  * Created On    : <2023-09-05>
- * Last Modified : <2024-08-16>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -37,14 +37,12 @@ os_gentoo_setsrc (char *option)
 
   chsrc_backup ("/etc/portage/repos.conf/gentoo.conf");
 
-  char *cmd = xy_strjoin (3, "sed -i \"s#rsync://.*/gentoo-portage#rsync://",
-                             source.url,
-                            "gentoo-portage#g");
-  chsrc_run (cmd, RunOpt_Default);
+  XyRewrite rules[] = { {"rsync://.*/gentoo-portage", xy_strjoin (3, "rsync://", source.url, "/gentoo-portage")} };
+  chsrc_rewrite_file ("/etc/portage/repos.conf/gentoo.conf", rules, xy_arylen (rules), false);
 
-  char *towrite = xy_strjoin (3, "GENTOO_MIRRORS=\"https://", source.url, "gentoo\"");
+  char *towrite = xy_strjoin (3, "GENTOO_MIRRORS=\"https://", source.url, "/gentoo\"");
 
-  chsrc_append_to_file (towrite, "/etc/portage/make.conf");
+  chsrc_write_managed_block ("gentoo", towrite, "/etc/portage/make.conf");
   chsrc_conclude (&source, ChsrcTypeUntested);
 }
 
@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2024-08-08>
- * Last Modified : <2024-08-08>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -46,9 +46,11 @@ os_openwrt_setsrc (char *option)
 
   chsrc_backup (OS_OpenWRT_SourceConfig);
 
-  char *cmd = xy_strjoin (3, "sed -E -i 's@https?://.*downloads.openwrt.org@", source.url, "@g' " OS_OpenWRT_SourceConfig);
+  XyRewrite rules[] = { {"https?://.*downloads\\.openwrt\\.org", source.url} };
+  chsrc_rewrite_file (OS_OpenWRT_SourceConfig, rules, xy_arylen (rules), false);
 
-  chsrc_run ("apt update", RunOpt_No_Last_New_Line);
+  // OpenWrt 不建议 opkg upgrade，full 时也只刷新
+  chsrc_refresh ("opkg update", NULL, NULL, RunOpt_No_Last_New_Line);
   chsrc_conclude (&source, ChsrcTypeAuto);
 }
 
@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-24>
- * Last Modified : <2024-08-16>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -41,17 +41,12 @@ os_void_setsrc (char *option)
   char *cmd = "cp /usr/share/xbps.d/*-repository-*.conf /etc/xbps.d/";
   chsrc_run (cmd, RunOpt_Default);
 
-  cmd = xy_strjoin (3,
-            "sed -i 's|https://repo-default.voidlinux.org|", source.url, "|g' /etc/xbps.d/*-repository-*.conf"
-            );
-  chsrc_run (cmd, RunOpt_Default);
-
-  cmd = xy_strjoin (3,
-            "sed -i 's|https://alpha.de.repo.voidlinux.org|", source.url, "|g' /etc/xbps.d/*-repository-*.conf"
-            );
-
-  chsrc_note2 ("若报错可尝试使用以下命令:");
-  say (cmd);
+  // 旧版本的默认源为 alpha.de.repo.voidlinux.org
+  XyRewrite rules[] = {
+    {"https://repo-default\\.voidlinux\\.org",     source.url},
+    {"https://alpha\\.de\\.repo\\.voidlinux\\.org", source.url}
+  };
+  chsrc_rewrite_file ("/etc/xbps.d/*-repository-*.conf", rules, xy_arylen (rules), false);
   chsrc_conclude (&source, ChsrcTypeUntested);
 }
 
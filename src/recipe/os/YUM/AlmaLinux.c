@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2024-06-12>
- * Last Modified : <2024-08-16>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -31,11 +31,13 @@ os_almalinux_setsrc (char *option)
 
   chsrc_yield_source_and_confirm (os_almalinux);
 
-  char *cmd = xy_strjoin (3,
-    "sed -e 's|^mirrorlist=|#mirrorlist=|g' -e 's|^#\\s*baseurl=https://repo.almalinux.org/almalinux|baseurl=", source.url, "|g'  -i.bak  /etc/yum.repos.d/almalinux*.repo");
+  XyRewrite rules[] = {
+    {"^mirrorlist=", "#mirrorlist="},
+    {"^#\\s*baseurl=https://repo\\.almalinux\\.org/almalinux", xy_2strjoin ("baseurl=", source.url)}
+  };
+  chsrc_rewrite_file ("/etc/yum.repos.d/almalinux*.repo", rules, xy_arylen (rules), true);
 
-  chsrc_run (cmd, RunOpt_Default);
-  chsrc_run ("dnf makecache", RunOpt_No_Last_New_Line);
+  chsrc_refresh ("dnf makecache", NULL, "dnf upgrade --refresh", RunOpt_No_Last_New_Line);
   chsrc_conclude (&source, ChsrcTypeAuto);
 }
 
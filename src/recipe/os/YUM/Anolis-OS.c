@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-24>
- * Last Modified : <2024-08-16>
+ * Last Modified : <2026-10-18>
  *
  * Anolis OS 为这个操作系统的名字，OpenAnolis(龙蜥社区) 只是社区名
  * ------------------------------------------------------------*/
@@ -31,11 +31,11 @@ os_anolis_setsrc (char *option)
 
   chsrc_yield_source_and_confirm (os_anolis);
 
-  char *cmd = xy_strjoin (3, "sed -i.bak -E 's|https?://(mirrors\\.openanolis\\.cn/anolis)|", source.url, "|g' /etc/yum.repos.d/*.repo");
-  chsrc_run (cmd, RunOpt_Default);
+  XyRewrite rules[] = { {"https?://mirrors\\.openanolis\\.cn/anolis", source.url} };
+  chsrc_rewrite_file ("/etc/yum.repos.d/*.repo", rules, xy_arylen (rules), true);
 
-  chsrc_run ("dnf makecache", RunOpt_Default);
-  chsrc_run ("dnf update", RunOpt_No_Last_New_Line);
+  // 只有 -refresh=full 时才升级整个系统
+  chsrc_refresh ("dnf makecache", NULL, "dnf upgrade --refresh", RunOpt_No_Last_New_Line);
   chsrc_conclude (&source, ChsrcTypeUntested);
 }
 
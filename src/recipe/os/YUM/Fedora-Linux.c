@@ -4,7 +4,7 @@
  * File Authors  :  Heng Guo  <2085471348@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-26>
- * Last Modified : <2024-08-16>
+ * Last Modified : <2026-10-18>
  *
  * 名称为 Fedora Linux
  * ------------------------------------------------------------*/
@@ -39,27 +39,21 @@ os_fedora_setsrc (char *option)
 
   chsrc_note2 ("Fedora 29 及以下版本暂不支持");
 
-  chsrc_backup ("/etc/yum.repos.d/fedora.repo");
-  chsrc_backup ("/etc/yum.repos.d/fedora-updates.repo");
-
-  char* cmd = xy_strjoin (9, "sed -e 's|^metalink=|#metalink=|g' ",
-         "-e 's|^#baseurl=http://download.example/pub/fedora/linux/|baseurl=",
-         source.url,
-         "|g' ",
-         "-i.bak ",
-         "/etc/yum.repos.d/fedora.repo ",
-         "/etc/yum.repos.d/fedora-modular.repo ",
-         "/etc/yum.repos.d/fedora-updates.repo ",
-         "/etc/yum.repos.d/fedora-updates-modular.repo");
-
-  chsrc_run (cmd, RunOpt_Default);
+  XyRewrite rules[] = {
+    {"^metalink=", "#metalink="},
+    {"^#baseurl=http://download\\.example/pub/fedora/linux/", xy_2strjoin ("baseurl=", source.url)}
+  };
+  chsrc_rewrite_file ("/etc/yum.repos.d/fedora.repo",                 rules, xy_arylen (rules), true);
+  chsrc_rewrite_file ("/etc/yum.repos.d/fedora-modular.repo",         rules, xy_arylen (rules), true);
+  chsrc_rewrite_file ("/etc/yum.repos.d/fedora-updates.repo",         rules, xy_arylen (rules), true);
+  chsrc_rewrite_file ("/etc/yum.repos.d/fedora-updates-modular.repo", rules, xy_arylen (rules), true);
 
   chsrc_log2 ("已替换文件 /etc/yum.repos.d/fedora.repo");
   chsrc_log2 ("已新增文件 /etc/yum.repos.d/fedora-modular.repo");
   chsrc_log2 ("已替换文件 /etc/yum.repos.d/fedora-updates.repo");
   chsrc_log2 ("已新增文件 /etc/yum.repos.d/fedora-updates-modular.repo");
 
-  chsrc_run ("dnf makecache", RunOpt_No_Last_New_Line);
+  chsrc_refresh ("dnf makecache", NULL, "dnf upgrade --refresh", RunOpt_No_Last_New_Line);
   chsrc_conclude (&source, ChsrcTypeAuto);
 }
 
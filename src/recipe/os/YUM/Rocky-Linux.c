@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-24>
- * Last Modified : <2024-08-22>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -37,36 +37,29 @@ os_rockylinux_setsrc (char *option)
   chsrc_yield_source_and_confirm (os_rockylinux);
 
 
-  char *version_str = xy_run ("sed -nr 's/ROCKY_SUPPORT_PRODUCT_VERSION=(.*)/\\1/p' " ETC_OS_RELEASE, 0, NULL);
-  version_str = xy_str_delete_suffix (version_str, "\n");
-  double version = atof (version_str);
+  char *version_str = chsrc_os_release ("ROCKY_SUPPORT_PRODUCT_VERSION");
+  double version = version_str ? atof (version_str) : 0;
 
-  char *cmd = NULL;
+  XyRewrite rules[] = {
+    {"^mirrorlist=", "#mirrorlist="},
+    {"^#baseurl=http://dl\\.rockylinux\\.org/\\$contentdir", xy_2strjoin ("baseurl=", source.url)}
+  };
 
   if (version < 9)
     {
-      cmd = xy_strjoin (3,
-                      "sed -e 's|^mirrorlist=|#mirrorlist=|g' "
-                      "-e 's|^#baseurl=http://dl.rockylinux.org/$contentdir|baseurl=", source.url, "|g' "
-                      "-i.bak /etc/yum.repos.d/Rocky-*.repo"
-                      );
-                      // Rocky-AppStream.repo
-                      // Rocky-BaseOS.repo
-                      // Rocky-Extras
-                      // Rocky-PowerTools
+      // Rocky-AppStream.repo
+      // Rocky-BaseOS.repo
+      // Rocky-Extras
+      // Rocky-PowerTools
+      chsrc_rewrite_file ("/etc/yum.repos.d/Rocky-*.repo", rules, xy_arylen (rules), true);
     }
   else
     {
-      cmd = xy_strjoin (3,
-                      "sed -e 's|^mirrorlist=|#mirrorlist=|g' "
-                      "-e 's|^#baseurl=http://dl.rockylinux.org/$contentdir|baseurl=", source.url, "|g' "
-                      "-i.bak /etc/yum.repos.d/rocky-extras.repo /etc/yum.repos.d/rocky.repo"
-                      );
+      chsrc_rewrite_file ("/etc/yum.repos.d/rocky-extras.repo", rules, xy_arylen (rules), true);
+      chsrc_rewrite_file ("/etc/yum.repos.d/rocky.repo",        rules, xy_arylen (rules), true);
     }
 
-
-  chsrc_run (cmd, RunOpt_Default);
-  chsrc_run ("dnf makecache", RunOpt_No_Last_New_Line);
+  chsrc_refresh ("dnf makecache", NULL, "dnf upgrade --refresh", RunOpt_No_Last_New_Line);
   chsrc_conclude (&source, ChsrcTypeAuto);
 }
 
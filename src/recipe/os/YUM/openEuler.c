@@ -4,7 +4,7 @@
  * File Authors  :  Heng Guo  <2085471348@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-06>
- * Last Modified : <2024-08-16>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -42,7 +42,7 @@ os_openeuler_setsrc (char *option)
 
   chsrc_overwrite_file (towrite, OS_openEuler_SourceList);
 
-  chsrc_run ("dnf makecache", RunOpt_No_Last_New_Line);
+  chsrc_refresh ("dnf makecache", NULL, "dnf upgrade --refresh", RunOpt_No_Last_New_Line);
   chsrc_conclude (&source, ChsrcTypeAuto);
 }
 
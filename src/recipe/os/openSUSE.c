@@ -4,7 +4,7 @@
  * File Authors  : Heng Guo <2085471348@qq.com>
  * Contributors  : Nil Null  <nil@null.org>
  * Created On    : <2023-09-17>
- * Last Modified : <2024-08-16>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -74,6 +74,8 @@ os_opensuse_setsrc (char *option)
 
   chsrc_run (cmd5, RunOpt_Default);
   chsrc_run (cmd6, RunOpt_Default);
+
+  chsrc_refresh ("zypper refresh", NULL, "zypper refresh && zypper update", RunOpt_No_Last_New_Line);
   chsrc_conclude (&source, ChsrcTypeUntested);
 }
 
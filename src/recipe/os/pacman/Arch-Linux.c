@@ -5,7 +5,7 @@
  *               |  Heng Guo  <2085471348@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-05>
- * Last Modified : <2024-08-22>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -63,32 +63,23 @@ os_arch_setsrc (char *option)
 
   chsrc_backup (OS_Pacman_MirrorList);
 
-  bool  is_x86 = false;
   char *to_write = NULL;
   char *arch = chsrc_get_cpuarch ();
 
   if (strncmp(arch, "x86_64", 6)==0)
     {
-      is_x86 = true;
       to_write = xy_strjoin (3, "Server = ", source.url, "/$repo/os/$arch");
     }
   else
     {
-      is_x86 = false;
       to_write = xy_strjoin (3, "Server = ", source.url, "arm/$arch/$repo");
     }
 
   // 越前面的优先级越高
   chsrc_prepend_to_file (to_write, OS_Pacman_MirrorList);
 
-  if (is_x86)
-    {
-      chsrc_run ("pacman -Syyu", RunOpt_No_Last_New_Line);
-    }
-  else
-    {
-      chsrc_run ("pacman -Syy", RunOpt_No_Last_New_Line);
-    }
+  // 只有 -refresh=full 时才升级整个系统
+  chsrc_refresh ("pacman -Syy", NULL, "pacman -Syyu", RunOpt_No_Last_New_Line);
   chsrc_conclude (&source, ChsrcTypeAuto);
 }
 
@@ -119,9 +110,11 @@ os_archlinuxcn_setsrc (char *option)
   chsrc_prepend_to_file (towrite, OS_Pacman_MirrorList);
 
   chsrc_run ("pacman-key --lsign-key \"farseerfc@archlinux.org\"", RunOpt_Dont_Abort_On_Failure);
-  chsrc_run ("pacman -Sy archlinuxcn-keyring", RunOpt_Default);
+  /* 安装 keyring 时已强制以新源刷新了所有仓库，无需再 pacman -Syy */
+  chsrc_run ("pacman -Syy archlinuxcn-keyring", RunOpt_Timeout(Chsrc_Refresh_Timeout)|RunOpt_Default);
 
-  chsrc_run ("pacman -Syy", RunOpt_No_Last_New_Line);
+  if (!chsrc_refresh_satisfied ("pacman"))
+    chsrc_refresh ("pacman -Syy", NULL, "pacman -Syyu", RunOpt_No_Last_New_Line);
   chsrc_conclude (&source, ChsrcTypeUntested);
 }
 #undef OS_Pacman_MirrorList
@@ -4,7 +4,7 @@
  * File Authors  : Heng Guo <2085471348@qq.com>
  * Contributors  : Nil Null <nil@null.org>
  * Created On    : <2023-09-06>
- * Last Modified : <2024-08-16>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -42,11 +42,8 @@ os_msys2_setsrc (char *option)
                              "distrib/<架构>/");
   chsrc_note2 (prev);
 
-  char *cmd = xy_strjoin (3, "sed -i \"s#https\?://mirror.msys2.org/#",
-                              source.url,
-                             "#g\" /etc/pacman.d/mirrorlist* ");
-
-  chsrc_run (cmd, RunOpt_Default);
+  XyRewrite rules[] = { {"https?://mirror\\.msys2\\.org/", source.url} };
+  chsrc_rewrite_file ("/etc/pacman.d/mirrorlist*", rules, xy_arylen (rules), false);
   chsrc_conclude (&source, ChsrcTypeUntested);
 }
 
@@ -4,7 +4,7 @@
  * File Authors  : Heng Guo <2085471348@qq.com>
  * Contributors  : Nil Null <nil@null.org>
  * Created On    : <2023-09-06>
- * Last Modified : <2024-08-16>
+ * Last Modified : <2026-10-18>
  *
  * Manjaro Linux（或简称Manjaro）基于Arch Linux
  * ------------------------------------------------------------*/
@@ -19,7 +19,7 @@ os_manjaro_setsrc (char *option)
   char *cmd = "pacman-mirrors -i -c China -m rank";
   chsrc_run (cmd, RunOpt_Default);
 
-  chsrc_run ("pacman -Syy", RunOpt_No_Last_New_Line);
+  chsrc_refresh ("pacman -Syy", NULL, "pacman -Syyu", RunOpt_No_Last_New_Line);
   chsrc_conclude (NULL, ChsrcTypeAuto);
 }
 
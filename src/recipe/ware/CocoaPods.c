@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2024-06-08>
- * Last Modified : <2024-08-15>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -24,6 +24,7 @@ def_sources_n(wr_cocoapods);
 void
 wr_cocoapods_setsrc (char *option)
 {
+  chsrc_git_probe_repo ("", "");
   chsrc_yield_source_and_confirm (wr_cocoapods);
 
   chsrc_note2 ("请手动执行以下命令:");
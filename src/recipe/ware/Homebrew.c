@@ -4,8 +4,8 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-10>
- * Last Modified : <2024-08-28>
- * Revision      :      3
+ * Last Modified : <2026-10-18>
+ * Revision      :      4
  * ------------------------------------------------------------*/
 
 /**
@@ -46,48 +46,22 @@ wr_homebrew_getsrc (char *option)
 void
 wr_homebrew_setsrc (char *option)
 {
+  chsrc_git_probe_repo ("", "git/homebrew/brew.git");
   chsrc_yield_source_and_confirm (wr_homebrew);
 
-  char *splitter        = "\n\n# Generated by chsrc " Chsrc_Banner_Version;
-  char *api_domain      = xy_strjoin (3, "export HOMEBREW_API_DOMAIN=\"",      xy_2strjoin (source.url, "homebrew-bottles/api"),  "\"");
-  char *bottle_domain   = xy_strjoin (3, "export HOMEBREW_BOTTLE_DOMAIN=\"",   xy_2strjoin (source.url, "homebrew-bottles"),      "\"");
-  char *brew_git_remote = xy_strjoin (3, "export HOMEBREW_BREW_GIT_REMOTE=\"", xy_2strjoin (source.url, "git/homebrew/brew.git"), "\"");
-  char *core_git_remote = xy_strjoin (3, "export HOMEBREW_CORE_GIT_REMOTE=\"", xy_2strjoin (source.url, "git/homebrew/homebrew-core.git"), "\"");
-
-  char *zshrc = "~/.zshrc";
-  chsrc_backup (zshrc);
-  chsrc_append_to_file (splitter,        zshrc);
-  chsrc_append_to_file (api_domain,      zshrc);
-  chsrc_append_to_file (bottle_domain,   zshrc);
-  chsrc_append_to_file (brew_git_remote, zshrc);
-  chsrc_append_to_file (core_git_remote, zshrc);
-
-  char *bashrc = "~/.bashrc";
-  if (xy_file_exist (bashrc))
-    {
-      chsrc_backup (bashrc);
-      chsrc_append_to_file (splitter,        bashrc);
-      chsrc_append_to_file (api_domain,      bashrc);
-      chsrc_append_to_file (bottle_domain,   bashrc);
-      chsrc_append_to_file (brew_git_remote, bashrc);
-      chsrc_append_to_file (core_git_remote, bashrc);
-    }
-
-  char *fishrc = "~/.config/fish/config.fish";
-  if (xy_file_exist (fishrc))
-    {
-      char *api_domain_fish = xy_strjoin(3, "set -x HOMEBREW_API_DOMAIN \"",           xy_2strjoin(source.url, "homebrew-bottles/api"), "\"");
-      char *bottle_domain_fish = xy_strjoin(3, "set -x HOMEBREW_BOTTLE_DOMAIN \"",     xy_2strjoin(source.url, "homebrew-bottles"), "\"");
-      char *brew_git_remote_fish = xy_strjoin(3, "set -x HOMEBREW_BREW_GIT_REMOTE \"", xy_2strjoin(source.url, "git/homebrew/brew.git"), "\"");
-      char *core_git_remote_fish = xy_strjoin(3, "set -x HOMEBREW_CORE_GIT_REMOTE \"", xy_2strjoin(source.url, "git/homebrew/homebrew-core.git"), "\"");
-
-      chsrc_backup (fishrc);
-      chsrc_append_to_file (splitter,             fishrc);
-      chsrc_append_to_file (api_domain_fish,      fishrc);
-      chsrc_append_to_file (bottle_domain_fish,   fishrc);
-      chsrc_append_to_file (brew_git_remote_fish, fishrc);
-      chsrc_append_to_file (core_git_remote_fish, fishrc);
-    }
+  const char *names[] = {
+    "HOMEBREW_API_DOMAIN",
+    "HOMEBREW_BOTTLE_DOMAIN",
+    "HOMEBREW_BREW_GIT_REMOTE",
+    "HOMEBREW_CORE_GIT_REMOTE"
+  };
+  const char *values[] = {
+    xy_2strjoin (source.url, "homebrew-bottles/api"),
+    xy_2strjoin (source.url, "homebrew-bottles"),
+    xy_2strjoin (source.url, "git/homebrew/brew.git"),
+    xy_2strjoin (source.url, "git/homebrew/homebrew-core.git")
+  };
+  chsrc_write_env_vars ("brew", names, values, xy_arylen (names));
 
   chsrc_conclude(&source, ChsrcTypeAuto);
   chsrc_note2 ("请您重启终端使Homebrew环境变量生效");
@@ -109,7 +83,7 @@ wr_homebrew_feat (char *option)
   /* 该换源方案中，URL存在拼凑，因此不能让用户手动使用某URL来换源 */
   fi.can_user_define = false;
 
-  fi.note = "该换源通过写入环境变量实现，若多次换源，请手动清理profile文件";
+  fi.note = "该换源通过写入环境变量实现，变量统一保存在 ~/.config/chsrc/env.sh 与 env.fish 中，由各 shell 配置文件加载";
   return fi;
 }
 
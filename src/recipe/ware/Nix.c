@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-26>
- * Last Modified : <2024-08-15>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -44,9 +44,9 @@ wr_nix_setsrc (char *option)
   chsrc_run (cmd, RunOpt_Default);
 
   char *towrite = xy_strjoin (3, "substituters = ", source.url, "store https://cache.nixos.org/");
-  chsrc_append_to_file (towrite , "~/.config/nix/nix.conf");
+  chsrc_write_managed_block ("nix", towrite, "~/.config/nix/nix.conf");
 
-  chsrc_run ("nix-channel --update", RunOpt_Default);
+  chsrc_refresh ("nix-channel --update", NULL, NULL, RunOpt_Default);
 
   chsrc_note2 ("若您使用的是NixOS，请确认您的系统版本<version>（如22.11），并手动运行:");
   cmd = xy_strjoin (3, "nix-channel --add ", source.url, "nixpkgs-<version> nixpkgs");
@@ -4,7 +4,7 @@
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Contributors  :  Nil Null  <nil@null.org>
  * Created On    : <2023-09-10>
- * Last Modified : <2024-08-15>
+ * Last Modified : <2026-10-18>
  * ------------------------------------------------------------*/
 
 /**
@@ -26,8 +26,14 @@ def_sources_n(wr_tex);
 void
 wr_tex_check_cmd (bool *tlmgr_exist, bool *mpm_exist)
 {
-  *tlmgr_exist = chsrc_check_program ("tlmgr");
-  *mpm_exist = chsrc_check_program ("mpm");
+  ProgramProbe probes[] = {
+    {.name = "tlmgr"},
+    {.name = "mpm"}
+  };
+  chsrc_detect_programs (probes, xy_arylen(probes), true);
+
+  *tlmgr_exist = probes[0].exist;
+  *mpm_exist   = probes[1].exist;
 
   if (!*tlmgr_exist && !*mpm_exist)
     {
@@ -4,13 +4,24 @@
  * File Name     : xy.c
  * File Authors  : Aoran Zeng <ccmywish@qq.com>
  * Created On    : <2023-08-30>
- * Last Modified : <2024-08-17>
+ * Last Modified : <2026-10-18>
  *
  * 测试 xy.h
  * ------------------------------------------------------------*/
 
 #include "xy.h"
 
+static bool
+count_lines (const char *line, size_t len, void *ctx)
+{
+  int *counter = (int *) ctx;
+  assert (len == strlen (line));
+  counter[0]++;
+  counter[1] += (int) len;
+  /* counter[2] 为非 0 时，读到该行数后停止 */
+  return counter[0] != counter[2];
+}
+
 int
 main (int argc, char const *argv[])
 {
@@ -75,6 +86,9 @@ main (int argc, char const *argv[])
   assert_str ("abcdefg", xy_str_delete_prefix ("abcdefg", ""));
   assert_str ("defg",    xy_str_delete_prefix ("abcdefg", "abc"));
 
+  assert_str ("abc", xy_strndup ("abcdef", 3));
+  assert_str ("ab",  xy_strndup ("ab", 5));
+
   assert_str ("defdef",   xy_str_gsub ("abcdefabcdef", "abc", ""));    // 删除
   assert_str ("6def6def", xy_str_gsub ("abcdefabcdef", "abc", "6")); // 缩小
   assert_str ("XIANGdefXIANGdef",
@@ -83,6 +97,116 @@ main (int argc, char const *argv[])
               xy_str_gsub ("abcdefabcdef", "abc", "DEF")); // 等量
 
 
+  {
+    XyRewrite rules[] = {
+      {"https?://.*/ubuntu/?", "https://mirrors.ustc.edu.cn/ubuntu/"},
+      {"^#\\s*baseurl=", "baseurl="}
+    };
+    int count = 0;
+    assert_str ("deb https://mirrors.ustc.edu.cn/ubuntu/ jammy main\nbaseurl=x\n",
+                xy_str_rewrite ("deb http://archive.ubuntu.com/ubuntu/ jammy main\n#  baseurl=x\n", rules, 2, &count));
+    assert (2 == count);
+
+    XyRewrite groups[] = { {"(a|b)+", "<\\1\\0>"} };
+    assert_str ("<baab> c<bab>", xy_str_rewrite ("aab cab", groups, 1, NULL));
+
+    /* 与 sed 一致: 空匹配在每个字符间替换，但不紧跟在上一个匹配之后 */
+    XyRewrite empty[] = { {"x*", "-"}, {"[^ ]*", "!"} };
+    assert_str ("-a-b-c-", xy_str_rewrite ("abc", empty, 1, NULL));
+    assert_str ("! !", xy_str_rewrite ("ab cd", empty + 1, 1, NULL));
+
+    XyRewrite literal[] = { {"\\$contentdir\\.", "C"} };
+    assert_str ("C/x $contentdirX", xy_str_rewrite ("$contentdir./x $contentdirX", literal, 1, NULL));
+
+    assert (NULL == xy_regex_compile ("(a"));
+    assert (NULL == xy_regex_compile ("[ab"));
+    assert (NULL == xy_regex_compile ("*a"));
+    assert (NULL == xy_regex_compile ("(a*)*"));
+    XyRewrite bad[] = { {"(a", "b"} };
+    assert (NULL == xy_str_rewrite ("a", bad, 1, NULL));
+  }
+
+  {
+    assert (NULL == xy_str_diff ("a\nb\n", "a\nb\n", "a/f", "b/f"));
+    assert_str ("--- a/f\n+++ b/f\n"
+                "@@ -1,3 +1,3 @@\n a\n-b\n+B\n c\n",
+                xy_str_diff ("a\nb\nc\n", "a\nB\nc\n", "a/f", "b/f"));
+    assert_str ("--- /dev/null\n+++ b/f\n@@ -0,0 +1 @@\n+x\n",
+                xy_str_diff ("", "x\n", "/dev/null", "b/f"));
+    /* 只补上了最后的换行符 */
+    assert_str ("--- a/f\n+++ b/f\n@@ -1 +1,2 @@\n-x\n\\ No newline at end of file\n+x\n+y\n",
+                xy_str_diff ("x", "x\ny\n", "a/f", "b/f"));
+    /* 两处改动之间恰有 6 行不变时，与 diff -u 一样合为一个 hunk */
+    assert_str ("--- a/f\n+++ b/f\n"
+                "@@ -1,11 +1,11 @@\n-1\n+one\n 2\n 3\n 4\n 5\n 6\n 7\n-8\n+eight\n 9\n 10\n 11\n",
+                xy_str_diff ("1\n2\n3\n4\n5\n6\n7\n8\n9\n10\n11\n",
+                             "one\n2\n3\n4\n5\n6\n7\neight\n9\n10\n11\n", "a/f", "b/f"));
+    /* 相距较远的改动分为两个 hunk */
+    assert_str ("--- a/f\n+++ b/f\n"
+                "@@ -1,4 +1,4 @@\n-1\n+one\n 2\n 3\n 4\n"
+                "@@ -7,4 +7,4 @@\n 7\n 8\n 9\n-10\n+ten\n",
+                xy_str_diff ("1\n2\n3\n4\n5\n6\n7\n8\n9\n10\n",
+                             "one\n2\n3\n4\n5\n6\n7\n8\n9\nten\n", "a/f", "b/f"));
+  }
+
+
+  char **args = xy_cmd_split ("sed -E -i 's@a b@c@g' \"x y\" z\\ w");
+  assert_str ("sed",       args[0]);
+  assert_str ("s@a b@c@g", args[3]);
+  assert_str ("x y",       args[4]);
+  assert_str ("z w",       args[5]);
+  assert (NULL == args[6]);
+  xy_argv_free (args);
+  assert (NULL == xy_cmd_split ("echo a | wc -l"));
+  assert (NULL == xy_cmd_split ("echo \"$HOME\""));
+  assert (NULL == xy_cmd_split ("LANG=C ls"));
+
+  if (!xy_on_windows)
+    {
+      XyProc proc = xy_spawn_cmd ("sh -c 'echo out; echo err >&2; exit 3'",
+                                  XyProc_Capture_Stdout | XyProc_Capture_Stderr);
+      assert (3 == proc.exit_code);
+      assert_str ("out\n", proc.out);
+      assert_str ("err\n", proc.err);
+      xy_proc_free (&proc);
+
+      proc = xy_spawn_cmd ("sh -c 'kill -9 $$'", 0);
+      assert (9 == proc.signal);
+
+      proc = xy_spawn_cmd ("chsrc-no-such-command", XyProc_Quiet);
+      assert (127 == proc.exit_code);
+
+      assert (xy_str_end_with (xy_which ("sh"), "/sh"));
+      assert (NULL == xy_which ("chsrc-no-such-command"));
+      assert_str ("/bin/sh", xy_which ("/bin/sh"));
+
+      assert_str ("b\n", xy_run ("printf 'a\\nb\\n'", 0, NULL));
+      assert_str ("a\n", xy_run ("printf 'a\\nb\\n'", 1, NULL));
+      assert_str ("c\n", xy_run ("printf 'a\\nb\\nc'", 0, NULL));
+
+      int counter[3] = {0};
+      proc = xy_run_iter ("sh -c 'head -c 100000 /dev/zero | tr \"\\\\0\" x; echo; echo end'", 0, count_lines, counter);
+      assert (xy_proc_succ (&proc));
+      assert (2 == counter[0]);
+      assert (100003 == counter[1]);
+
+      int stop[3] = {0, 0, 2};
+      proc = xy_run_iter ("seq 1 100000", 0, count_lines, stop);
+      assert (2 == stop[0]);
+
+      /* 超时后整个进程组都被终止，包括后台的 sleep */
+      time_t begin = time (NULL);
+      proc = xy_spawn_cmd_timeout ("sh -c 'sleep 30 & sleep 30'", XyProc_Capture_Stdout, 1);
+      assert (proc.timed_out);
+      assert (!xy_proc_succ (&proc));
+      assert (time (NULL) - begin < 10);
+      xy_proc_free (&proc);
+
+      proc = xy_spawn_cmd_timeout ("sh -c 'exit 4'", 0, 5);
+      assert (!proc.timed_out);
+      assert (4 == proc.exit_code);
+    }
+
   assert (xy_file_exist ("./image/chsrc.png"));
   assert (xy_dir_exist ("~"));
   if (xy_on_windows)
@@ -95,8 +219,66 @@ main (int argc, char const *argv[])
     {
       assert (xy_file_exist ("~/.bashrc"));
       assert (xy_dir_exist ("/etc"));
+      assert (!xy_dir_exist ("/etc/passwd"));
     }
 
+  {
+    char *base = xy_2strjoin (xy_on_windows ? getenv ("TEMP") : "/tmp", "/xy-test-mkdir");
+    char *deep = xy_2strjoin (base, "/a/b/c");
+    assert (!xy_dir_exist (deep));
+    assert (xy_mkdir_p (deep));
+    assert (xy_dir_exist (deep));
+    assert (xy_mkdir_p (deep)); /* 已存在 */
+    rmdir (deep);
+    rmdir (xy_2strjoin (base, "/a/b"));
+    rmdir (xy_2strjoin (base, "/a"));
+    rmdir (base);
+    assert (!xy_dir_exist (base));
+  }
+
+
+  {
+    char *tmp = xy_2strjoin (xy_on_windows ? getenv ("TEMP") : "/tmp", "/xy-test-rewrite.txt");
+    assert (xy_file_write (tmp, "a=1\nb=2\n", 8));
+    XyRewrite rules[] = { {"^b=.*", "b=3"}, {"^c=", "d="} };
+    int count = 0;
+    char *result = xy_str_rewrite (xy_file_read (tmp, NULL), rules, 2, &count);
+    assert (1 == count);
+    assert (xy_file_write (tmp, result, strlen (result)));
+    xy_str_rewrite (xy_file_read (tmp, NULL), rules + 1, 1, &count);
+    assert (0 == count);
+    assert_str ("a=1\nb=3\n", xy_file_read (tmp, NULL));
+    remove (tmp);
+    assert (NULL == xy_file_read (tmp, NULL));
+
+#ifndef XY_On_Windows
+      {
+        /* 写入符号链接时，改写的是其指向的文件，并保留原有权限 */
+        char *link = xy_2strjoin (tmp, ".link");
+        assert (xy_file_write (tmp, "x\n", 2));
+        chmod (tmp, 0600);
+        assert (0 == symlink (tmp, link));
+        assert (xy_file_write (link, "y\n", 2));
+        struct stat st;
+        assert (0 == lstat (link, &st) && S_ISLNK (st.st_mode));
+        assert (0 == stat (tmp, &st) && 0600 == (st.st_mode & 0777));
+        assert_str ("y\n", xy_file_read (tmp, NULL));
+        remove (link);
+        remove (tmp);
+      }
+#endif
+  }
+
+  {
+    char *a = xy_tmpfile_create ("xy-test");
+    char *b = xy_tmpfile_create ("xy-test");
+    assert (a && b && !xy_streql (a, b));
+    assert (xy_file_exist (a));
+    assert_str ("", xy_file_read (a, NULL));
+    remove (a);
+    remove (b);
+  }
+
 
   puts (xy_uniform_path (" \n ~/haha/test/123 \n\r "));
   assert_str (xy_uniform_path ("~/haha/test"), xy_parent_dir (" ~/haha/test/123"));